@@ -0,0 +1,184 @@
+#include "command.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+
+// FNV-1a
+static uint32_t hash_name(const char *name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+
+void command_registry_init(command_registry_t *registry, const command_t *commands, uint8_t count) {
+    assert(count < COMMAND_SLOTS);
+    registry->commands = commands;
+    memset(registry->slots, 0, sizeof(registry->slots));
+    for (uint8_t i = 0; i < count; i++) {
+        size_t len = strlen(commands[i].name);
+        assert(command_find(registry, commands[i].name, len) == NULL);   // duplicate name
+        // linear probing, the index is never full
+        uint32_t slot = hash_name(commands[i].name, len);
+        while (registry->slots[slot & (COMMAND_SLOTS - 1)] != 0) {
+            slot++;
+        }
+        registry->slots[slot & (COMMAND_SLOTS - 1)] = i + 1;
+    }
+}
+
+
+const command_t *command_find(const command_registry_t *registry, const char *name, size_t len) {
+    uint32_t slot = hash_name(name, len);
+    uint8_t index;
+    while ((index = registry->slots[slot & (COMMAND_SLOTS - 1)]) != 0) {
+        const command_t *command = &registry->commands[index - 1];
+        if (strncmp(command->name, name, len) == 0 && command->name[len] == '\0') {
+            return command;
+        }
+        slot++;
+    }
+    return NULL;
+}
+
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+
+// Parse a decimal integer, saturating near UINT32_MAX; false if there is none
+static bool parse_digits(const char **str, uint32_t *value) {
+    if (!is_digit(**str)) {
+        return false;
+    }
+    uint32_t v = 0;
+    while (is_digit(**str)) {
+        v = v < UINT32_MAX / 10 ? v * 10 + (**str - '0') : UINT32_MAX;
+        (*str)++;
+    }
+    *value = v;
+    return true;
+}
+
+
+// Parse one argument of the given type at *str, leaving *str after it
+static bool parse_value(char type, const char **str, command_value_t *value) {
+    const char *p = *str;
+    bool negative = false;
+    uint32_t magnitude;
+    if (type == 's') {
+        value->s = p;
+        *str = p + strlen(p);
+        return true;
+    }
+    if (type != 'u' && *p == '-') {
+        negative = true;
+        p++;
+    }
+    if (!parse_digits(&p, &magnitude)) {
+        return false;
+    }
+    if (type == 'u') {
+        value->u = magnitude;
+    } else {
+        if (magnitude > 100000)     magnitude = 100000;     // far outside any valid range
+        int32_t v = (int32_t)magnitude;
+        if (type == 't') {
+            // "27.5" is 275, further digits are ignored
+            v *= 10;
+            if (*p == '.') {
+                p++;
+                if (is_digit(*p))   v += *p - '0';
+                while (is_digit(*p))    p++;
+            }
+        }
+        value->i = negative ? -v : v;
+    }
+    // an argument ends at a space
+    if (*p != '\0' && *p != ' ') {
+        return false;
+    }
+    *str = p;
+    return true;
+}
+
+
+static bool parse_args(const command_t *command, const char *str, command_args_t *args) {
+    memset(args, 0, sizeof(command_args_t));
+    for (const char *type = command->args; *type != '\0'; type++) {
+        str += strspn(str, " ");
+        if (*str == '\0') {
+            break;
+        }
+        if (!parse_value(*type, &str, &args->value[args->count])) {
+            return false;
+        }
+        args->count++;
+    }
+    str += strspn(str, " ");
+    return *str == '\0' && args->count >= command->required;
+}
+
+
+// Run one command; line is a single command without separators
+static size_t execute_one(const command_registry_t *registry, void *context, char *line, bool last, char *reply,
+                          size_t size) {
+    int len;
+    size_t name_len = strcspn(line, " ");
+    const command_t *command = command_find(registry, line, name_len);
+    command_args_t args;
+    if (command == NULL) {
+        printf("Unknown command from client\n");
+        len = snprintf(reply, size, "Error: Unknown command\n\n");
+    } else if (command->streams && !last) {
+        len = snprintf(reply, size, "Error: %s must be the last command of a request\n\n", command->name);
+    } else if (!parse_args(command, line + name_len, &args)) {
+        len = snprintf(reply, size, "Error: Invalid arguments. Usage: %s\n\n", command->usage);
+    } else {
+        return command->handler(context, &args, reply, size);
+    }
+    return len < (int)size ? len : size - 1;
+}
+
+
+size_t command_execute(const command_registry_t *registry, void *context, const char *request, char *reply,
+                       size_t size) {
+    size_t len = 0;
+    reply[0] = '\0';
+    while (*request != '\0' && len < size - 1) {
+        size_t n = strcspn(request, ";");
+        const char *next = request[n] == ';' ? request + n + 1 : request + n;
+
+        // copy the command out so it can be terminated and trimmed
+        char line[COMMAND_MAX_LEN];
+        const char *start = request + strspn(request, " ");
+        n -= start - request;
+        while (n > 0 && start[n - 1] == ' ') {
+            n--;
+        }
+        bool last = next[strspn(next, " ;")] == '\0';
+        request = next;
+        if (n == 0) {
+            continue;   // empty, e.g. a trailing ';'
+        }
+        if (n >= sizeof(line)) {
+            int m = snprintf(reply + len, size - len, "Error: Command too long\n\n");
+            len += m < (int)(size - len) ? (size_t)m : size - len - 1;
+            continue;
+        }
+        memcpy(line, start, n);
+        line[n] = '\0';
+        len += execute_one(registry, context, line, last, reply + len, size - len);
+    }
+    if (len == 0) {
+        // a blank request still gets an answer
+        char line[1] = "";
+        len = execute_one(registry, context, line, true, reply, size);
+    }
+    return len;
+}
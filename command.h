@@ -0,0 +1,91 @@
+#ifndef _COMMAND_H_
+#define _COMMAND_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** \file command.h
+ *
+ * \brief Table-driven command engine.
+ *
+ * Commands are rows of a static table: a name, a typed argument spec and a
+ * handler. The registry indexes the table by a hash of the name once at init,
+ * so lookup doesn't depend on how many commands there are. The engine parses
+ * the arguments before the handler runs, so handlers only see typed values.
+ *
+ * A request may hold several commands separated by ';', for example
+ * "status;history". They run in order and their replies are concatenated into
+ * one reply.
+ */
+
+#define COMMAND_MAX_ARGS 2
+#define COMMAND_MAX_LEN 128         // longest single command in a request
+#define COMMAND_SLOTS 32            // hash index size, a power of two above the table size
+
+/**
+ * \brief A parsed argument; the member follows the spec character.
+ */
+typedef union command_value_t {
+    int32_t i;          // 'i' signed integer, 't' tenths ("27.5" is 275)
+    uint32_t u;         // 'u' unsigned integer
+    const char *s;      // 's' rest of the command, may be empty
+} command_value_t;
+
+typedef struct command_args_t {
+    uint8_t count;      // arguments given, the rest are zero
+    command_value_t value[COMMAND_MAX_ARGS];
+} command_args_t;
+
+/**
+ * \brief Run one command and write its reply text.
+ *
+ * \param context Passed through from command_execute().
+ * \return Reply length, less than size.
+ */
+typedef size_t (*command_handler_t)(void *context, const command_args_t *args, char *reply, size_t size);
+
+typedef struct command_t {
+    const char *name;
+    const char *args;       // one spec character per argument: i, u, t or s ('s' last)
+    uint8_t required;       // leading arguments that must be given
+    bool streams;           // output follows the reply, so the command must end its request
+    const char *usage;      // shown when the arguments don't parse
+    command_handler_t handler;
+} command_t;
+
+typedef struct command_registry_t {
+    const command_t *commands;
+    uint8_t slots[COMMAND_SLOTS];   // index + 1 into commands, 0 for an empty slot
+} command_registry_t;
+
+/**
+ * \brief Index a command table.
+ *
+ * \param registry Registry.
+ * \param commands Table, must stay valid; names must be unique.
+ * \param count Rows, less than COMMAND_SLOTS.
+ */
+void command_registry_init(command_registry_t *registry, const command_t *commands, uint8_t count);
+
+/**
+ * \brief Look up a command by name.
+ *
+ * \param name Name, not necessarily terminated.
+ * \param len Length of the name.
+ * \return The command, or NULL if there is none.
+ */
+const command_t *command_find(const command_registry_t *registry, const char *name, size_t len);
+
+/**
+ * \brief Run every command of a request and write the combined reply.
+ *
+ * \param registry Registry.
+ * \param context Passed to the handlers.
+ * \param request Request text, one or more commands separated by ';'.
+ * \return Reply length, less than size.
+ */
+size_t command_execute(const command_registry_t *registry, void *context, const char *request, char *reply,
+                       size_t size);
+
+#endif // _COMMAND_H_
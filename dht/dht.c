@@ -8,6 +8,8 @@
 #include <dht.pio.h>
 #include <hardware/clocks.h>
 #include <hardware/dma.h>
+#include <hardware/irq.h>
+#include <hardware/sync.h>
 #include <pico/stdlib.h>
 #include <math.h>
 #include <string.h>
@@ -16,6 +18,22 @@ static const uint PIO_SM_CLOCK_FREQUENCY = 1000000; // 1MHz
 static const uint DHT_LONG_PULSE_THRESHOLD_US = 50;
 static const uint DHT_MEASUREMENT_TIMEOUT_US = 6000;
 
+// sensors waiting on a DMA channel, looked up from the shared DMA IRQ handler
+static dht_t *dht_by_dma_chan[NUM_DMA_CHANNELS];
+static bool dht_irq_handler_installed = false;
+
+// scanners waiting on their data channel, looked up from their own shared DMA IRQ handler
+static dht_scanner_t *dht_scanner_by_dma_chan[NUM_DMA_CHANNELS];
+static bool dht_scanner_irq_handler_installed = false;
+
+// sensors initialized one by one or through a scanner share a copy of the program per PIO block
+static uint8_t dht_program_offset[NUM_PIOS];
+static uint8_t dht_program_users[NUM_PIOS];
+
+// completion can race between the DMA IRQ, the timeout alarm and a polling
+// caller, which need not all run on the same core
+static spin_lock_t *dht_lock;
+
 //sudo minicom -b 115200 -o -D /dev/ttyACM0
 // misc
 //
@@ -55,40 +73,40 @@ static void dht_program_init(PIO pio, uint sm, uint offset, dht_model_t model, u
     pio_sm_exec(pio, sm, pio_encode_mov(pio_y, pio_osr));
     // pull the long pulse threshold
     pio_sm_exec(pio, sm, pio_encode_pull(/* if_empty */ false, /* block */ true));
-    // start executing the PIO program
-    pio_sm_set_enabled(pio, sm, true);
 }
 
 static void configure_dma_channel(uint chan, PIO pio, uint sm, uint8_t *write_addr) {
     dma_channel_config c = dma_channel_get_default_config(chan);
     channel_config_set_dreq(&c, pio_get_dreq(pio, sm, false /* is_tx */));
-    channel_config_set_irq_quiet(&c, true);
+    // raise DMA_IRQ_0 once all 5 bytes have arrived
+    channel_config_set_irq_quiet(&c, false);
     channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
     channel_config_set_read_increment(&c, false);
     channel_config_set_write_increment(&c, true);
     dma_channel_configure(chan, &c, write_addr, &pio->rxf[sm], 5, true /* trigger */);
 }
 
-static float decode_temperature(dht_model_t model, uint8_t b0, uint8_t b1) {
-    float temperature;
+// tenths of a degree C
+static int16_t decode_temperature(dht_model_t model, uint8_t b0, uint8_t b1) {
+    int16_t temperature;
     switch (model) {
     case DHT11:
         if (b1 & 0x80) {
             // below-zero temperature not supported
-            temperature = 0.0f;
+            temperature = 0;
         } else {
-            temperature = b0 + 0.1f * (b1 & 0x7F);
+            temperature = b0 * 10 + (b1 & 0x7F);
         }
         break;
     case DHT12:
-        temperature = b0 + 0.1f * (b1 & 0x7F);
+        temperature = b0 * 10 + (b1 & 0x7F);
         if (b1 & 0x80) {
             temperature = -temperature;
         }
         break;
     case DHT21:
     case DHT22:
-        temperature = 0.1f * (((b0 & 0x7F) << 8) + b1);
+        temperature = ((b0 & 0x7F) << 8) + b1;
         if (b0 & 0x80) {
             temperature = -temperature;
         }
@@ -99,16 +117,17 @@ static float decode_temperature(dht_model_t model, uint8_t b0, uint8_t b1) {
     return temperature;
 }
 
-static float decode_humidity(dht_model_t model, uint8_t b0, uint8_t b1) {
-    float humidity;
+// tenths of %RH
+static uint16_t decode_humidity(dht_model_t model, uint8_t b0, uint8_t b1) {
+    uint16_t humidity;
     switch (model) {
     case DHT11:
     case DHT12:
-        humidity = b0 + 0.1f * b1;
+        humidity = b0 * 10 + b1;
         break;
     case DHT21:
     case DHT22:
-        humidity = 0.1f * ((b0 << 8) + b1);
+        humidity = (b0 << 8) + b1;
         break;
     default:
         assert(false); // invalid model
@@ -116,6 +135,68 @@ static float decode_humidity(dht_model_t model, uint8_t b0, uint8_t b1) {
     return humidity;
 }
 
+static uint32_t get_measurement_timeout_us(dht_model_t model) {
+    return get_start_pulse_duration_us(model) + DHT_MEASUREMENT_TIMEOUT_US;
+}
+
+static void complete_measurement(dht_t *dht) {
+    // may race between the DMA IRQ, the timeout alarm and a polling caller;
+    // the first one to get here finalizes the frame
+    uint32_t save = spin_lock_blocking(dht_lock);
+    if (!dht->busy) {
+        spin_unlock(dht_lock, save);
+        return;
+    }
+    pio_sm_set_enabled(dht->pio, dht->sm, false);
+    // make sure pin is left in hi-z mode
+    pio_sm_exec(dht->pio, dht->sm, pio_encode_set(pio_pindirs, 0));
+
+    dht_result_t result;
+    if (dma_channel_is_busy(dht->dma_chan)) {
+        dma_channel_abort(dht->dma_chan);
+        // abort may raise a spurious completion IRQ; it is dropped since busy is cleared below
+        result = DHT_RESULT_TIMEOUT;
+    } else {
+        uint8_t checksum = dht->data[0] + dht->data[1] + dht->data[2] + dht->data[3];
+        result = dht->data[4] == checksum ? DHT_RESULT_OK : DHT_RESULT_BAD_CHECKSUM;
+    }
+    dht->result = result;
+    dht->busy = false;
+    alarm_id_t alarm = dht->timeout_alarm;
+    dht->timeout_alarm = 0;
+    spin_unlock(dht_lock, save);
+
+    if (alarm > 0) {
+        cancel_alarm(alarm);
+    }
+    if (dht->callback != NULL) {
+        dht->callback(dht, result, dht->user_data);
+    }
+}
+
+static void dht_dma_irq_handler(void) {
+    for (uint chan = 0; chan < NUM_DMA_CHANNELS; chan++) {
+        dht_t *dht = dht_by_dma_chan[chan];
+        if (dht != NULL && dma_channel_get_irq0_status(chan)) {
+            dma_channel_acknowledge_irq0(chan);
+            complete_measurement(dht);
+        }
+    }
+}
+
+static int64_t measurement_timeout_callback(alarm_id_t id, void *user_data) {
+    dht_t *dht = (dht_t *)user_data;
+    dht->timeout_alarm = 0;
+    complete_measurement(dht);
+    return 0; // don't reschedule
+}
+
+static void claim_lock(void) {
+    if (dht_lock == NULL) {
+        dht_lock = spin_lock_instance(spin_lock_claim_unused(true /* required */));
+    }
+}
+
 //
 // public interface
 //
@@ -123,21 +204,39 @@ static float decode_humidity(dht_model_t model, uint8_t b0, uint8_t b1) {
 void dht_init(dht_t *dht, dht_model_t model, PIO pio, uint8_t data_pin, bool pull_up) {
     assert(pio == pio0 || pio == pio1);
 
+    claim_lock();
     memset(dht, 0, sizeof(dht_t));
     dht->model = model;
     dht->pio = pio;
-    dht->pio_program_offset = pio_add_program(pio, &dht_program);
+    uint pio_index = pio_get_index(pio);
+    if (dht_program_users[pio_index]++ == 0) {
+        dht_program_offset[pio_index] = pio_add_program(pio, &dht_program);
+    }
+    dht->pio_program_offset = dht_program_offset[pio_index];
     dht->sm = pio_claim_unused_sm(pio, true /* required */);
     dht->dma_chan = dma_claim_unused_channel(true /* required */);
     dht->data_pin = data_pin;
+    dht->result = DHT_RESULT_TIMEOUT; // no data yet
 
     pio_gpio_init(pio, data_pin);
     gpio_set_pulls(data_pin, pull_up, false /* down */);
+
+    dht_by_dma_chan[dht->dma_chan] = dht;
+    dma_channel_set_irq0_enabled(dht->dma_chan, true);
+    if (!dht_irq_handler_installed) {
+        irq_add_shared_handler(DMA_IRQ_0, dht_dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        irq_set_enabled(DMA_IRQ_0, true);
+        dht_irq_handler_installed = true;
+    }
 }
 
 void dht_deinit(dht_t *dht) {
     assert(dht->pio != NULL); // not initialized
 
+    dht->callback = NULL;
+    complete_measurement(dht);
+    dma_channel_set_irq0_enabled(dht->dma_chan, false);
+    dht_by_dma_chan[dht->dma_chan] = NULL;
     dma_channel_abort(dht->dma_chan);
     dma_channel_unclaim(dht->dma_chan);
 
@@ -145,46 +244,359 @@ void dht_deinit(dht_t *dht) {
     // make sure pin is left in hi-z mode; original pin function & pulls are not restored
     pio_sm_set_consecutive_pindirs(dht->pio, dht->sm, dht->data_pin, 1, false /* is_out */);
     pio_sm_unclaim(dht->pio, dht->sm);
-    pio_remove_program(dht->pio, &dht_program, dht->pio_program_offset);
+    if (--dht_program_users[pio_get_index(dht->pio)] == 0) {
+        pio_remove_program(dht->pio, &dht_program, dht->pio_program_offset);
+    }
 
     dht->pio = NULL;
 }
 
 void dht_start_measurement(dht_t *dht) {
     assert(dht->pio != NULL); // not initialized
-    assert(!pio_sm_is_enabled(dht->pio, dht->sm)); // another measurement in progress
+    assert(!dht->busy); // another measurement in progress
 
     memset(dht->data, 0, sizeof(dht->data));
+    dht->busy = true;
     configure_dma_channel(dht->dma_chan, dht->pio, dht->sm, dht->data);
     dht_program_init(dht->pio, dht->sm, dht->pio_program_offset, dht->model, dht->data_pin);
+    // start executing the PIO program
+    pio_sm_set_enabled(dht->pio, dht->sm, true);
     dht->start_time = time_us_32();
+    alarm_id_t alarm = add_alarm_in_us(get_measurement_timeout_us(dht->model), measurement_timeout_callback, dht, true /* fire_if_past */);
+    // if no alarm slot is free, the timeout is still enforced by dht_poll_measurement()
+    dht->timeout_alarm = alarm > 0 ? alarm : 0;
 }
 
-dht_result_t dht_finish_measurement_blocking(dht_t *dht, float *humidity, float *temperature_c) {
+void dht_set_callback(dht_t *dht, dht_callback_t callback, void *user_data) {
+    uint32_t save = spin_lock_blocking(dht_lock);
+    dht->callback = callback;
+    dht->user_data = user_data;
+    spin_unlock(dht_lock, save);
+}
+
+dht_result_t dht_poll_measurement_tenths(dht_t *dht, uint16_t *humidity, int16_t *temperature) {
     assert(dht->pio != NULL); // not initialized
-    assert(pio_sm_is_enabled(dht->pio, dht->sm)); // no measurement in progress
 
-    uint32_t timeout = get_start_pulse_duration_us(dht->model) + DHT_MEASUREMENT_TIMEOUT_US;
-    while (dma_channel_is_busy(dht->dma_chan) && time_us_32() - dht->start_time < timeout) {
+    if (dht->busy) {
+        if (time_us_32() - dht->start_time < get_measurement_timeout_us(dht->model)) {
+            return DHT_RESULT_IN_PROGRESS;
+        }
+        complete_measurement(dht);
+    }
+    dht_result_t result = dht->result;
+    if (result != DHT_RESULT_OK) {
+        return result;
+    }
+    if (humidity != NULL) {
+        *humidity = decode_humidity(dht->model, dht->data[0], dht->data[1]);
+    }
+    if (temperature != NULL) {
+        *temperature = decode_temperature(dht->model, dht->data[2], dht->data[3]);
+    }
+    return DHT_RESULT_OK;
+}
+
+dht_result_t dht_poll_measurement(dht_t *dht, float *humidity, float *temperature_c) {
+    uint16_t humidity_tenths;
+    int16_t temperature_tenths;
+    dht_result_t result = dht_poll_measurement_tenths(dht, &humidity_tenths, &temperature_tenths);
+    if (result == DHT_RESULT_OK) {
+        if (humidity != NULL)       *humidity = humidity_tenths / 10.0f;
+        if (temperature_c != NULL)  *temperature_c = temperature_tenths / 10.0f;
+    }
+    return result;
+}
+
+dht_result_t dht_finish_measurement_blocking_tenths(dht_t *dht, uint16_t *humidity, int16_t *temperature) {
+    dht_result_t result;
+    while ((result = dht_poll_measurement_tenths(dht, humidity, temperature)) == DHT_RESULT_IN_PROGRESS) {
         tight_loop_contents();
     }
-    pio_sm_set_enabled(dht->pio, dht->sm, false);
-    // make sure pin is left in hi-z mode
-    pio_sm_exec(dht->pio, dht->sm, pio_encode_set(pio_pindirs, 0));
+    return result;
+}
 
-    if (dma_channel_is_busy(dht->dma_chan)) {
-        dma_channel_abort(dht->dma_chan);
-        return DHT_RESULT_TIMEOUT;
+dht_result_t dht_finish_measurement_blocking(dht_t *dht, float *humidity, float *temperature_c) {
+    dht_result_t result;
+    while ((result = dht_poll_measurement(dht, humidity, temperature_c)) == DHT_RESULT_IN_PROGRESS) {
+        tight_loop_contents();
+    }
+    return result;
+}
+
+//
+// multi-sensor scanner
+//
+
+static void configure_scanner_dma(dht_scanner_t *scanner) {
+    // the data channel copies one frame per control block, unpaced since the
+    // state machines have stopped by then, and chains back to the control
+    // channel for the next one. In quiet mode it raises its IRQ only on the
+    // null trigger that ends the list.
+    dma_channel_config c = dma_channel_get_default_config(scanner->data_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_chain_to(&c, scanner->ctrl_chan);
+    channel_config_set_irq_quiet(&c, true);
+    dma_channel_configure(scanner->data_chan, &c, scanner->frames, NULL, 0, false /* trigger */);
+
+    // the control channel writes each block's length and FIFO address to the
+    // data channel's transfer count and read address trigger
+    c = dma_channel_get_default_config(scanner->ctrl_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true /* write */, 3 /* 8 bytes */);
+    dma_channel_configure(scanner->ctrl_chan, &c, &dma_hw->ch[scanner->data_chan].al3_transfer_count,
+                          scanner->control_blocks, 2, false /* trigger */);
+}
+
+// Ends the measurement window: stops the state machines and starts one DMA
+// pass over the frames of every block that arrived whole
+static void end_scan(dht_scanner_t *scanner) {
+    uint32_t save = spin_lock_blocking(dht_lock);
+    if (!scanner->busy || scanner->draining) {
+        spin_unlock(dht_lock, save);
+        return;
+    }
+    scanner->draining = true;
+    alarm_id_t alarm = scanner->timeout_alarm;
+    scanner->timeout_alarm = 0;
+
+    uint32_t sm_mask[NUM_PIOS] = { 0 };
+    for (uint i = 0; i < scanner->count; i++) {
+        if (scanner->scan_mask & (1u << i)) {
+            sm_mask[pio_get_index(scanner->sensors[i].pio)] |= 1u << scanner->sensors[i].sm;
+        }
+    }
+    for (uint p = 0; p < NUM_PIOS; p++) {
+        if (sm_mask[p] != 0) {
+            pio_set_sm_mask_enabled(pio_get_instance(p), sm_mask[p], false);
+        }
+    }
+
+    uint n = 0;
+    scanner->drain_mask = 0;
+    for (uint i = 0; i < scanner->count; i++) {
+        dht_scanner_sensor_t *sensor = &scanner->sensors[i];
+        if (!(scanner->scan_mask & (1u << i))) {
+            continue;
+        }
+        // make sure pin is left in hi-z mode
+        pio_sm_exec(sensor->pio, sensor->sm, pio_encode_set(pio_pindirs, 0));
+        // a short frame is a timeout, and is left in its FIFO until the next start clears it
+        if (pio_sm_get_rx_fifo_level(sensor->pio, sensor->sm) >= sizeof(sensor->data)) {
+            scanner->control_blocks[n][0] = sizeof(sensor->data);
+            scanner->control_blocks[n][1] = (uint32_t)(uintptr_t)&sensor->pio->rxf[sensor->sm];
+            scanner->drain_mask |= 1u << i;
+            n++;
+        }
+    }
+    // the null trigger ends the chain and raises the IRQ, even when no frame arrived
+    scanner->control_blocks[n][0] = 0;
+    scanner->control_blocks[n][1] = 0;
+    spin_unlock(dht_lock, save);
+
+    if (alarm > 0) {
+        cancel_alarm(alarm);
+    }
+    dma_channel_set_write_addr(scanner->data_chan, scanner->frames, false /* trigger */);
+    dma_channel_set_read_addr(scanner->ctrl_chan, scanner->control_blocks, true /* trigger */);
+}
+
+// Checksums the frames the DMA pass copied, in sensor order
+static void complete_scan(dht_scanner_t *scanner) {
+    uint32_t save = spin_lock_blocking(dht_lock);
+    if (!scanner->draining) {
+        spin_unlock(dht_lock, save);
+        return;
+    }
+    uint n = 0;
+    for (uint i = 0; i < scanner->count; i++) {
+        dht_scanner_sensor_t *sensor = &scanner->sensors[i];
+        if (!(scanner->scan_mask & (1u << i))) {
+            continue;
+        }
+        if (scanner->drain_mask & (1u << i)) {
+            memcpy(sensor->data, scanner->frames[n++], sizeof(sensor->data));
+            uint8_t checksum = sensor->data[0] + sensor->data[1] + sensor->data[2] + sensor->data[3];
+            sensor->result = sensor->data[4] == checksum ? DHT_RESULT_OK : DHT_RESULT_BAD_CHECKSUM;
+        } else {
+            sensor->result = DHT_RESULT_TIMEOUT;
+        }
+    }
+    scanner->draining = false;
+    scanner->busy = false;
+    spin_unlock(dht_lock, save);
+}
+
+static void dht_scanner_dma_irq_handler(void) {
+    for (uint chan = 0; chan < NUM_DMA_CHANNELS; chan++) {
+        dht_scanner_t *scanner = dht_scanner_by_dma_chan[chan];
+        if (scanner != NULL && dma_channel_get_irq0_status(chan)) {
+            dma_channel_acknowledge_irq0(chan);
+            complete_scan(scanner);
+        }
+    }
+}
+
+static int64_t scan_timeout_callback(alarm_id_t id, void *user_data) {
+    dht_scanner_t *scanner = (dht_scanner_t *)user_data;
+    scanner->timeout_alarm = 0;
+    end_scan(scanner);
+    return 0; // don't reschedule
+}
+
+void dht_scanner_init(dht_scanner_t *scanner) {
+    claim_lock();
+    memset(scanner, 0, sizeof(dht_scanner_t));
+    scanner->data_chan = dma_claim_unused_channel(true /* required */);
+    scanner->ctrl_chan = dma_claim_unused_channel(true /* required */);
+    configure_scanner_dma(scanner);
+
+    dht_scanner_by_dma_chan[scanner->data_chan] = scanner;
+    dma_channel_set_irq0_enabled(scanner->data_chan, true);
+    if (!dht_scanner_irq_handler_installed) {
+        irq_add_shared_handler(DMA_IRQ_0, dht_scanner_dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        irq_set_enabled(DMA_IRQ_0, true);
+        dht_scanner_irq_handler_installed = true;
+    }
+}
+
+int dht_scanner_add(dht_scanner_t *scanner, dht_model_t model, uint8_t data_pin, bool pull_up, bool required) {
+    assert(scanner->count < DHT_SCANNER_MAX_SENSORS);
+
+    for (uint p = 0; p < NUM_PIOS; p++) {
+        PIO pio = pio_get_instance(p);
+        if (dht_program_users[p] == 0 && !pio_can_add_program(pio, &dht_program)) {
+            continue;
+        }
+        int sm = pio_claim_unused_sm(pio, false /* required */);
+        if (sm < 0) {
+            continue;
+        }
+        if (dht_program_users[p]++ == 0) {
+            dht_program_offset[p] = pio_add_program(pio, &dht_program);
+        }
+
+        dht_scanner_sensor_t *sensor = &scanner->sensors[scanner->count];
+        memset(sensor, 0, sizeof(dht_scanner_sensor_t));
+        sensor->pio = pio;
+        sensor->model = model;
+        sensor->pio_program_offset = dht_program_offset[p];
+        sensor->sm = sm;
+        sensor->data_pin = data_pin;
+        sensor->result = DHT_RESULT_TIMEOUT; // no data yet
+
+        pio_gpio_init(pio, data_pin);
+        gpio_set_pulls(data_pin, pull_up, false /* down */);
+        return scanner->count++;
+    }
+    if (required) {
+        panic("No PIO state machine or program space left for the DHT sensor on GPIO%u", data_pin);
+    }
+    return -1;
+}
+
+void dht_scanner_deinit(dht_scanner_t *scanner) {
+    // the DMA IRQ may be taken on a core that is no longer running, so a
+    // scan in progress is dropped rather than waited for
+    uint32_t save = spin_lock_blocking(dht_lock);
+    scanner->busy = false;
+    scanner->draining = false;
+    alarm_id_t alarm = scanner->timeout_alarm;
+    scanner->timeout_alarm = 0;
+    spin_unlock(dht_lock, save);
+    if (alarm > 0) {
+        cancel_alarm(alarm);
+    }
+
+    dma_channel_set_irq0_enabled(scanner->data_chan, false);
+    dht_scanner_by_dma_chan[scanner->data_chan] = NULL;
+    // the control channel first, so it can't restart the data channel
+    dma_channel_abort(scanner->ctrl_chan);
+    dma_channel_abort(scanner->data_chan);
+    dma_channel_acknowledge_irq0(scanner->data_chan);
+    dma_channel_unclaim(scanner->ctrl_chan);
+    dma_channel_unclaim(scanner->data_chan);
+
+    for (uint i = 0; i < scanner->count; i++) {
+        dht_scanner_sensor_t *sensor = &scanner->sensors[i];
+        pio_sm_set_enabled(sensor->pio, sensor->sm, false);
+        // make sure pin is left in hi-z mode; original pin function & pulls are not restored
+        pio_sm_set_consecutive_pindirs(sensor->pio, sensor->sm, sensor->data_pin, 1, false /* is_out */);
+        pio_sm_unclaim(sensor->pio, sensor->sm);
+        if (--dht_program_users[pio_get_index(sensor->pio)] == 0) {
+            pio_remove_program(sensor->pio, &dht_program, sensor->pio_program_offset);
+        }
+    }
+    scanner->count = 0;
+}
+
+void dht_scanner_start(dht_scanner_t *scanner, uint32_t mask) {
+    assert(!scanner->busy); // another scan in progress
+    mask &= (1u << scanner->count) - 1;
+
+    uint32_t sm_mask[NUM_PIOS] = { 0 };
+    uint32_t timeout_us = 0;
+    for (uint i = 0; i < scanner->count; i++) {
+        dht_scanner_sensor_t *sensor = &scanner->sensors[i];
+        if (!(mask & (1u << i))) {
+            continue;
+        }
+        dht_program_init(sensor->pio, sensor->sm, sensor->pio_program_offset, sensor->model, sensor->data_pin);
+        // join the FIFOs so the RX FIFO holds all 5 bytes of the frame until
+        // the window is over; this clears them, after the timing values are pulled
+        hw_set_bits(&sensor->pio->sm[sensor->sm].shiftctrl, PIO_SM0_SHIFTCTRL_FJOIN_RX_BITS);
+        sensor->result = DHT_RESULT_IN_PROGRESS;
+        sm_mask[pio_get_index(sensor->pio)] |= 1u << sensor->sm;
+        if (get_measurement_timeout_us(sensor->model) > timeout_us) {
+            timeout_us = get_measurement_timeout_us(sensor->model);
+        }
     }
-    uint8_t checksum = dht->data[0] + dht->data[1] + dht->data[2] + dht->data[3];
-    if (dht->data[4] != checksum) {
-        return DHT_RESULT_BAD_CHECKSUM;
+    if (mask == 0) {
+        return;
+    }
+
+    scanner->scan_mask = mask;
+    scanner->timeout_us = timeout_us;
+    scanner->draining = false;
+    scanner->busy = true;
+    // start executing the PIO program on every state machine of a block at once
+    for (uint p = 0; p < NUM_PIOS; p++) {
+        if (sm_mask[p] != 0) {
+            pio_enable_sm_mask_in_sync(pio_get_instance(p), sm_mask[p]);
+        }
+    }
+    scanner->start_time = time_us_32();
+    alarm_id_t alarm = add_alarm_in_us(timeout_us, scan_timeout_callback, scanner, true /* fire_if_past */);
+    // if no alarm slot is free, the window is still ended by dht_scanner_poll()
+    scanner->timeout_alarm = alarm > 0 ? alarm : 0;
+}
+
+bool dht_scanner_poll(dht_scanner_t *scanner) {
+    if (scanner->busy && !scanner->draining && time_us_32() - scanner->start_time >= scanner->timeout_us) {
+        end_scan(scanner);
+    }
+    return !scanner->busy;
+}
+
+dht_result_t dht_scanner_get_result_tenths(const dht_scanner_t *scanner, uint index, uint16_t *humidity, int16_t *temperature) {
+    assert(index < scanner->count);
+
+    if (scanner->busy && (scanner->scan_mask & (1u << index))) {
+        return DHT_RESULT_IN_PROGRESS;
+    }
+    const dht_scanner_sensor_t *sensor = &scanner->sensors[index];
+    dht_result_t result = sensor->result;
+    if (result != DHT_RESULT_OK) {
+        return result;
     }
     if (humidity != NULL) {
-        *humidity = decode_humidity(dht->model, dht->data[0], dht->data[1]);
+        *humidity = decode_humidity(sensor->model, sensor->data[0], sensor->data[1]);
     }
-    if (temperature_c != NULL) {
-        *temperature_c = decode_temperature(dht->model, dht->data[2], dht->data[3]);
+    if (temperature != NULL) {
+        *temperature = decode_temperature(sensor->model, sensor->data[2], sensor->data[3]);
     }
     return DHT_RESULT_OK;
 }
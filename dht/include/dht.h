@@ -8,6 +8,7 @@
 #define _DHT_H_
 
 #include <hardware/pio.h>
+#include <pico/time.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -29,6 +30,26 @@ typedef enum dht_model_t {
     DHT22,
 } dht_model_t;
 
+/**
+ * \brief Measurement result.
+ */
+typedef enum dht_result_t {
+    DHT_RESULT_OK, /**< No error.*/
+    DHT_RESULT_TIMEOUT, /**< DHT sensor not reponding. */
+    DHT_RESULT_BAD_CHECKSUM, /**< Sensor data doesn't match checksum. */
+    DHT_RESULT_IN_PROGRESS, /**< Measurement still running. */
+} dht_result_t;
+
+struct dht_t;
+
+/**
+ * \brief Measurement completion callback.
+ *
+ * Called from interrupt context (DMA or timer IRQ) once the sensor frame has
+ * been received and validated, or the measurement has timed out. Keep it short.
+ */
+typedef void (*dht_callback_t)(struct dht_t *dht, dht_result_t result, void *user_data);
+
 /**
  * \brief DHT sensor.
  */
@@ -41,22 +62,22 @@ typedef struct dht_t {
     uint8_t data_pin;
     uint8_t data[5];
     uint32_t start_time;
+    volatile bool busy;
+    volatile uint8_t result;
+    alarm_id_t timeout_alarm;
+    dht_callback_t callback;
+    void *user_data;
 } dht_t;
 
-/**
- * \brief Measurement result.
- */
-typedef enum dht_result_t {
-    DHT_RESULT_OK, /**< No error.*/
-    DHT_RESULT_TIMEOUT, /**< DHT sensor not reponding. */
-    DHT_RESULT_BAD_CHECKSUM, /**< Sensor data doesn't match checksum. */
-} dht_result_t;
-
 /**
  * \brief Initialize DHT sensor.
  * 
  * The library claims one state machine from the given PIO instance, and one DMA
- * channel to communicate with the sensor.
+ * channel to communicate with the sensor. Sensors on the same PIO instance share
+ * one copy of the program, so up to four fit in a block. Measurements complete through a shared
+ * DMA_IRQ_0 handler, backed by a timer alarm for the timeout. The DMA IRQ is
+ * enabled on the core that initializes the first sensor; the alarm may fire on
+ * the other core, so completion is serialized with a hardware spin lock.
  * 
  * \param dht DHT sensor.
  * \param model DHT sensor model.
@@ -82,10 +103,57 @@ void dht_deinit(dht_t *dht);
  * DHT sensors typically need at least 2 seconds between measurements for
  * accurate results.
  * 
+ * The frame is finalized and checksummed from interrupt context; use
+ * dht_poll_measurement() or a completion callback to collect the result.
+ *
  * \param dht DHT sensor.
  */
 void dht_start_measurement(dht_t *dht);
 
+/**
+ * \brief Set the callback invoked when a measurement completes.
+ *
+ * \param dht DHT sensor.
+ * \param callback Completion callback, or NULL to disable.
+ * \param user_data Passed to the callback.
+ */
+void dht_set_callback(dht_t *dht, dht_callback_t callback, void *user_data);
+
+/**
+ * \brief Get the result of the last measurement without blocking, in fixed point.
+ *
+ * The sensors report tenths natively, so this involves no float math.
+ * Outputs are only written when the result is DHT_RESULT_OK.
+ *
+ * \param dht DHT sensor.
+ * \param[out] humidity Relative humidity, tenths of a percent. May be NULL.
+ * \param[out] temperature Tenths of a degree Celsius. May be NULL.
+ * \return DHT_RESULT_IN_PROGRESS while the measurement is running, otherwise its status.
+ */
+dht_result_t dht_poll_measurement_tenths(dht_t *dht, uint16_t *humidity, int16_t *temperature);
+
+/**
+ * \brief Get the result of the last measurement without blocking.
+ *
+ * Outputs are only written when the result is DHT_RESULT_OK.
+ *
+ * \param dht DHT sensor.
+ * \param[out] humidity Relative humidity. May be NULL.
+ * \param[out] temperature_c Degrees Celsius. May be NULL.
+ * \return DHT_RESULT_IN_PROGRESS while the measurement is running, otherwise its status.
+ */
+dht_result_t dht_poll_measurement(dht_t *dht, float *humidity, float *temperature_c);
+
+/**
+ * \brief Wait for measurement to complete and get the result, in fixed point.
+ *
+ * \param dht DHT sensor.
+ * \param[out] humidity Relative humidity, tenths of a percent. May be NULL.
+ * \param[out] temperature Tenths of a degree Celsius. May be NULL.
+ * \return Result status.
+ */
+dht_result_t dht_finish_measurement_blocking_tenths(dht_t *dht, uint16_t *humidity, int16_t *temperature);
+
 /**
  * \brief Wait for measurement to complete and get the result.
  *
@@ -96,6 +164,111 @@ void dht_start_measurement(dht_t *dht);
  */
 dht_result_t dht_finish_measurement_blocking(dht_t *dht, float *humidity, float *temperature_c);
 
+/**
+ * \brief Maximum number of sensors one scanner can drive, one per state machine.
+ */
+#define DHT_SCANNER_MAX_SENSORS (NUM_PIOS * NUM_PIO_STATE_MACHINES)
+
+/**
+ * \brief Sensor of a multi-sensor scanner.
+ */
+typedef struct dht_scanner_sensor_t {
+    PIO pio;
+    uint8_t model;
+    uint8_t pio_program_offset;
+    uint8_t sm;
+    uint8_t data_pin;
+    uint8_t data[5];
+    volatile uint8_t result;
+} dht_scanner_sensor_t;
+
+/**
+ * \brief Multi-sensor scanner.
+ *
+ * Measures any set of its sensors in one window: the state machines of each
+ * PIO block are started in sync, and once the window is over the frames of
+ * all blocks are collected in one DMA pass that raises a single interrupt.
+ */
+typedef struct dht_scanner_t {
+    dht_scanner_sensor_t sensors[DHT_SCANNER_MAX_SENSORS];
+    uint8_t count;
+    uint8_t data_chan;          // copies each frame out of its RX FIFO
+    uint8_t ctrl_chan;          // loads data_chan with one control block per frame
+    uint32_t scan_mask;         // sensors in the running or last scan
+    uint32_t drain_mask;        // of those, the ones whose whole frame arrived
+    uint32_t control_blocks[DHT_SCANNER_MAX_SENSORS + 1][2];
+    uint8_t frames[DHT_SCANNER_MAX_SENSORS][5];
+    uint32_t start_time;
+    uint32_t timeout_us;
+    volatile bool busy;
+    volatile bool draining;
+    alarm_id_t timeout_alarm;
+} dht_scanner_t;
+
+/**
+ * \brief Initialize an empty scanner.
+ *
+ * Claims two DMA channels, whatever the number of sensors. Scans complete
+ * through a shared DMA_IRQ_0 handler, enabled on the calling core.
+ *
+ * \param scanner Scanner.
+ */
+void dht_scanner_init(dht_scanner_t *scanner);
+
+/**
+ * \brief Add a sensor to the scanner.
+ *
+ * Claims a state machine from the first PIO block with one free and room for
+ * the program, which is loaded once per block and shared with dht_init().
+ *
+ * \param scanner Scanner.
+ * \param model DHT sensor model.
+ * \param data_pin Sensor data pin.
+ * \param pull_up Whether to enable the internal pull-up.
+ * \param required If true, panic when no PIO block has room for the sensor.
+ * \return Sensor index, counting from 0 in the order added, or -1 if there was no room.
+ */
+int dht_scanner_add(dht_scanner_t *scanner, dht_model_t model, uint8_t data_pin, bool pull_up, bool required);
+
+/**
+ * \brief Release the sensors, state machines, programs and DMA channels of the scanner.
+ *
+ * \param scanner Scanner.
+ */
+void dht_scanner_deinit(dht_scanner_t *scanner);
+
+/**
+ * \brief Start measuring a set of sensors at once.
+ *
+ * The window lasts as long as the timeout of the slowest model in the set.
+ * Sensors whose frame hasn't arrived whole by then time out.
+ *
+ * \param scanner Scanner, idle.
+ * \param mask Bit i set to measure sensor i.
+ */
+void dht_scanner_start(dht_scanner_t *scanner, uint32_t mask);
+
+/**
+ * \brief Check whether the last scan has completed, without blocking.
+ *
+ * \param scanner Scanner.
+ * \return true once the results of every sensor in the scan are available.
+ */
+bool dht_scanner_poll(dht_scanner_t *scanner);
+
+/**
+ * \brief Get the result of one sensor from the last scan, in fixed point.
+ *
+ * Outputs are only written when the result is DHT_RESULT_OK.
+ *
+ * \param scanner Scanner.
+ * \param index Sensor index returned by dht_scanner_add().
+ * \param[out] humidity Relative humidity, tenths of a percent. May be NULL.
+ * \param[out] temperature Tenths of a degree Celsius. May be NULL.
+ * \return DHT_RESULT_IN_PROGRESS while the scan is running, otherwise the sensor's status.
+ */
+dht_result_t dht_scanner_get_result_tenths(const dht_scanner_t *scanner, uint index, uint16_t *humidity, int16_t *temperature);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,105 @@
+#include "dht_acquire.h"
+
+#include <string.h>
+
+
+static uint32_t get_read_interval_us(dht_model_t model) {
+    return model == DHT11 ? 1000000 : 2000000;
+}
+
+
+void dht_acquire_init(dht_acquire_t *acq, dht_model_t model) {
+    memset(acq, 0, sizeof(dht_acquire_t));
+    acq->interval_us = get_read_interval_us(model);
+    acq->next_start = get_absolute_time();
+}
+
+
+static void collect(dht_acquire_t *acq, dht_result_t result, uint16_t humidity, int16_t temperature) {
+    acq->measuring = false;
+    if (result != DHT_RESULT_TIMEOUT) {
+        acq->last_answered = acq->last_start;
+    }
+
+    if (result == DHT_RESULT_OK) {
+        acq->good++;
+        if (acq->backoff_us != 0) {
+            acq->recovered++;
+        }
+        acq->backoff_us = 0;
+        acq->valid = true;
+        acq->temperature = temperature;
+        acq->humidity = humidity;
+        acq->time = get_absolute_time();
+    } else {
+        if (result == DHT_RESULT_TIMEOUT) {
+            acq->timeouts++;
+        } else {
+            acq->bad_checksums++;
+        }
+        // retry soon, then back off while it keeps failing
+        if (acq->backoff_us == 0) {
+            acq->backoff_us = DHT_ACQUIRE_RETRY_MS * 1000;
+        } else if (acq->backoff_us < DHT_ACQUIRE_MAX_BACKOFF_MS * 1000) {
+            acq->backoff_us *= 2;
+        }
+        // but never inside the interval of the last read the sensor answered
+        acq->next_start = make_timeout_time_us(acq->backoff_us);
+        absolute_time_t allowed = delayed_by_us(acq->last_answered, acq->interval_us);
+        if (absolute_time_diff_us(acq->next_start, allowed) > 0) {
+            acq->next_start = allowed;
+        }
+    }
+}
+
+
+void dht_acquire_poll(dht_scanner_t *scanner, dht_acquire_t *acqs, uint count, dht_result_t *results) {
+    for (uint i = 0; i < count; i++) {
+        results[i] = DHT_RESULT_IN_PROGRESS;
+    }
+    if (!dht_scanner_poll(scanner)) {
+        return;
+    }
+
+    for (uint i = 0; i < count; i++) {
+        if (acqs[i].measuring) {
+            int16_t temperature = 0;
+            uint16_t humidity = 0;
+            results[i] = dht_scanner_get_result_tenths(scanner, i, &humidity, &temperature);
+            collect(&acqs[i], results[i], humidity, temperature);
+        }
+    }
+
+    // a good read sets the pace from its start, so the interval holds however long it took
+    absolute_time_t start = get_absolute_time();
+    uint32_t mask = 0;
+    for (uint i = 0; i < count; i++) {
+        dht_acquire_t *acq = &acqs[i];
+        if (absolute_time_diff_us(acq->next_start, start) >= 0) {
+            acq->measuring = true;
+            acq->reads++;
+            acq->last_start = start;
+            acq->next_start = delayed_by_us(start, acq->interval_us);
+            mask |= 1u << i;
+        }
+    }
+    if (mask != 0) {
+        dht_scanner_start(scanner, mask);
+    }
+}
+
+
+bool dht_acquire_get(const dht_acquire_t *acq, int16_t *temperature, uint16_t *humidity, uint32_t *age_ms) {
+    if (!acq->valid) {
+        return false;
+    }
+    *temperature = acq->temperature;
+    *humidity = acq->humidity;
+    *age_ms = (uint32_t)(absolute_time_diff_us(acq->time, get_absolute_time()) / 1000);
+    return true;
+}
+
+
+bool dht_acquire_is_fresh(const dht_acquire_t *acq) {
+    return acq->valid && absolute_time_diff_us(acq->time, get_absolute_time()) <= 2 * (int64_t)acq->interval_us;
+}
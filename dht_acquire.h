@@ -0,0 +1,92 @@
+#ifndef _DHT_ACQUIRE_H_
+#define _DHT_ACQUIRE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <dht.h>
+#include "pico/time.h"
+
+/** \file dht_acquire.h
+ *
+ * \brief Read policy for a DHT sensor: pacing, retries and read statistics.
+ *
+ * A start pulse never comes sooner than the model's minimum interval (1 s
+ * for the DHT11, 2 s for the others) after the last one the sensor answered,
+ * with a good frame or a bad checksum. A sensor polled sooner may answer with
+ * garbage or a stale conversion. A read that timed out got no answer, so it
+ * is retried after DHT_ACQUIRE_RETRY_MS, as long as that keeps the interval.
+ * A read with a bad checksum is retried once the interval is over. The retry
+ * delay doubles with every further failure, up to DHT_ACQUIRE_MAX_BACKOFF_MS,
+ * so a disconnected sensor isn't hammered.
+ *
+ * The sensors of a board are measured through one dht_scanner_t: all those
+ * that are due start in the same scan, so sensors reading at the same pace
+ * share one measurement window.
+ *
+ * Only good readings are kept, with the time they were taken, so callers can
+ * tell a fresh value from the last good one repeated.
+ */
+
+#define DHT_ACQUIRE_RETRY_MS 250
+#define DHT_ACQUIRE_MAX_BACKOFF_MS 32000
+
+/**
+ * \brief Sensor under the read policy.
+ */
+typedef struct dht_acquire_t {
+    uint32_t interval_us;       // model minimum between good reads
+    uint32_t backoff_us;        // delay before the next retry, 0 after a good read
+    absolute_time_t last_start; // of the last read
+    absolute_time_t last_answered;  // start of the last read the sensor answered, the interval counts from it
+    absolute_time_t next_start;
+    bool measuring;
+    // last good reading
+    bool valid;
+    int16_t temperature;        // tenths of a degree C
+    uint16_t humidity;          // tenths of %RH
+    absolute_time_t time;
+    // statistics, written by the polling core only
+    volatile uint32_t reads;
+    volatile uint32_t good;
+    volatile uint32_t timeouts;
+    volatile uint32_t bad_checksums;
+    volatile uint32_t recovered;    // good reads right after a failure
+} dht_acquire_t;
+
+/**
+ * \brief Put a sensor under the policy. The first read starts on the first poll.
+ *
+ * \param acq Policy state.
+ * \param model The sensor's model, for the minimum interval.
+ */
+void dht_acquire_init(dht_acquire_t *acq, dht_model_t model);
+
+/**
+ * \brief Collect a finished scan and start the sensors that are due in the next one.
+ *
+ * Call often, every few ms; it never waits on the sensors.
+ *
+ * \param scanner Scanner, idle or running a scan started by this function.
+ * \param acqs Policy state of each sensor, in the scanner's order.
+ * \param count Number of sensors.
+ * \param[out] results For each sensor, the result of the read collected by
+ *   this call, DHT_RESULT_IN_PROGRESS if none was.
+ */
+void dht_acquire_poll(dht_scanner_t *scanner, dht_acquire_t *acqs, uint count, dht_result_t *results);
+
+/**
+ * \brief Get the last good reading.
+ *
+ * \param[out] temperature Tenths of a degree C.
+ * \param[out] humidity Tenths of %RH.
+ * \param[out] age_ms Time since the reading was taken.
+ * \return false if no read has succeeded yet.
+ */
+bool dht_acquire_get(const dht_acquire_t *acq, int16_t *temperature, uint16_t *humidity, uint32_t *age_ms);
+
+/**
+ * \brief Whether the last good reading is no older than two read intervals.
+ */
+bool dht_acquire_is_fresh(const dht_acquire_t *acq);
+
+#endif // _DHT_ACQUIRE_H_
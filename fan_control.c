@@ -0,0 +1,150 @@
+#include "fan_control.h"
+
+#include <string.h>
+#include "hardware/pwm.h"
+
+#define Q8(x) ((int32_t)((x) * 256))
+
+
+static int32_t clamp(int32_t value, int32_t lo, int32_t hi) {
+    return value < lo ? lo : value > hi ? hi : value;
+}
+
+
+// Set the PWM levels for a Q8 % duty
+static void fan_control_apply(fan_control_t *fan, int32_t output) {
+    for (uint i = 0; i < fan->num_outputs; i++) {
+        const fan_control_output_t *out = &fan->outputs[i];
+        uint32_t level = (uint32_t)out->wrap * (uint32_t)output / Q8(100);
+        pwm_set_chan_level(out->slice_num, out->chan, level);
+    }
+    fan->duty = (output + 128) >> 8;
+}
+
+
+void fan_control_update(fan_control_t *fan) {
+    if (!fan->automatic) {
+        return;
+    }
+    const fan_control_config_t *config = &fan->config;
+    int32_t max_output = Q8(config->max_duty);
+    uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+
+    fan_control_input_t input;
+    uint32_t seq = seqlock_read(&fan->input_lock, &input);
+    int16_t temperature = input.temperature;
+    uint32_t input_ms = input.time_ms;
+    if (seq != fan->seen_seq) {
+        // derivative on the measurement, held until the next one arrives
+        if (fan->seen_seq != 0 && input_ms != fan->prev_input_ms) {
+            int32_t rise = temperature - fan->prev_temperature;
+            fan->derivative = config->kd * rise * 100 / (int32_t)(input_ms - fan->prev_input_ms);
+        }
+        fan->prev_temperature = temperature;
+        fan->prev_input_ms = input_ms;
+        fan->seen_seq = seq;
+    }
+
+    int32_t output;
+    const fan_curve_lut_t *curve = fan->curve;
+    if (seq == 0 || now_ms - input_ms > FAN_CONTROL_INPUT_TIMEOUT_MS) {
+        // no usable temperature, fail safe
+        output = max_output;
+    } else if (curve != NULL) {
+        output = Q8(fan_curve_lookup(curve, temperature, fan->duty));
+    } else {
+        int32_t error = temperature - config->setpoint;     // positive when too hot
+        int32_t proportional = config->kp * error / 10;
+        int32_t step = config->ki * error * FAN_CONTROL_PERIOD_MS / 10000;
+        output = proportional + fan->integral + fan->derivative;
+
+        // anti-windup: stop integrating while the output is pinned in the direction of the error
+        if (!(output >= max_output && step > 0) && !(output <= 0 && step < 0)) {
+            fan->integral = clamp(fan->integral + step, 0, max_output);
+            output = proportional + fan->integral + fan->derivative;
+        }
+        output = clamp(output, 0, max_output);
+    }
+
+    // below min_duty the fan may not spin: start it only once the loop or the
+    // curve asks for min_duty, then hold min_duty until it asks for nothing
+    int32_t min_output = Q8(config->min_duty);
+    if (output < min_output) {
+        output = (output > 0 && fan->duty > 0) ? min_output : 0;
+    }
+    fan_control_apply(fan, output);
+}
+
+
+fan_control_config_t fan_control_default_config(void) {
+    fan_control_config_t config = {
+        .setpoint = 250,
+        .kp = Q8(20),
+        .ki = Q8(0.5),
+        .kd = 0,
+        .min_duty = 20,
+        .max_duty = 100,
+    };
+    return config;
+}
+
+
+void fan_control_init(fan_control_t *fan, const fan_control_config_t *config) {
+    memset(fan, 0, sizeof(fan_control_t));
+    fan->config = *config;
+    fan->automatic = true;
+    seqlock_init(&fan->input_lock, &fan->input, sizeof(fan->input));
+}
+
+
+bool fan_control_add_output(fan_control_t *fan, uint slice_num, uint chan, uint16_t wrap) {
+    if (fan->num_outputs == FAN_CONTROL_MAX_OUTPUTS) {
+        return false;
+    }
+    fan_control_output_t *out = &fan->outputs[fan->num_outputs++];
+    out->slice_num = slice_num;
+    out->chan = chan;
+    out->wrap = wrap;
+    pwm_set_chan_level(slice_num, chan, (uint32_t)wrap * fan->duty / 100);
+    return true;
+}
+
+
+void fan_control_set_input(fan_control_t *fan, int16_t temperature) {
+    fan_control_input_t input = {
+        .temperature = temperature,
+        .time_ms = to_ms_since_boot(get_absolute_time()),
+    };
+    // the loop never sees a temperature paired with another reading's time
+    seqlock_write(&fan->input_lock, &input);
+}
+
+
+void fan_control_set_setpoint(fan_control_t *fan, int16_t setpoint) {
+    fan->config.setpoint = setpoint;
+}
+
+
+void fan_control_set_manual(fan_control_t *fan, uint8_t duty) {
+    // suspend the loop first so it can't overwrite the manual level
+    fan->automatic = false;
+    fan_control_apply(fan, Q8(duty > 100 ? 100 : duty));
+}
+
+
+void fan_control_set_curve(fan_control_t *fan, const fan_curve_lut_t *curve) {
+    if (curve == NULL && fan->curve != NULL) {
+        // bumpless, like leaving manual mode
+        fan->integral = clamp(Q8(fan->duty), 0, Q8(fan->config.max_duty));
+        fan->derivative = 0;
+    }
+    fan->curve = curve;
+}
+
+
+void fan_control_set_automatic(fan_control_t *fan) {
+    // bumpless: the integral picks up from the manual duty
+    fan->integral = clamp(Q8(fan->duty), 0, Q8(fan->config.max_duty));
+    fan->derivative = 0;
+    fan->automatic = true;
+}
@@ -0,0 +1,156 @@
+#ifndef _FAN_CONTROL_H_
+#define _FAN_CONTROL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "pico/time.h"
+#include "fan_curve.h"
+#include "seqlock.h"
+
+/** \file fan_control.h
+ *
+ * \brief Closed-loop fan controller.
+ *
+ * A PID loop on the temperature of one zone, updated by the caller at a fixed
+ * rate independent of the sensor cadence. Every fan of the zone is a PWM output
+ * of the same controller and runs at the same duty. All math is integer: the
+ * temperature is in tenths of a degree C and the output duty is kept in
+ * 1/256 percent (Q8), so the update is also safe to run from an IRQ.
+ *
+ * Instead of the PID loop, automatic mode can follow a fan curve, a table of
+ * duty by temperature (see fan_curve.h). The input timeout applies to both.
+ */
+
+#define FAN_CONTROL_PERIOD_MS 100           // rate fan_control_update() must be called at
+#define FAN_CONTROL_INPUT_TIMEOUT_MS 10000  // no fresh temperature this long: full speed
+#define FAN_CONTROL_MAX_OUTPUTS 4           // fans per controller
+
+/**
+ * \brief Tuning, gains in Q8 (256 = 1.0).
+ */
+typedef struct fan_control_config_t {
+    int16_t setpoint;       // tenths of a degree C
+    int32_t kp;             // % duty per degree C of error
+    int32_t ki;             // % duty per degree C of error per second
+    int32_t kd;             // % duty per degree C per second of temperature rise
+    uint8_t min_duty;       // lowest duty the fan reliably spins at, below it the fan is off
+    uint8_t max_duty;
+} fan_control_config_t;
+
+/**
+ * \brief Temperature measurement fed to the loop.
+ */
+typedef struct fan_control_input_t {
+    int16_t temperature;    // tenths of a degree C
+    uint32_t time_ms;       // time of the measurement
+} fan_control_input_t;
+
+/**
+ * \brief PWM channel driving one fan.
+ */
+typedef struct fan_control_output_t {
+    uint8_t slice_num;
+    uint8_t chan;
+    uint16_t wrap;      // PWM counter wrap value, the level for 100 % duty
+} fan_control_output_t;
+
+/**
+ * \brief Fan controller driving the PWM channels of a zone.
+ */
+typedef struct fan_control_t {
+    fan_control_output_t outputs[FAN_CONTROL_MAX_OUTPUTS];
+    uint8_t num_outputs;
+    fan_control_config_t config;
+    volatile bool automatic;
+    const fan_curve_lut_t *volatile curve;  // followed instead of the PID loop, NULL for none
+    volatile uint8_t duty;          // duty currently applied, in percent
+    fan_control_input_t input;      // latest input, read through input_lock
+    seqlock_t input_lock;
+    uint32_t seen_seq;              // input_lock version last used by the loop
+    int32_t integral;               // Q8 % duty
+    int32_t derivative;             // Q8 % duty, held between inputs
+    int16_t prev_temperature;
+    uint32_t prev_input_ms;
+} fan_control_t;
+
+/**
+ * \brief Default tuning: 25.0 C setpoint, 20 %/C proportional, 0.5 %/C/s integral.
+ */
+fan_control_config_t fan_control_default_config(void);
+
+/**
+ * \brief Initialize a controller without outputs.
+ *
+ * The controller starts in automatic mode with its fans off. The loop only
+ * runs when fan_control_update() is called.
+ *
+ * \param fan Controller.
+ * \param config Tuning.
+ */
+void fan_control_init(fan_control_t *fan, const fan_control_config_t *config);
+
+/**
+ * \brief Drive a PWM channel that is already configured and enabled.
+ *
+ * The channel is set to the current duty.
+ *
+ * \param fan Controller.
+ * \param slice_num PWM slice.
+ * \param chan PWM channel.
+ * \param wrap PWM counter wrap value, the level for 100 % duty.
+ * \return false if the controller already has FAN_CONTROL_MAX_OUTPUTS outputs.
+ */
+bool fan_control_add_output(fan_control_t *fan, uint slice_num, uint chan, uint16_t wrap);
+
+/**
+ * \brief Run one step of the loop and set the PWM levels.
+ *
+ * Call every FAN_CONTROL_PERIOD_MS from the core that owns the controller;
+ * the integral assumes that rate. Does nothing in manual mode.
+ */
+void fan_control_update(fan_control_t *fan);
+
+/**
+ * \brief Feed a new temperature measurement.
+ *
+ * \param fan Controller.
+ * \param temperature Tenths of a degree C.
+ */
+void fan_control_set_input(fan_control_t *fan, int16_t temperature);
+
+/**
+ * \brief Change the setpoint, in tenths of a degree C.
+ */
+void fan_control_set_setpoint(fan_control_t *fan, int16_t setpoint);
+
+/**
+ * \brief Hold a fixed duty and suspend the loop.
+ *
+ * \param fan Controller.
+ * \param duty Percent, 0 to 100.
+ */
+void fan_control_set_manual(fan_control_t *fan, uint8_t duty);
+
+/**
+ * \brief Resume closed-loop control, starting from the current duty.
+ */
+void fan_control_set_automatic(fan_control_t *fan);
+
+/**
+ * \brief Follow a compiled fan curve in automatic mode, or the PID loop again.
+ *
+ * Takes effect on the next update, and leaves manual mode as it is.
+ *
+ * \param fan Controller.
+ * \param curve Must stay valid while in use; NULL returns to the PID loop.
+ */
+void fan_control_set_curve(fan_control_t *fan, const fan_curve_lut_t *curve);
+
+/**
+ * \brief Duty currently applied, in percent.
+ */
+static inline uint8_t fan_control_get_duty(const fan_control_t *fan) {
+    return fan->duty;
+}
+
+#endif // _FAN_CONTROL_H_
@@ -0,0 +1,123 @@
+#include "fan_curve.h"
+
+#include <string.h>
+#include "format.h"
+
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+
+// Parse "-12.5" as -125 at *str, leaving *str after it
+static bool parse_tenths(const char **str, int32_t *tenths) {
+    const char *p = *str;
+    bool negative = *p == '-';
+    if (negative)   p++;
+    if (!is_digit(*p)) {
+        return false;
+    }
+    int32_t value = 0;
+    while (is_digit(*p)) {
+        if (value > 10000)  return false;   // far outside any valid range
+        value = value * 10 + (*p++ - '0');
+    }
+    value *= 10;
+    if (*p == '.') {
+        p++;
+        if (!is_digit(*p))  return false;
+        value += *p++ - '0';
+    }
+    *tenths = negative ? -value : value;
+    *str = p;
+    return true;
+}
+
+
+bool fan_curve_parse(fan_curve_t *curve, const char *text) {
+    memset(curve, 0, sizeof(fan_curve_t));
+    curve->hysteresis = FAN_CURVE_DEFAULT_HYSTERESIS;
+    const char *p = text;
+    for (;;) {
+        int32_t temperature, duty;
+        if (curve->num_points == FAN_CURVE_MAX_POINTS || !parse_tenths(&p, &temperature) || *p++ != ':' ||
+                !parse_tenths(&p, &duty) || duty % 10 != 0) {
+            return false;
+        }
+        if (temperature < FAN_CURVE_MIN_TEMP || temperature > FAN_CURVE_MAX_TEMP || duty < 0 || duty > 1000) {
+            return false;
+        }
+        curve->points[curve->num_points].temperature = temperature;
+        curve->points[curve->num_points++].duty = duty / 10;
+        if (*p != ',') {
+            break;
+        }
+        p++;
+    }
+
+    if (*p == ' ') {
+        int32_t hysteresis;
+        p += strspn(p, " ");
+        if (!parse_tenths(&p, &hysteresis) || hysteresis < 0 || hysteresis > FAN_CURVE_MAX_HYSTERESIS) {
+            return false;
+        }
+        curve->hysteresis = hysteresis;
+    }
+    return *p == '\0' && fan_curve_is_valid(curve);
+}
+
+
+size_t fan_curve_format(const fan_curve_t *curve, char *buf) {
+    size_t len = 0;
+    for (uint8_t i = 0; i < curve->num_points; i++) {
+        if (i > 0)  buf[len++] = ',';
+        len += format_tenths(buf + len, curve->points[i].temperature);
+        buf[len++] = ':';
+        len += format_uint(buf + len, curve->points[i].duty);
+    }
+    buf[len++] = ' ';
+    len += format_tenths(buf + len, curve->hysteresis);
+    return len;
+}
+
+
+bool fan_curve_is_valid(const fan_curve_t *curve) {
+    if (curve->num_points > FAN_CURVE_MAX_POINTS || curve->hysteresis > FAN_CURVE_MAX_HYSTERESIS) {
+        return false;
+    }
+    for (uint8_t i = 0; i < curve->num_points; i++) {
+        const fan_curve_point_t *point = &curve->points[i];
+        if (point->temperature < FAN_CURVE_MIN_TEMP || point->temperature > FAN_CURVE_MAX_TEMP || point->duty > 100) {
+            return false;
+        }
+        if (i > 0 && (point->temperature <= point[-1].temperature || point->duty < point[-1].duty)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void fan_curve_compile(const fan_curve_t *curve, fan_curve_lut_t *lut) {
+    const fan_curve_point_t *points = curve->points;
+    uint8_t last = curve->num_points - 1;
+    lut->hysteresis = curve->hysteresis;
+    uint8_t segment = 0;
+    for (size_t index = 0; index < sizeof(lut->duty); index++) {
+        int32_t temperature = FAN_CURVE_MIN_TEMP + (int32_t)index;
+        while (segment < last && temperature > points[segment + 1].temperature) {
+            segment++;
+        }
+        const fan_curve_point_t *lo = &points[segment];
+        if (temperature <= lo->temperature || segment == last) {
+            // before the first point, or past the last
+            lut->duty[index] = temperature <= points[0].temperature ? points[0].duty : points[last].duty;
+            continue;
+        }
+        // rounded to the nearest percent
+        const fan_curve_point_t *hi = lo + 1;
+        int32_t span = hi->temperature - lo->temperature;
+        int32_t rise = (hi->duty - lo->duty) * (temperature - lo->temperature);
+        lut->duty[index] = lo->duty + (rise + span / 2) / span;
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef _FAN_CURVE_H_
+#define _FAN_CURVE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** \file fan_curve.h
+ *
+ * \brief Temperature to duty fan curves, compiled into lookup tables.
+ *
+ * A curve is up to FAN_CURVE_MAX_POINTS (temperature, duty) points with the
+ * duty interpolated linearly between them. The duty never falls as the
+ * temperature rises. Below the first point the duty is the first point's,
+ * and above the last point it is the last point's. The curve is compiled
+ * once into a table with one duty per tenth of a degree from
+ * FAN_CURVE_MIN_TEMP to FAN_CURVE_MAX_TEMP, so each control step is one array
+ * read. Temperatures outside that range read the nearest end.
+ *
+ * Hysteresis keeps a fan from hunting around a point. A rising temperature
+ * raises the duty right away. The duty only drops once the temperature is
+ * hysteresis below the temperature that gives the current duty.
+ */
+
+#define FAN_CURVE_MAX_POINTS 8
+#define FAN_CURVE_MIN_TEMP (-400)       // tenths of a degree C
+#define FAN_CURVE_MAX_TEMP 1000
+#define FAN_CURVE_MAX_HYSTERESIS 100    // tenths of a degree C
+#define FAN_CURVE_DEFAULT_HYSTERESIS 10
+#define FAN_CURVE_TEXT_SIZE (FAN_CURVE_MAX_POINTS * 11 + 8)    // longest fan_curve_format() text
+
+typedef struct fan_curve_point_t {
+    int16_t temperature;    // tenths of a degree C
+    uint8_t duty;           // percent
+} fan_curve_point_t;
+
+/**
+ * \brief Curve definition, as set and stored.
+ */
+typedef struct fan_curve_t {
+    uint8_t num_points;     // 0 for no curve
+    uint8_t hysteresis;     // tenths of a degree C
+    fan_curve_point_t points[FAN_CURVE_MAX_POINTS];     // by rising temperature
+} fan_curve_t;
+
+/**
+ * \brief Compiled curve.
+ *
+ * The table runs FAN_CURVE_MAX_HYSTERESIS past FAN_CURVE_MAX_TEMP, so the
+ * falling lookup needs no bounds check.
+ */
+typedef struct fan_curve_lut_t {
+    uint8_t hysteresis;
+    uint8_t duty[FAN_CURVE_MAX_TEMP - FAN_CURVE_MIN_TEMP + 1 + FAN_CURVE_MAX_HYSTERESIS];
+} fan_curve_lut_t;
+
+/**
+ * \brief Parse "temperature:duty,..." with an optional hysteresis after a space.
+ *
+ * Temperatures are degrees C with up to one decimal, for example
+ * "30:20,40:60,50:100 1.5". Points must rise in temperature, must not fall
+ * in duty and must lie within the table. Without a hysteresis
+ * FAN_CURVE_DEFAULT_HYSTERESIS is used.
+ *
+ * \return false if the text isn't a valid curve; curve is then undefined.
+ */
+bool fan_curve_parse(fan_curve_t *curve, const char *text);
+
+/**
+ * \brief Write a curve in the text fan_curve_parse() takes.
+ *
+ * \param buf At least FAN_CURVE_TEXT_SIZE bytes.
+ * \return Length, without the terminator.
+ */
+size_t fan_curve_format(const fan_curve_t *curve, char *buf);
+
+/**
+ * \brief Whether a curve, e.g. one read back from flash, is well formed.
+ */
+bool fan_curve_is_valid(const fan_curve_t *curve);
+
+/**
+ * \brief Build the lookup table of a valid curve with at least one point.
+ */
+void fan_curve_compile(const fan_curve_t *curve, fan_curve_lut_t *lut);
+
+/**
+ * \brief Duty for a temperature, starting from the current duty.
+ *
+ * \param temperature Tenths of a degree C.
+ * \param duty Duty currently applied, in percent.
+ */
+static inline uint8_t fan_curve_lookup(const fan_curve_lut_t *lut, int16_t temperature, uint8_t duty) {
+    int32_t index = temperature - FAN_CURVE_MIN_TEMP;
+    if (index < 0)  index = 0;
+    if (index > FAN_CURVE_MAX_TEMP - FAN_CURVE_MIN_TEMP)    index = FAN_CURVE_MAX_TEMP - FAN_CURVE_MIN_TEMP;
+    uint8_t rising = lut->duty[index];
+    if (rising >= duty) {
+        return rising;
+    }
+    // falling: hold the duty until the temperature for it is hysteresis away
+    uint8_t falling = lut->duty[index + lut->hysteresis];
+    return falling < duty ? falling : duty;
+}
+
+#endif // _FAN_CURVE_H_
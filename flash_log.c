@@ -0,0 +1,254 @@
+#include "flash_log.h"
+
+#include <stddef.h>
+#include <string.h>
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "pico/flash.h"
+
+#define LOG_SECTORS (FLASH_LOG_SIZE / FLASH_SECTOR_SIZE)
+#define SECTOR_PAGES (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define LOG_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_LOG_SIZE)
+#define LOG_MAGIC 0x474f4c46            // "FLOG"
+#define NO_RECORDS UINT32_MAX           // sector index entry of an erased or foreign sector
+
+static const uint32_t SAFE_EXECUTE_TIMEOUT_MS = 10;    // for the other core to pause
+
+typedef struct sector_header_t {
+    uint32_t magic;
+    uint32_t first_index;   // index of the sector's first record
+    uint32_t time_ms;       // time of that record, so the log time survives an empty sector
+    uint32_t check;         // of the fields above
+} sector_header_t;
+
+typedef struct log_page_t {
+    history_sample_t records[FLASH_LOG_PAGE_RECORDS];
+    uint32_t check;         // of the records
+} log_page_t;
+
+_Static_assert(sizeof(log_page_t) == FLASH_PAGE_SIZE, "a batch fills one flash page");
+_Static_assert((SECTOR_PAGES - 1) * FLASH_LOG_PAGE_RECORDS == FLASH_LOG_SECTOR_RECORDS, "records per sector");
+
+typedef struct flash_op_t {
+    uint32_t offset;
+    bool erase;             // the sector first
+    const void *page;
+} flash_op_t;
+
+// sector index, rebuilt from the headers on boot. Appends change it from the
+// main loop and history reads it from lwIP callbacks on the same core, so it
+// only changes with interrupts masked.
+static uint32_t first_index[LOG_SECTORS];
+static bool empty;
+static uint32_t oldest;         // sector holding the tail
+static uint32_t newest;         // sector being filled
+static uint32_t next_page;      // in newest, SECTOR_PAGES once it is full
+
+static log_page_t batch;
+static uint32_t batch_count;
+static uint8_t header_page[FLASH_PAGE_SIZE];
+static const log_page_t *checked_page;  // last page whose checksum passed
+
+
+static uint32_t checksum(const void *data, size_t len) {
+    // FNV-1a
+    const uint8_t *bytes = data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+
+static uint32_t sector_offset(uint32_t sector) {
+    return LOG_OFFSET + sector * FLASH_SECTOR_SIZE;
+}
+
+
+static const sector_header_t *header_at(uint32_t sector) {
+    return (const sector_header_t *)(XIP_BASE + sector_offset(sector));
+}
+
+
+static const log_page_t *page_at(uint32_t sector, uint32_t page) {
+    return (const log_page_t *)(XIP_BASE + sector_offset(sector) + page * FLASH_PAGE_SIZE);
+}
+
+
+static bool page_erased(const log_page_t *page) {
+    const uint32_t *words = (const uint32_t *)page;
+    for (size_t i = 0; i < FLASH_PAGE_SIZE / sizeof(uint32_t); i++) {
+        if (words[i] != 0xFFFFFFFF)     return false;
+    }
+    return true;
+}
+
+
+static bool page_valid(const log_page_t *page) {
+    if (page != checked_page) {
+        if (page->check != checksum(page->records, sizeof(page->records)))  return false;
+        checked_page = page;
+    }
+    return true;
+}
+
+
+// Runs with the other core paused and interrupts off
+static void flash_op(void *param) {
+    const flash_op_t *op = (const flash_op_t *)param;
+    if (op->erase) {
+        flash_range_erase(op->offset, FLASH_SECTOR_SIZE);
+    }
+    flash_range_program(op->offset, op->page, FLASH_PAGE_SIZE);
+}
+
+
+// Erase the sector after the newest and write its header; the oldest records go if the ring is full
+static bool start_sector(uint32_t first, uint32_t time_ms) {
+    uint32_t sector = empty ? 0 : (newest + 1) % LOG_SECTORS;
+    memset(header_page, 0xFF, sizeof(header_page));
+    sector_header_t *header = (sector_header_t *)header_page;
+    header->magic = LOG_MAGIC;
+    header->first_index = first;
+    header->time_ms = time_ms;
+    header->check = checksum(header, offsetof(sector_header_t, check));
+
+    // drop the sector from the index before erasing it, so no reader looks at it meanwhile
+    uint32_t save = save_and_disable_interrupts();
+    if (!empty && sector == oldest) {
+        oldest = (oldest + 1) % LOG_SECTORS;
+    }
+    checked_page = NULL;
+    restore_interrupts(save);
+
+    flash_op_t op = { sector_offset(sector), true, header_page };
+    if (flash_safe_execute(flash_op, &op, SAFE_EXECUTE_TIMEOUT_MS) != PICO_OK) {
+        return false;
+    }
+    save = save_and_disable_interrupts();
+    if (empty) {
+        oldest = sector;
+    }
+    first_index[sector] = first;
+    newest = sector;
+    next_page = 1;
+    empty = false;
+    restore_interrupts(save);
+    return true;
+}
+
+
+uint32_t flash_log_init(void) {
+    empty = true;
+    for (uint32_t sector = 0; sector < LOG_SECTORS; sector++) {
+        const sector_header_t *header = header_at(sector);
+        bool valid = header->magic == LOG_MAGIC && header->check == checksum(header, offsetof(sector_header_t, check));
+        first_index[sector] = valid ? header->first_index : NO_RECORDS;
+        if (!valid) {
+            continue;
+        }
+        // indices only grow, so the sectors sort by their first record
+        if (empty || header->first_index < first_index[oldest])     oldest = sector;
+        if (empty || header->first_index > first_index[newest])     newest = sector;
+        empty = false;
+    }
+    batch_count = 0;
+    checked_page = NULL;
+    if (empty) {
+        next_page = SECTOR_PAGES;
+        return 0;
+    }
+
+    // writing continues after the last page programmed, torn or not
+    uint32_t resume_ms = header_at(newest)->time_ms;
+    next_page = 0;
+    for (uint32_t page = SECTOR_PAGES - 1; page > 0; page--) {
+        const log_page_t *p = page_at(newest, page);
+        if (page_erased(p)) {
+            continue;
+        }
+        if (next_page == 0)     next_page = page + 1;
+        if (page_valid(p)) {
+            resume_ms = p->records[FLASH_LOG_PAGE_RECORDS - 1].time_ms + 1;
+            break;
+        }
+    }
+    if (next_page == 0)     next_page = 1;
+    return resume_ms;
+}
+
+
+void flash_log_append(const history_sample_t *sample) {
+    batch.records[batch_count++] = *sample;
+    if (batch_count < FLASH_LOG_PAGE_RECORDS) {
+        return;
+    }
+    batch_count = 0;
+    batch.check = checksum(batch.records, sizeof(batch.records));
+
+    // if the other core can't be paused the batch is dropped; an untouched
+    // page takes the next one
+    if (next_page == SECTOR_PAGES && !start_sector(flash_log_head(), batch.records[0].time_ms)) {
+        return;
+    }
+    flash_op_t op = { sector_offset(newest) + next_page * FLASH_PAGE_SIZE, false, &batch };
+    if (flash_safe_execute(flash_op, &op, SAFE_EXECUTE_TIMEOUT_MS) == PICO_OK) {
+        uint32_t save = save_and_disable_interrupts();
+        next_page++;
+        restore_interrupts(save);
+    }
+}
+
+
+uint32_t flash_log_tail(void) {
+    return empty ? 0 : first_index[oldest];
+}
+
+
+uint32_t flash_log_head(void) {
+    return empty ? 0 : first_index[newest] + (next_page - 1) * FLASH_LOG_PAGE_RECORDS;
+}
+
+
+bool flash_log_get(uint32_t index, history_sample_t *sample) {
+    if (index < flash_log_tail() || index >= flash_log_head()) {
+        return false;
+    }
+    // the last sector, in ring order from the oldest, that starts at or before index
+    uint32_t lo = 0;
+    uint32_t hi = (newest + LOG_SECTORS - oldest) % LOG_SECTORS;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi + 1) / 2;
+        if (first_index[(oldest + mid) % LOG_SECTORS] <= index) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    uint32_t sector = (oldest + lo) % LOG_SECTORS;
+    uint32_t offset = index - first_index[sector];
+    const log_page_t *page = page_at(sector, 1 + offset / FLASH_LOG_PAGE_RECORDS);
+    if (!page_valid(page)) {
+        return false;
+    }
+    *sample = page->records[offset % FLASH_LOG_PAGE_RECORDS];
+    return true;
+}
+
+
+uint32_t flash_log_find(uint32_t time_ms) {
+    uint32_t lo = flash_log_tail();
+    uint32_t hi = flash_log_head();
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        history_sample_t sample;
+        if (!flash_log_get(mid, &sample) || sample.time_ms < time_ms) {
+            // a torn page is skipped like the older records before it
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
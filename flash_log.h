@@ -0,0 +1,71 @@
+#ifndef _FLASH_LOG_H_
+#define _FLASH_LOG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "history.h"
+
+/** \file flash_log.h
+ *
+ * \brief Append-only sample log in on-board flash, kept across reboots.
+ *
+ * The log fills the last FLASH_LOG_SIZE bytes of flash as a ring of erase
+ * sectors, so every sector is erased once per lap and wear is even. The first
+ * page of a sector is its header: the index of its first record and the log
+ * time it started at. The other pages hold FLASH_LOG_PAGE_RECORDS samples and
+ * a checksum each. Samples are batched in RAM and programmed a whole page at
+ * a time, so flash (and XIP) is only stalled for one page program per batch
+ * and one sector erase per FLASH_LOG_SECTOR_RECORDS samples. A batch not yet
+ * programmed is lost on reset.
+ *
+ * On boot the log is recovered from the sector headers alone; only the newest
+ * sector's pages are checked, to find where writing continues. Pages torn by a
+ * reset mid-program fail their checksum and read as a gap.
+ *
+ * All functions must be called from the same core. Programming uses
+ * flash_safe_execute(), so the other core must have called
+ * flash_safe_execute_core_init().
+ */
+
+#define FLASH_LOG_SIZE (1024 * 1024)    // reserved at the end of flash, whole sectors
+#define FLASH_LOG_PAGE_RECORDS 21       // samples per 256 byte page, with a 4 byte checksum
+#define FLASH_LOG_SECTOR_RECORDS (15 * FLASH_LOG_PAGE_RECORDS)  // 15 data pages per sector
+
+/**
+ * \brief Recover the log written before the last reset.
+ *
+ * \return Log time to continue from: one past the newest recovered sample's
+ *         time_ms, 0 if the log is empty.
+ */
+uint32_t flash_log_init(void);
+
+/**
+ * \brief Append a sample; a full batch is programmed before returning.
+ *
+ * Samples must come in time_ms order.
+ */
+void flash_log_append(const history_sample_t *sample);
+
+/**
+ * \brief Index of the oldest record still in flash.
+ */
+uint32_t flash_log_tail(void);
+
+/**
+ * \brief Index one past the newest record programmed to flash.
+ */
+uint32_t flash_log_head(void);
+
+/**
+ * \brief Read a programmed record.
+ *
+ * \return false outside [tail, head) or if the record's page is torn.
+ */
+bool flash_log_get(uint32_t index, history_sample_t *sample);
+
+/**
+ * \brief First index in [tail, head) whose time is >= time_ms, head if none.
+ */
+uint32_t flash_log_find(uint32_t time_ms);
+
+#endif // _FLASH_LOG_H_
@@ -0,0 +1,113 @@
+#include "flash_settings.h"
+
+#include <stdint.h>
+#include <string.h>
+#include "hardware/flash.h"
+#include "pico/flash.h"
+
+#include "flash_log.h"
+
+#define SETTINGS_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_LOG_SIZE - FLASH_SECTOR_SIZE)
+#define SECTOR_PAGES (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define SETTINGS_MAGIC 0x54455346       // "FSET"
+
+static const uint32_t SAFE_EXECUTE_TIMEOUT_MS = 10;    // for the other core to pause
+
+typedef struct settings_page_t {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t check;         // of size and data
+    uint8_t data[FLASH_SETTINGS_MAX_SIZE];
+    uint32_t reserved;
+} settings_page_t;
+
+_Static_assert(sizeof(settings_page_t) == FLASH_PAGE_SIZE, "a record fills one flash page");
+
+typedef struct flash_op_t {
+    uint32_t offset;
+    bool erase;             // the sector first
+    const void *page;
+} flash_op_t;
+
+static settings_page_t page_buf;
+
+
+static uint32_t checksum(const settings_page_t *page) {
+    // FNV-1a
+    const uint8_t *bytes = (const uint8_t *)&page->size;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(page->size); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    for (size_t i = 0; i < page->size && i < FLASH_SETTINGS_MAX_SIZE; i++) {
+        hash = (hash ^ page->data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+
+static const settings_page_t *page_at(uint32_t page) {
+    return (const settings_page_t *)(XIP_BASE + SETTINGS_OFFSET + page * FLASH_PAGE_SIZE);
+}
+
+
+static bool page_erased(const settings_page_t *page) {
+    const uint32_t *words = (const uint32_t *)page;
+    for (size_t i = 0; i < FLASH_PAGE_SIZE / sizeof(uint32_t); i++) {
+        if (words[i] != 0xFFFFFFFF)     return false;
+    }
+    return true;
+}
+
+
+static bool page_valid(const settings_page_t *page) {
+    return page->magic == SETTINGS_MAGIC && page->size <= FLASH_SETTINGS_MAX_SIZE && page->check == checksum(page);
+}
+
+
+// Runs with the other core paused and interrupts off
+static void flash_op(void *param) {
+    const flash_op_t *op = (const flash_op_t *)param;
+    if (op->erase) {
+        flash_range_erase(op->offset, FLASH_SECTOR_SIZE);
+    }
+    flash_range_program(op->offset, op->page, FLASH_PAGE_SIZE);
+}
+
+
+bool flash_settings_load(void *data, size_t size) {
+    for (uint32_t page = SECTOR_PAGES; page-- > 0; ) {
+        const settings_page_t *p = page_at(page);
+        if (page_valid(p)) {
+            if (p->size != size) {
+                return false;   // saved by a build with another layout
+            }
+            memcpy(data, p->data, size);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool flash_settings_save(const void *data, size_t size) {
+    if (size > FLASH_SETTINGS_MAX_SIZE) {
+        return false;
+    }
+    // the first erased page after the last one used, or a fresh sector
+    uint32_t next = 0;
+    for (uint32_t page = SECTOR_PAGES; page-- > 0; ) {
+        if (!page_erased(page_at(page))) {
+            next = page + 1;
+            break;
+        }
+    }
+    memset(&page_buf, 0xFF, sizeof(page_buf));
+    page_buf.magic = SETTINGS_MAGIC;
+    page_buf.size = size;
+    memcpy(page_buf.data, data, size);
+    page_buf.check = checksum(&page_buf);
+
+    flash_op_t op = { SETTINGS_OFFSET + (next % SECTOR_PAGES) * FLASH_PAGE_SIZE, next == SECTOR_PAGES, &page_buf };
+    return flash_safe_execute(flash_op, &op, SAFE_EXECUTE_TIMEOUT_MS) == PICO_OK;
+}
@@ -0,0 +1,41 @@
+#ifndef _FLASH_SETTINGS_H_
+#define _FLASH_SETTINGS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** \file flash_settings.h
+ *
+ * \brief Settings record in a flash sector of its own, kept across reboots.
+ *
+ * The sector sits just below the flash log. Each save programs the next free
+ * page with the whole record and a checksum. The sector is only erased once
+ * all its pages are used, so it wears once per 16 saves. Load takes the last
+ * page whose checksum passes, so a save torn by a reset leaves the one
+ * before it in place; only a reset during the erase loses the settings.
+ *
+ * Must be called from the core that programs the flash log. Programming uses
+ * flash_safe_execute(), so the other core must have called
+ * flash_safe_execute_core_init().
+ */
+
+#define FLASH_SETTINGS_MAX_SIZE 240     // a page, less the record header
+
+/**
+ * \brief Read the last saved record.
+ *
+ * \param data Receives size bytes.
+ * \param size Record size; a record saved with another size isn't loaded.
+ * \return false if there is no valid record of this size.
+ */
+bool flash_settings_load(void *data, size_t size);
+
+/**
+ * \brief Save a record, replacing the previous one.
+ *
+ * \param size At most FLASH_SETTINGS_MAX_SIZE.
+ * \return false if the flash couldn't be programmed; the previous record stays.
+ */
+bool flash_settings_save(const void *data, size_t size);
+
+#endif // _FLASH_SETTINGS_H_
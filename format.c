@@ -0,0 +1,33 @@
+#include "format.h"
+
+
+size_t format_uint(char *buf, uint32_t value) {
+    char digits[10];
+    size_t n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    size_t len = 0;
+    while (n > 0) {
+        buf[len++] = digits[--n];
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+
+size_t format_tenths(char *buf, int32_t tenths) {
+    size_t len = 0;
+    // negate as unsigned so INT32_MIN doesn't overflow
+    uint32_t magnitude = tenths < 0 ? 0u - (uint32_t)tenths : (uint32_t)tenths;
+    if (tenths < 0) {
+        buf[len++] = '-';
+    }
+    len += format_uint(buf + len, magnitude / 10);
+    buf[len++] = '.';
+    buf[len++] = '0' + magnitude % 10;
+    buf[len] = '\0';
+    return len;
+}
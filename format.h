@@ -0,0 +1,33 @@
+#ifndef _FORMAT_H_
+#define _FORMAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** \file format.h
+ *
+ * \brief Integer to decimal text, for replies built from fixed-point values.
+ *
+ * Measurements are kept in tenths, so printing them needs no float math and
+ * no float printf support.
+ */
+
+#define FORMAT_TENTHS_SIZE 14   // "-214748364.8" and the terminator
+
+/**
+ * \brief Write an unsigned integer.
+ *
+ * \param buf Receives the digits and a terminator, at least 11 bytes.
+ * \return Number of characters, without the terminator.
+ */
+size_t format_uint(char *buf, uint32_t value);
+
+/**
+ * \brief Write a value in tenths as a decimal with one fractional digit, "-12.5".
+ *
+ * \param buf Receives the text and a terminator, at least FORMAT_TENTHS_SIZE bytes.
+ * \return Number of characters, without the terminator.
+ */
+size_t format_tenths(char *buf, int32_t tenths);
+
+#endif // _FORMAT_H_
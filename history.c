@@ -0,0 +1,151 @@
+#include "history.h"
+
+#include <string.h>
+#include "flash_log.h"
+
+#define HISTORY_MASK (HISTORY_CAPACITY - 1)
+
+static history_sample_t ring[HISTORY_CAPACITY];
+static volatile uint32_t head = 0;   // total number of samples appended
+
+
+static size_t put_varint(uint8_t *buf, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        buf[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = (uint8_t)value;
+    return n;
+}
+
+
+static uint32_t zigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+
+static size_t put_record(history_encoder_t *encoder, uint8_t *buf, const history_sample_t *sample) {
+    const history_sample_t *prev = &encoder->prev;
+    size_t pos = put_varint(buf, sample->time_ms - prev->time_ms + 1);
+    pos += put_varint(buf + pos, zigzag(sample->temperature - prev->temperature));
+    pos += put_varint(buf + pos, zigzag(sample->humidity - prev->humidity));
+    pos += put_varint(buf + pos, zigzag(sample->rpm - prev->rpm));
+    pos += put_varint(buf + pos, zigzag(sample->duty - prev->duty));
+    pos += put_varint(buf + pos, sample->flags);
+    encoder->prev = *sample;
+    return pos;
+}
+
+
+uint32_t history_init(void) {
+    return flash_log_init();
+}
+
+
+void history_append(const history_sample_t *sample) {
+    uint32_t seq = head;
+    ring[seq & HISTORY_MASK] = *sample;
+    // publish the slot only once it is fully written
+    __atomic_store_n(&head, seq + 1, __ATOMIC_RELEASE);
+    flash_log_append(sample);
+}
+
+
+uint32_t history_head(void) {
+    return __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+}
+
+
+uint32_t history_tail(void) {
+    // the oldest slot is the next one to be overwritten, so it is never handed out
+    uint32_t h = history_head();
+    return h >= HISTORY_CAPACITY ? h - (HISTORY_CAPACITY - 1) : 0;
+}
+
+
+bool history_get(uint32_t seq, history_sample_t *sample) {
+    if (seq - history_tail() >= history_head() - history_tail()) {
+        return false;
+    }
+    *sample = ring[seq & HISTORY_MASK];
+    // the writer may have lapped us while copying
+    return history_head() - seq < HISTORY_CAPACITY;
+}
+
+
+// first sequence number in [tail, head) whose time is >= time_ms
+static uint32_t history_find(uint32_t time_ms) {
+    uint32_t lo = history_tail();
+    uint32_t hi = history_head();
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        history_sample_t sample;
+        if (!history_get(mid, &sample)) {
+            // overwritten while searching, everything before it is gone too
+            lo = mid + 1;
+        } else if (sample.time_ms < time_ms) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+
+void history_encoder_init(history_encoder_t *encoder, uint32_t from_ms, uint32_t to_ms) {
+    memset(encoder, 0, sizeof(history_encoder_t));
+    // samples older than the RAM ring come from flash, the flash copies of
+    // the ones still in RAM are skipped
+    history_sample_t oldest;
+    uint32_t ram_from_ms = history_get(history_tail(), &oldest) ? oldest.time_ms : UINT32_MAX;
+    encoder->flash_index = flash_log_find(from_ms);
+    encoder->flash_end = flash_log_find(ram_from_ms);
+    encoder->seq = history_find(from_ms);
+    encoder->end = history_head();
+    encoder->to_ms = to_ms;
+}
+
+
+size_t history_encode(history_encoder_t *encoder, uint8_t *buf, size_t len) {
+    size_t pos = 0;
+    while (encoder->flash_index < encoder->flash_end && len - pos >= HISTORY_RECORD_MAX_SIZE) {
+        history_sample_t sample;
+        if (encoder->flash_index < flash_log_tail()) {
+            // erased to make room meanwhile
+            encoder->flash_index = flash_log_tail();
+            continue;
+        }
+        if (!flash_log_get(encoder->flash_index++, &sample)) {
+            continue;   // torn page
+        }
+        if (sample.time_ms > encoder->to_ms) {
+            encoder->flash_end = encoder->flash_index;
+            encoder->end = encoder->seq;
+            break;
+        }
+        pos += put_record(encoder, buf + pos, &sample);
+    }
+    while (encoder->flash_index >= encoder->flash_end && encoder->seq < encoder->end &&
+           len - pos >= HISTORY_RECORD_MAX_SIZE) {
+        history_sample_t sample;
+        if (!history_get(encoder->seq, &sample)) {
+            // lapped by the writer, skip to the oldest sample still available
+            encoder->seq = history_tail();
+            continue;
+        }
+        if (sample.time_ms > encoder->to_ms) {
+            encoder->end = encoder->seq;
+            break;
+        }
+        pos += put_record(encoder, buf + pos, &sample);
+        encoder->seq++;
+    }
+    return pos;
+}
+
+
+bool history_encoder_done(const history_encoder_t *encoder) {
+    return encoder->flash_index >= encoder->flash_end && encoder->seq >= encoder->end;
+}
@@ -0,0 +1,107 @@
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** \file history.h
+ *
+ * \brief Telemetry history.
+ *
+ * Fixed-size ring of timestamped samples in RAM, appended by the sampling loop
+ * and exported by the TCP server as a delta + varint encoded stream. Every
+ * sample also goes to the flash log (flash_log.h), and an export starts with
+ * the older samples from there, so the history outlives reboots.
+ *
+ * Times are on the log clock: ms since boot, plus the time the log had
+ * reached before this boot (downtime isn't counted). See history_init().
+ */
+
+#define HISTORY_CAPACITY 8192   // samples, must be a power of two (~4.5 h at 2 s)
+
+#define HISTORY_FLAG_SENSOR_OK  0x01    // temperature/humidity come from a good read
+#define HISTORY_FLAG_FAN_AUTO   0x02    // fan under automatic control
+#define HISTORY_FLAG_FAN_STALLED 0x04   // fan driven but its tach stopped pulsing
+
+// upper bound of one encoded record: 5 byte time + 3 x 3 byte readings + 2 x 2 byte duty/flags
+#define HISTORY_RECORD_MAX_SIZE 18
+
+/**
+ * \brief One telemetry sample, fixed-point.
+ */
+typedef struct history_sample_t {
+    uint32_t time_ms;       // log clock, ms
+    int16_t temperature;    // tenths of a degree C
+    uint16_t humidity;      // tenths of %RH
+    uint16_t rpm;
+    uint8_t duty;           // fan duty in percent
+    uint8_t flags;          // HISTORY_FLAG_*
+} history_sample_t;
+
+/**
+ * \brief Stream encoder state, one per export in progress.
+ */
+typedef struct history_encoder_t {
+    uint32_t flash_index;   // next flash log record to encode
+    uint32_t flash_end;     // one past the last one, the rest are still in RAM
+    uint32_t seq;           // next sample to encode
+    uint32_t end;           // one past the last sample to encode
+    uint32_t to_ms;
+    history_sample_t prev;  // base for the deltas
+} history_encoder_t;
+
+/**
+ * \brief Recover the flash log.
+ *
+ * \return Log clock at boot, to be added to ms since boot when stamping samples.
+ */
+uint32_t history_init(void);
+
+/**
+ * \brief Append a sample, to RAM and the flash log. Single writer only, on
+ * the core that also exports.
+ */
+void history_append(const history_sample_t *sample);
+
+/**
+ * \brief Sequence number the next appended sample will get.
+ */
+uint32_t history_head(void);
+
+/**
+ * \brief Sequence number of the oldest sample that can still be read.
+ */
+uint32_t history_tail(void);
+
+/**
+ * \brief Copy a sample out of the RAM ring.
+ *
+ * \return false if the sample has been (or is being) overwritten.
+ */
+bool history_get(uint32_t seq, history_sample_t *sample);
+
+/**
+ * \brief Prepare an export of all samples with from_ms <= time_ms <= to_ms.
+ */
+void history_encoder_init(history_encoder_t *encoder, uint32_t from_ms, uint32_t to_ms);
+
+/**
+ * \brief Encode as many whole records as fit into buf.
+ *
+ * Each record is a varint of (time delta + 1) followed by zigzag varints of
+ * the temperature, humidity, rpm and duty deltas and a varint of the flags.
+ * Deltas are taken against the previous record, starting from all zeros.
+ * A single 0 byte (time delta 0) marks the end of the stream; it is written
+ * by the caller once history_encoder_done() returns true.
+ *
+ * \return Number of bytes written.
+ */
+size_t history_encode(history_encoder_t *encoder, uint8_t *buf, size_t len);
+
+/**
+ * \brief Whether all records of the export have been encoded.
+ */
+bool history_encoder_done(const history_encoder_t *encoder);
+
+#endif // _HISTORY_H_
@@ -0,0 +1,364 @@
+#include "http_metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "pico/cyw43_arch.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+
+#define DEBUG_printf printf
+#define POLL_INTERVAL 2 // tcp_poll interval, in 500ms coarse timer ticks
+#define IDLE_POLLS (HTTP_METRICS_IDLE_TIMEOUT_S * 2 / POLL_INTERVAL)
+
+// fixed responses, all closing the connection
+static const char BAD_REQUEST[] =
+    "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char NOT_FOUND[] =
+    "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\nConnection: close\r\n\r\n"
+    "Not found\n";
+static const char NOT_ALLOWED[] =
+    "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET, HEAD\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+
+// Render into a buffer lwIP no longer sends from, or keep serving the current one
+static http_metrics_response_t *get_response(http_metrics_t *metrics) {
+    if (metrics->current != NULL && !metrics->stale) {
+        return metrics->current;
+    }
+    http_metrics_response_t *response = NULL;
+    for (int i = 0; i < 2 && response == NULL; i++) {
+        if (metrics->responses[i].users == 0) {
+            response = &metrics->responses[i];
+        }
+    }
+    if (response == NULL) {
+        return metrics->current;    // both in flight, stale for one more scrape
+    }
+
+    // cleared first, so a sample arriving while this renders invalidates it again
+    metrics->stale = false;
+    metrics->renders++;
+    char *body = response->buf + HTTP_METRICS_HEADER_SIZE;
+    size_t body_len = metrics->render(metrics->user_data, body, metrics->body_size);
+    if (body_len + 1 >= metrics->body_size) {
+        // full, so the last line may be cut off: serve only the complete lines
+        while (body_len > 0 && body[body_len - 1] != '\n') {
+            body_len--;
+        }
+        metrics->truncated++;
+        DEBUG_printf("Metrics body doesn't fit %u bytes\n", metrics->body_size);
+    }
+
+    // the headers go right in front of the body, so the response is one buffer
+    char header[HTTP_METRICS_HEADER_SIZE];
+    int header_len = snprintf(header, sizeof(header),
+        "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: %u\r\n\r\n",
+        (unsigned)body_len);
+    memcpy(body - header_len, header, header_len);
+    response->data = body - header_len;
+    response->header_len = header_len;
+    response->len = header_len + body_len;
+    metrics->current = response;
+    return response;
+}
+
+
+// Hand the pending response to lwIP without copying; returns false if lwIP has no room yet
+static bool http_conn_send(http_metrics_conn_t *conn) {
+    if (conn->tx_len == 0) {
+        return true;
+    }
+    err_t err = tcp_write(conn->pcb, conn->tx_data, conn->tx_len, 0);
+    if (err == ERR_MEM) {
+        return false;   // retried from http_conn_sent or http_conn_poll
+    } else if (err != ERR_OK) {
+        DEBUG_printf("Failed to write metrics %d\n", err);
+        conn->close_after = true;
+        conn->tx_len = 0;
+        return true;
+    }
+    conn->unacked += conn->tx_len;
+    conn->tx_len = 0;
+    tcp_output(conn->pcb);
+    return true;
+}
+
+
+static void http_conn_respond(http_metrics_conn_t *conn, http_metrics_response_t *response, const char *data,
+                              size_t len, bool close_after) {
+    conn->response = response;
+    if (response != NULL) {
+        response->users++;
+    }
+    conn->tx_data = data;
+    conn->tx_len = len;
+    conn->close_after = close_after;
+}
+
+
+// The response is acked, or lwIP is gone: let the buffer be rendered into again
+static void http_conn_release(http_metrics_conn_t *conn) {
+    if (conn->response != NULL) {
+        conn->response->users--;
+        conn->response = NULL;
+    }
+    conn->tx_len = 0;
+    conn->unacked = 0;
+}
+
+
+// Value of a header in the request head, or NULL
+static const char *header_value(const char *head, const char *name) {
+    size_t name_len = strlen(name);
+    for (const char *line = strstr(head, "\r\n"); line != NULL; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, name, name_len) == 0 && line[2 + name_len] == ':') {
+            const char *value = line + 3 + name_len;
+            while (*value == ' ')   value++;
+            return value;
+        }
+    }
+    return NULL;
+}
+
+
+// Answer the NUL-terminated request head
+static void http_conn_handle(http_metrics_conn_t *conn, const char *head) {
+    http_metrics_t *metrics = conn->metrics;
+    char method[8], target[64], version[16];
+    if (sscanf(head, "%7s %63s %15s", method, target, version) != 3 || strncmp(version, "HTTP/1.", 7) != 0) {
+        http_conn_respond(conn, NULL, BAD_REQUEST, sizeof(BAD_REQUEST) - 1, true);
+        return;
+    }
+    bool head_only = strcmp(method, "HEAD") == 0;
+    if (!head_only && strcmp(method, "GET") != 0) {
+        http_conn_respond(conn, NULL, NOT_ALLOWED, sizeof(NOT_ALLOWED) - 1, true);
+        return;
+    }
+    // a query string, e.g. from a scrape config with params, is ignored
+    target[strcspn(target, "?")] = '\0';
+    if (strcmp(target, "/metrics") != 0) {
+        http_conn_respond(conn, NULL, NOT_FOUND, sizeof(NOT_FOUND) - 1, true);
+        return;
+    }
+
+    // HTTP/1.1 keeps the connection unless asked not to, HTTP/1.0 only when asked
+    const char *connection = header_value(head, "Connection");
+    bool keep_alive = strcmp(version, "HTTP/1.0") != 0;
+    if (connection != NULL) {
+        keep_alive = strncasecmp(connection, "keep-alive", 10) == 0 ||
+                     (keep_alive && strncasecmp(connection, "close", 5) != 0);
+    }
+    http_metrics_response_t *response = get_response(metrics);
+    metrics->scrapes++;
+    http_conn_respond(conn, response, response->data, head_only ? response->header_len : response->len, !keep_alive);
+}
+
+
+static void http_conn_free(http_metrics_conn_t *conn) {
+    http_conn_release(conn);
+    conn->pcb = NULL;
+    conn->closing = false;
+}
+
+
+static void http_conn_detach(http_metrics_conn_t *conn) {
+    struct tcp_pcb *pcb = conn->pcb;
+    tcp_arg(pcb, NULL);
+    tcp_poll(pcb, NULL, 0);
+    tcp_sent(pcb, NULL);
+    tcp_recv(pcb, NULL);
+    tcp_err(pcb, NULL);
+}
+
+
+static err_t http_conn_close(http_metrics_conn_t *conn) {
+    struct tcp_pcb *pcb = conn->pcb;
+    conn->tx_len = 0;
+    if (conn->unacked > 0) {
+        // lwIP still sends from the response; keep the sent and err callbacks
+        // to learn when it is free again
+        tcp_poll(pcb, NULL, 0);
+        tcp_recv(pcb, NULL);
+    } else {
+        http_conn_detach(conn);
+    }
+    err_t err = tcp_close(pcb);
+    if (err != ERR_OK) {
+        DEBUG_printf("close failed %d, calling abort\n", err);
+        http_conn_detach(conn);
+        tcp_abort(pcb);
+        err = ERR_ABRT;
+    } else if (conn->unacked > 0) {
+        conn->closing = true;
+        return ERR_OK;
+    }
+    http_conn_free(conn);
+    return err;
+}
+
+
+// Answer buffered requests one at a time, each once the previous response is acked
+static err_t http_conn_process(http_metrics_conn_t *conn) {
+    while (http_conn_send(conn) && conn->unacked == 0) {
+        if (conn->response != NULL || conn->close_after) {
+            // the previous response is through
+            http_conn_release(conn);
+            if (conn->close_after) {
+                return http_conn_close(conn);
+            }
+        }
+        conn->request[conn->recv_len] = '\0';
+        char *end = strstr(conn->request, "\r\n\r\n");
+        if (end == NULL) {
+            if (conn->recv_len < HTTP_METRICS_REQUEST_SIZE - 1) {
+                break;  // wait for the rest of the head
+            }
+            DEBUG_printf("Oversized HTTP request\n");
+            conn->recv_len = 0;
+            http_conn_respond(conn, NULL, BAD_REQUEST, sizeof(BAD_REQUEST) - 1, true);
+            continue;
+        }
+        end[2] = '\0';  // the head keeps the CRLF ending its last header
+        http_conn_handle(conn, conn->request);
+        size_t consumed = end + 4 - conn->request;
+        memmove(conn->request, conn->request + consumed, conn->recv_len - consumed);
+        conn->recv_len -= consumed;
+    }
+    return ERR_OK;
+}
+
+
+static err_t http_conn_sent(void *arg, struct tcp_pcb *tpcb, u16_t len) {
+    http_metrics_conn_t *conn = (http_metrics_conn_t *)arg;
+    conn->idle_polls = 0;
+    conn->unacked -= len < conn->unacked ? len : conn->unacked;
+
+    if (conn->closing) {
+        if (conn->unacked == 0) {
+            http_conn_detach(conn);
+            http_conn_free(conn);
+        }
+        return ERR_OK;
+    }
+    return http_conn_process(conn);
+}
+
+
+static err_t http_conn_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) {
+    http_metrics_conn_t *conn = (http_metrics_conn_t *)arg;
+    if (!p) {
+        return http_conn_close(conn);
+    }
+    cyw43_arch_lwip_check();
+    conn->idle_polls = 0;
+
+    // request heads are small, so they are copied out and acked right away;
+    // one that doesn't fit fails the size check in http_conn_process
+    u16_t space = HTTP_METRICS_REQUEST_SIZE - 1 - conn->recv_len;
+    u16_t len = p->tot_len < space ? p->tot_len : space;
+    conn->recv_len += pbuf_copy_partial(p, conn->request + conn->recv_len, len, 0);
+    tcp_recved(tpcb, p->tot_len);
+    pbuf_free(p);
+    return http_conn_process(conn);
+}
+
+
+static err_t http_conn_poll(void *arg, struct tcp_pcb *tpcb) {
+    http_metrics_conn_t *conn = (http_metrics_conn_t *)arg;
+    if (++conn->idle_polls >= IDLE_POLLS) {
+        return http_conn_close(conn);
+    }
+    // retry a response lwIP had no memory for, in case no ack is on the way
+    return http_conn_process(conn);
+}
+
+
+static void http_conn_err(void *arg, err_t err) {
+    http_metrics_conn_t *conn = (http_metrics_conn_t *)arg;
+    if (err != ERR_ABRT) {
+        DEBUG_printf("http_conn_err %d\n", err);
+    }
+    // the pcb is already gone
+    if (conn) {
+        http_conn_free(conn);
+    }
+}
+
+
+static err_t http_metrics_accept(void *arg, struct tcp_pcb *client_pcb, err_t err) {
+    http_metrics_t *metrics = (http_metrics_t *)arg;
+    if (err != ERR_OK || client_pcb == NULL) {
+        DEBUG_printf("Failure in accept\n");
+        return ERR_VAL;
+    }
+
+    http_metrics_conn_t *conn = NULL;
+    for (int i = 0; i < HTTP_METRICS_MAX_CONNECTIONS && conn == NULL; i++) {
+        if (metrics->conns[i].pcb == NULL) {
+            conn = &metrics->conns[i];
+        }
+    }
+    if (!conn) {
+        DEBUG_printf("No free metrics connection, rejecting client\n");
+        tcp_abort(client_pcb);
+        return ERR_ABRT;
+    }
+
+    memset(conn, 0, offsetof(http_metrics_conn_t, request));
+    conn->pcb = client_pcb;
+    conn->metrics = metrics;
+    tcp_nagle_disable(client_pcb);
+    tcp_arg(client_pcb, conn);
+    tcp_sent(client_pcb, http_conn_sent);
+    tcp_recv(client_pcb, http_conn_recv);
+    tcp_poll(client_pcb, http_conn_poll, POLL_INTERVAL);
+    tcp_err(client_pcb, http_conn_err);
+    return ERR_OK;
+}
+
+
+bool http_metrics_open(http_metrics_t *metrics, http_metrics_render_fn render, void *user_data,
+                       char *storage, uint16_t body_size) {
+    memset(metrics, 0, sizeof(http_metrics_t));
+    metrics->render = render;
+    metrics->user_data = user_data;
+    metrics->body_size = body_size;
+    for (int i = 0; i < 2; i++) {
+        metrics->responses[i].buf = storage + i * (HTTP_METRICS_HEADER_SIZE + body_size);
+    }
+
+    struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb) {
+        DEBUG_printf("failed to create pcb\n");
+        return false;
+    }
+    if (tcp_bind(pcb, NULL, HTTP_METRICS_PORT) != ERR_OK) {
+        DEBUG_printf("failed to bind to port %u\n", HTTP_METRICS_PORT);
+        tcp_abort(pcb);
+        return false;
+    }
+    metrics->server_pcb = tcp_listen_with_backlog(pcb, HTTP_METRICS_MAX_CONNECTIONS);
+    if (!metrics->server_pcb) {
+        DEBUG_printf("failed to listen\n");
+        tcp_close(pcb);
+        return false;
+    }
+    tcp_arg(metrics->server_pcb, metrics);
+    tcp_accept(metrics->server_pcb, http_metrics_accept);
+    return true;
+}
+
+
+void http_metrics_close(http_metrics_t *metrics) {
+    for (int i = 0; i < HTTP_METRICS_MAX_CONNECTIONS; i++) {
+        if (metrics->conns[i].pcb != NULL && !metrics->conns[i].closing) {
+            http_conn_close(&metrics->conns[i]);
+        }
+    }
+    if (metrics->server_pcb) {
+        tcp_arg(metrics->server_pcb, NULL);
+        tcp_close(metrics->server_pcb);
+        metrics->server_pcb = NULL;
+    }
+}
@@ -0,0 +1,125 @@
+#ifndef _HTTP_METRICS_H_
+#define _HTTP_METRICS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** \file http_metrics.h
+ *
+ * \brief Minimal HTTP/1.1 server for a Prometheus /metrics endpoint.
+ *
+ * Answers GET and HEAD of /metrics with the body of the render callback, in
+ * the Prometheus text format. The complete response, status line and headers
+ * included, is cached and is only rendered again after
+ * http_metrics_invalidate(), so a scrape normally costs one tcp_write of a
+ * prebuilt buffer. There are two response buffers. A new response can be
+ * rendered while lwIP still sends the previous one. If both are still in
+ * flight, the older data is served.
+ *
+ * Connections are kept alive between scrapes unless the client asks for
+ * close. Requests on one connection are answered one at a time. Anything
+ * else gets 404, 405 or 400 and the connection is closed. The server only
+ * reads the request line and the Connection header. It doesn't read request
+ * bodies, so a request with a body breaks the connection.
+ *
+ * The caller sizes the response buffers for the longest body it renders. A
+ * body that doesn't fit anyway is cut back to its last complete line, since
+ * Prometheus rejects a whole scrape for one partial line.
+ */
+
+#ifndef HTTP_METRICS_PORT
+#define HTTP_METRICS_PORT 80
+#endif
+#define HTTP_METRICS_MAX_CONNECTIONS 2
+#define HTTP_METRICS_IDLE_TIMEOUT_S 60
+#define HTTP_METRICS_REQUEST_SIZE 1024  // longest request head accepted
+#define HTTP_METRICS_HEADER_SIZE 128    // status line and headers of the cached response
+#define HTTP_METRICS_STORAGE_SIZE(body_size) (2 * (HTTP_METRICS_HEADER_SIZE + (body_size)))
+
+/**
+ * \brief Body renderer.
+ *
+ * Runs from lwIP context on the first scrape after an invalidation.
+ *
+ * \return Body length, less than size. size - 1 means the body may have been cut off.
+ */
+typedef size_t (*http_metrics_render_fn)(void *user_data, char *body, size_t size);
+
+/**
+ * \brief Cached response.
+ */
+typedef struct http_metrics_response_t {
+    const char *data;       // status line, headers and body, within buf
+    uint16_t len;
+    uint16_t header_len;    // all HEAD sends
+    uint8_t users;          // connections lwIP still sends it to
+    char *buf;              // HTTP_METRICS_HEADER_SIZE + body_size bytes of the caller's storage
+} http_metrics_response_t;
+
+typedef struct http_metrics_conn_t {
+    struct tcp_pcb *pcb;
+    struct http_metrics_t *metrics;
+    bool closing;               // closed, waiting for lwIP to ack the response it still refers to
+    bool close_after;           // close once the response is acked
+    http_metrics_response_t *response;  // cached response being sent, NULL for a fixed one
+    const char *tx_data;        // response bytes not yet accepted by tcp_write
+    uint16_t tx_len;
+    uint16_t unacked;           // response bytes handed to tcp_write and not yet acked
+    uint16_t idle_polls;
+    uint16_t recv_len;
+    char request[HTTP_METRICS_REQUEST_SIZE];
+} http_metrics_conn_t;
+
+/**
+ * \brief Server state, caches and statistics.
+ */
+typedef struct http_metrics_t {
+    struct tcp_pcb *server_pcb;
+    http_metrics_render_fn render;
+    void *user_data;
+    uint16_t body_size;
+    volatile bool stale;        // invalidated since the last render
+    http_metrics_response_t responses[2];
+    http_metrics_response_t *current;   // latest rendered, NULL before the first scrape
+    http_metrics_conn_t conns[HTTP_METRICS_MAX_CONNECTIONS];
+    // statistics
+    uint32_t scrapes;           // /metrics requests answered
+    uint32_t renders;           // bodies rendered
+    uint32_t truncated;         // renders that didn't fit and were cut back to a complete line
+} http_metrics_t;
+
+/**
+ * \brief Start listening on HTTP_METRICS_PORT.
+ *
+ * Call from lwIP context.
+ *
+ * \param metrics Server, must stay valid until http_metrics_close().
+ * \param render Writes the body.
+ * \param user_data Passed to render.
+ * \param storage HTTP_METRICS_STORAGE_SIZE(body_size) bytes for the two
+ *                cached responses, valid as long as metrics.
+ * \param body_size Longest body render writes, below 64 kB with the headers.
+ * \return false if the port can't be opened.
+ */
+bool http_metrics_open(http_metrics_t *metrics, http_metrics_render_fn render, void *user_data,
+                       char *storage, uint16_t body_size);
+
+/**
+ * \brief Render the body again on the next scrape.
+ *
+ * Call when the data behind it changes, e.g. for every new sample. Safe
+ * outside lwIP context.
+ */
+static inline void http_metrics_invalidate(http_metrics_t *metrics) {
+    metrics->stale = true;
+}
+
+/**
+ * \brief Close all connections and stop listening.
+ *
+ * Call from lwIP context.
+ */
+void http_metrics_close(http_metrics_t *metrics);
+
+#endif // _HTTP_METRICS_H_
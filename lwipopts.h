@@ -7,4 +7,11 @@
 // This example uses a common include to avoid repetition
 #include "lwipopts_examples_common.h"
 
+// 4 command clients and 2 metrics scrapers, with room for closing connections
+#define MEMP_NUM_TCP_PCB            10
+
+// a broadcast send needs SOF_BROADCAST on its PCB, as telemetry sets; other
+// UDP PCBs can't broadcast by mistake
+#define IP_SOF_BROADCAST            1
+
 #endif
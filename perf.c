@@ -0,0 +1,79 @@
+#include "perf.h"
+
+#if PERF_ENABLED
+
+#include <stdarg.h>
+#include <stdio.h>
+
+typedef struct perf_hist_t {
+    volatile uint32_t bucket[PERF_BUCKETS];
+    volatile uint32_t max_us;
+} perf_hist_t;
+
+static const char *const POINT_NAMES[PERF_POINT_COUNT] = {
+    "sample", "dht_poll", "control", "tcp_recv", "tcp_send",
+};
+
+// counts only ever grow, written by the point's core; a reset moves the
+// baseline instead, so the reader never races a writer on a count
+static perf_hist_t hists[PERF_POINT_COUNT];
+static uint32_t baseline[PERF_POINT_COUNT][PERF_BUCKETS];
+
+
+// snprintf that stops at a full buffer instead of overrunning len
+static size_t append(char *buf, size_t size, size_t len, const char *format, ...) {
+    if (len >= size) {
+        return len;
+    }
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf + len, size - len, format, args);
+    va_end(args);
+    return n < 0 ? len : len + n;
+}
+
+
+void perf_record(perf_point_t point, uint32_t us) {
+    perf_hist_t *hist = &hists[point];
+    uint b = us == 0 ? 0 : 32 - __builtin_clz(us);
+    hist->bucket[b < PERF_BUCKETS ? b : PERF_BUCKETS - 1]++;
+    if (us > hist->max_us) {
+        hist->max_us = us;
+    }
+}
+
+
+size_t perf_report(char *buf, size_t size) {
+    size_t len = append(buf, size, 0, "Perf, us since the last report:\n");
+    for (uint point = 0; point < PERF_POINT_COUNT; point++) {
+        perf_hist_t *hist = &hists[point];
+        uint32_t counts[PERF_BUCKETS];
+        uint32_t calls = 0;
+        for (uint b = 0; b < PERF_BUCKETS; b++) {
+            counts[b] = hist->bucket[b] - baseline[point][b];
+            calls += counts[b];
+        }
+        len = append(buf, size, len, "%s: %lu calls, max %lu", POINT_NAMES[point], (unsigned long)calls,
+                     (unsigned long)hist->max_us);
+        for (uint b = 0; b < PERF_BUCKETS; b++) {
+            if (counts[b] == 0) {
+                continue;
+            }
+            if (b == PERF_BUCKETS - 1) {
+                len = append(buf, size, len, ", >=%lu: %lu", 1ul << (b - 1), (unsigned long)counts[b]);
+            } else {
+                len = append(buf, size, len, ", <%lu: %lu", 1ul << b, (unsigned long)counts[b]);
+            }
+        }
+        len = append(buf, size, len, "\n");
+        for (uint b = 0; b < PERF_BUCKETS; b++) {
+            baseline[point][b] += counts[b];
+        }
+        // may drop a run recorded at the same moment, it is only the max
+        hist->max_us = 0;
+    }
+    len = append(buf, size, len, "\n");
+    return len < size ? len : size - 1;
+}
+
+#endif // PERF_ENABLED
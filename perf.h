@@ -0,0 +1,61 @@
+#ifndef _PERF_H_
+#define _PERF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** \file perf.h
+ *
+ * \brief Hot-path latency histograms.
+ *
+ * PERF_BEGIN() / PERF_END() around a code path record its run time, measured
+ * with time_us_32(), into a histogram of power-of-two microsecond buckets.
+ * Each point must only be recorded from one core. Recording is a handful of
+ * instructions and no locks; the report is taken on demand by the `perf`
+ * command instead of being printed as it happens.
+ *
+ * Built with PERF_ENABLED=0 the macros expand to nothing and perf.c is empty.
+ */
+
+#ifndef PERF_ENABLED
+#define PERF_ENABLED 0
+#endif
+
+typedef enum perf_point_t {
+    PERF_SAMPLE,        // get_system_state()
+    PERF_DHT_POLL,      // dht_acquire_poll(): collecting a DHT read, starting the next
+    PERF_CONTROL,       // fan_control_update()
+    PERF_TCP_RECV,      // tcp_server_recv(), including running the commands
+    PERF_TCP_SEND,      // tcp_server_send_data()
+    PERF_POINT_COUNT,
+} perf_point_t;
+
+#if PERF_ENABLED
+
+#include "pico/time.h"
+
+#define PERF_BUCKETS 17     // < 1 us, < 2 us, ... < 32768 us, and longer
+
+/**
+ * \brief Record one run of a point.
+ */
+void perf_record(perf_point_t point, uint32_t us);
+
+/**
+ * \brief Write the histograms recorded since the last report, and start over.
+ *
+ * \return Number of characters written, without the terminator.
+ */
+size_t perf_report(char *buf, size_t size);
+
+#define PERF_BEGIN(name) uint32_t perf_start_##name = time_us_32()
+#define PERF_END(point, name) perf_record(point, time_us_32() - perf_start_##name)
+
+#else
+
+#define PERF_BEGIN(name) ((void)0)
+#define PERF_END(point, name) ((void)0)
+
+#endif // PERF_ENABLED
+
+#endif // _PERF_H_
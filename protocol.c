@@ -0,0 +1,92 @@
+#include "protocol.h"
+
+#include <string.h>
+
+
+static protocol_status_t parse_text(const uint8_t *buf, size_t len, char *cmd, size_t cmd_size, size_t *consumed) {
+    size_t end = 0;
+    while (end < len && buf[end] != '\n' && buf[end] != '\0') {
+        end++;
+    }
+    if (end == len) {
+        // no terminator yet; error out early if it can never fit
+        if (len >= cmd_size) {
+            *consumed = PROTOCOL_TO_LINE_END;
+            return PROTOCOL_ERROR;
+        }
+        return PROTOCOL_NEED_MORE;
+    }
+    *consumed += end + 1;
+
+    size_t cmd_len = end;
+    if (cmd_len > 0 && buf[cmd_len - 1] == '\r') {
+        cmd_len--;
+    }
+    if (cmd_len >= cmd_size) {
+        return PROTOCOL_ERROR;
+    }
+    memcpy(cmd, buf, cmd_len);
+    cmd[cmd_len] = '\0';
+    return PROTOCOL_OK;
+}
+
+
+static protocol_status_t parse_binary(const uint8_t *buf, size_t len, protocol_request_t *request,
+                                      char *cmd, size_t cmd_size, size_t *consumed) {
+    if (len < PROTOCOL_HEADER_SIZE) {
+        return PROTOCOL_NEED_MORE;
+    }
+    uint16_t id = buf[2] | (buf[3] << 8);
+    size_t payload_len = buf[4] | (buf[5] << 8);
+    request->id = id;   // the error reply echoes it too
+    if (payload_len >= cmd_size) {
+        // the length is known, so skip the payload and resync after it
+        *consumed += PROTOCOL_HEADER_SIZE + payload_len;
+        return PROTOCOL_ERROR;
+    }
+    if (len < PROTOCOL_HEADER_SIZE + payload_len) {
+        return PROTOCOL_NEED_MORE;
+    }
+    *consumed += PROTOCOL_HEADER_SIZE + payload_len;
+
+    memcpy(cmd, buf + PROTOCOL_HEADER_SIZE, payload_len);
+    cmd[payload_len] = '\0';
+    return PROTOCOL_OK;
+}
+
+
+protocol_status_t protocol_parse(const uint8_t *buf, size_t len, protocol_request_t *request,
+                                 char *cmd, size_t cmd_size, size_t *consumed) {
+    // skip line endings and zero padding left between requests
+    size_t pos = 0;
+    while (pos < len && (buf[pos] == '\0' || buf[pos] == '\r' || buf[pos] == '\n')) {
+        pos++;
+    }
+    *consumed = pos;
+    if (pos == len) {
+        return PROTOCOL_NEED_MORE;
+    }
+
+    if (buf[pos] == PROTOCOL_MAGIC) {
+        request->mode = PROTOCOL_BINARY;
+        return parse_binary(buf + pos, len - pos, request, cmd, cmd_size, consumed);
+    }
+    request->mode = PROTOCOL_TEXT;
+    request->id = 0;
+    return parse_text(buf + pos, len - pos, cmd, cmd_size, consumed);
+}
+
+
+uint8_t *protocol_frame(const protocol_request_t *request, uint8_t flags, uint8_t *frame, size_t *len) {
+    if (request->mode == PROTOCOL_TEXT) {
+        return frame + PROTOCOL_HEADER_SIZE;
+    }
+    frame[0] = PROTOCOL_MAGIC;
+    frame[1] = flags;
+    frame[2] = request->id & 0xFF;
+    frame[3] = request->id >> 8;
+    frame[4] = *len & 0xFF;
+    frame[5] = *len >> 8;
+    *len += PROTOCOL_HEADER_SIZE;
+    return frame;
+}
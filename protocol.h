@@ -0,0 +1,74 @@
+#ifndef _PROTOCOL_H_
+#define _PROTOCOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** \file protocol.h
+ *
+ * \brief Request framing for the TCP command server.
+ *
+ * Two framings share the port and can be mixed on one connection; requests
+ * are answered in order, so several may be pipelined in one segment.
+ *
+ * Text: a command terminated by '\n' (or '\0', so zero-padded frames from old
+ * clients still work). Stray '\r', '\n' and '\0' between commands are ignored.
+ * The reply is text ending with a blank line.
+ *
+ * Binary: PROTOCOL_MAGIC, flags, request id (u16 LE), payload length (u16 LE),
+ * then the command text. Replies use the same header, echo the request id and
+ * carry the reply text as payload. Long replies are split into several frames,
+ * all but the last one flagged PROTOCOL_FLAG_MORE.
+ *
+ * Subscription pushes are sent between replies: in text mode as a "sample"
+ * line ending with a blank line, in binary mode as a frame flagged
+ * PROTOCOL_FLAG_PUSH carrying the id of the subscribe request.
+ */
+
+#define PROTOCOL_MAGIC          0xB5    // never the first byte of a text command
+#define PROTOCOL_HEADER_SIZE    6
+#define PROTOCOL_FLAG_MORE      0x01    // more reply frames follow for this request
+#define PROTOCOL_FLAG_PUSH      0x02    // unsolicited sample for a subscription, id of the subscribe request
+#define PROTOCOL_TO_LINE_END    SIZE_MAX    // consumed by an oversized text request whose end hasn't arrived
+
+typedef enum protocol_mode_t {
+    PROTOCOL_TEXT,
+    PROTOCOL_BINARY,
+} protocol_mode_t;
+
+typedef enum protocol_status_t {
+    PROTOCOL_OK,            // a request was parsed
+    PROTOCOL_NEED_MORE,     // incomplete, wait for more data
+    PROTOCOL_ERROR,         // malformed, or longer than the command buffer
+} protocol_status_t;
+
+typedef struct protocol_request_t {
+    protocol_mode_t mode;
+    uint16_t id;            // binary only
+} protocol_request_t;
+
+/**
+ * \brief Parse the next request from buf.
+ *
+ * \param cmd Receives the NUL-terminated command text.
+ * \param cmd_size Size of cmd, including the terminator.
+ * \param[out] consumed Bytes of buf used, including skipped filler. Set for
+ *                      every status; the caller drops them from its buffer.
+ *                      On PROTOCOL_ERROR it spans the whole bad request, so
+ *                      the parser resyncs after it. For a binary frame it may
+ *                      exceed len, and the caller drops the rest as it
+ *                      arrives. It is PROTOCOL_TO_LINE_END for a text request
+ *                      whose terminator hasn't arrived yet.
+ */
+protocol_status_t protocol_parse(const uint8_t *buf, size_t len, protocol_request_t *request,
+                                 char *cmd, size_t cmd_size, size_t *consumed);
+
+/**
+ * \brief Frame a reply whose payload was written at frame + PROTOCOL_HEADER_SIZE.
+ *
+ * \param[in,out] len Payload length in, framed length out.
+ * \return Start of the bytes to send.
+ */
+uint8_t *protocol_frame(const protocol_request_t *request, uint8_t flags, uint8_t *frame, size_t *len);
+
+#endif // _PROTOCOL_H_
@@ -0,0 +1,137 @@
+#include "sched.h"
+
+#include <string.h>
+
+#define WHEEL_MASK (SCHED_WHEEL_SLOTS - 1)
+
+
+static uint32_t tick_of(absolute_time_t time) {
+    return (uint32_t)(to_us_since_boot(time) / SCHED_TICK_US);
+}
+
+
+static void wheel_insert(sched_t *sched, sched_task_t *task) {
+    sched_task_t **slot = &sched->wheel[tick_of(task->release) & WHEEL_MASK];
+    task->next = *slot;
+    *slot = task;
+}
+
+
+// Only ends the core's __wfe(); the tasks run from sched_run()
+static int64_t wake_alarm_callback(alarm_id_t id, void *user_data) {
+    return 0;
+}
+
+
+static void run_task(sched_t *sched, sched_task_t *task) {
+    absolute_time_t start = get_absolute_time();
+    task->fn(task->user_data);
+    absolute_time_t end = get_absolute_time();
+
+    uint32_t jitter = (uint32_t)absolute_time_diff_us(task->release, start);
+    uint32_t run = (uint32_t)absolute_time_diff_us(start, end);
+    task->runs++;
+    task->jitter_total_us += jitter;
+    if (jitter > task->jitter_max_us)   task->jitter_max_us = jitter;
+    if (run > task->run_max_us)         task->run_max_us = run;
+    if (absolute_time_diff_us(task->release, end) > task->deadline_us) {
+        task->overruns++;
+    }
+
+    // fixed rate; releases that have already gone by are skipped, not run late
+    task->release = delayed_by_us(task->release, task->period_us);
+    int64_t behind = absolute_time_diff_us(task->release, end);
+    if (behind >= 0) {
+        uint32_t missed = behind / task->period_us + 1;
+        task->overruns += missed;
+        task->release = delayed_by_us(task->release, (uint64_t)missed * task->period_us);
+    }
+    wheel_insert(sched, task);
+}
+
+
+void sched_init(sched_t *sched, alarm_pool_t *pool) {
+    memset(sched, 0, sizeof(sched_t));
+    sched->pool = pool ? pool : alarm_pool_get_default();
+    sched->tick = tick_of(get_absolute_time());
+    sched->alarm_time = at_the_end_of_time;
+}
+
+
+void sched_add(sched_t *sched, sched_task_t *task, const char *name, sched_fn_t fn, void *user_data,
+               uint32_t period_us, uint32_t deadline_us) {
+    memset(task, 0, sizeof(sched_task_t));
+    task->name = name;
+    task->fn = fn;
+    task->user_data = user_data;
+    task->period_us = period_us;
+    task->deadline_us = deadline_us;
+    task->release = make_timeout_time_us(period_us);
+    task->next_task = sched->tasks;
+    sched->tasks = task;
+    wheel_insert(sched, task);
+}
+
+
+absolute_time_t sched_next_release(const sched_t *sched) {
+    // slots are in release order within one revolution from the wheel
+    // position, so the first slot holding a release from that revolution has
+    // the earliest one
+    for (uint32_t tick = sched->tick; tick != sched->tick + SCHED_WHEEL_SLOTS; tick++) {
+        absolute_time_t earliest = at_the_end_of_time;
+        for (sched_task_t *task = sched->wheel[tick & WHEEL_MASK]; task != NULL; task = task->next) {
+            if (tick_of(task->release) - sched->tick < SCHED_WHEEL_SLOTS &&
+                absolute_time_diff_us(task->release, earliest) > 0) {
+                earliest = task->release;
+            }
+        }
+        if (absolute_time_diff_us(earliest, at_the_end_of_time) > 0) {
+            return earliest;
+        }
+    }
+    // nothing within a revolution
+    absolute_time_t earliest = at_the_end_of_time;
+    for (sched_task_t *task = sched->tasks; task != NULL; task = task->next_task) {
+        if (absolute_time_diff_us(task->release, earliest) > 0) {
+            earliest = task->release;
+        }
+    }
+    return earliest;
+}
+
+
+void sched_run(sched_t *sched) {
+    absolute_time_t now = get_absolute_time();
+    uint32_t now_tick = tick_of(now);
+
+    // every slot from the last position up to now, at most one revolution
+    uint32_t slots = now_tick - sched->tick + 1;
+    if (slots > SCHED_WHEEL_SLOTS)  slots = SCHED_WHEEL_SLOTS;
+    for (uint32_t i = 0; i < slots; i++) {
+        sched_task_t **link = &sched->wheel[(sched->tick + i) & WHEEL_MASK];
+        while (*link != NULL) {
+            sched_task_t *task = *link;
+            if (absolute_time_diff_us(task->release, now) >= 0) {
+                // unlink, run_task puts it back in the slot of its next release
+                *link = task->next;
+                run_task(sched, task);
+            } else {
+                link = &task->next;
+            }
+        }
+    }
+    // later releases in the current slot are still pending
+    sched->tick = now_tick;
+
+    absolute_time_t next = sched_next_release(sched);
+    if (to_us_since_boot(next) != to_us_since_boot(sched->alarm_time)) {
+        if (sched->alarm > 0) {
+            alarm_pool_cancel_alarm(sched->pool, sched->alarm);
+        }
+        sched->alarm = 0;
+        if (to_us_since_boot(next) != to_us_since_boot(at_the_end_of_time)) {
+            sched->alarm = alarm_pool_add_alarm_at(sched->pool, next, wake_alarm_callback, sched, true);
+        }
+        sched->alarm_time = next;
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "pico/time.h"
+
+/** \file sched.h
+ *
+ * \brief Cooperative periodic task scheduler.
+ *
+ * Each core runs its own scheduler. Tasks are released at a fixed rate and
+ * run to completion from the core's main loop, in task context, never from
+ * an interrupt. Pending releases sit in a timer wheel of SCHED_WHEEL_SLOTS
+ * one-millisecond slots; a single alarm from the given pool is armed for the
+ * earliest one, so the core can sleep in __wfe() until there is work.
+ *
+ * Every task keeps timing statistics: jitter is how late a run started after
+ * its release, and an overrun is a run that finished after its deadline or a
+ * release that was skipped because the previous run was still too late.
+ */
+
+#define SCHED_WHEEL_SLOTS 64        // a power of two
+#define SCHED_TICK_US 1000          // time covered by one slot
+
+typedef void (*sched_fn_t)(void *user_data);
+
+/**
+ * \brief Periodic task, in caller-provided storage.
+ */
+typedef struct sched_task_t {
+    const char *name;
+    sched_fn_t fn;
+    void *user_data;
+    uint32_t period_us;
+    uint32_t deadline_us;           // from the release
+    absolute_time_t release;        // next release
+    struct sched_task_t *next;      // in the same wheel slot
+    struct sched_task_t *next_task; // in the scheduler's list of all tasks
+    // statistics, written by the scheduler's core only
+    volatile uint32_t runs;
+    volatile uint32_t overruns;
+    volatile uint32_t jitter_max_us;
+    volatile uint32_t jitter_total_us;
+    volatile uint32_t run_max_us;   // longest run
+} sched_task_t;
+
+typedef struct sched_t {
+    sched_task_t *wheel[SCHED_WHEEL_SLOTS];
+    sched_task_t *tasks;            // all tasks, for reporting
+    uint32_t tick;                  // wheel position, in SCHED_TICK_US since boot
+    alarm_pool_t *pool;
+    alarm_id_t alarm;
+    absolute_time_t alarm_time;     // release the alarm is armed for
+} sched_t;
+
+/**
+ * \brief Initialize an empty scheduler.
+ *
+ * \param sched Scheduler.
+ * \param pool Alarm pool that wakes the core, NULL for the default pool.
+ *             Its IRQ must run on the core that calls sched_run().
+ */
+void sched_init(sched_t *sched, alarm_pool_t *pool);
+
+/**
+ * \brief Add a periodic task, first released one period from now.
+ *
+ * \param sched Scheduler.
+ * \param task Task storage, must stay valid.
+ * \param name Name for reporting.
+ * \param fn Task function.
+ * \param user_data Passed to fn.
+ * \param period_us Release interval.
+ * \param deadline_us Time after each release by which the run must finish.
+ */
+void sched_add(sched_t *sched, sched_task_t *task, const char *name, sched_fn_t fn, void *user_data,
+               uint32_t period_us, uint32_t deadline_us);
+
+/**
+ * \brief Run every released task, then arm the alarm for the next release.
+ *
+ * Call from the core's main loop, before sleeping in __wfe(): the alarm's
+ * interrupt ends the sleep when the next task is due.
+ */
+void sched_run(sched_t *sched);
+
+/**
+ * \brief Time of the next release, at_the_end_of_time if there are no tasks.
+ */
+absolute_time_t sched_next_release(const sched_t *sched);
+
+#endif // _SCHED_H_
@@ -0,0 +1,39 @@
+#include "seqlock.h"
+
+#include <string.h>
+#include "hardware/sync.h"
+
+
+void seqlock_init(seqlock_t *lock, void *data, size_t size) {
+    lock->seq = 0;
+    lock->data = data;
+    lock->size = size;
+}
+
+
+void seqlock_write(seqlock_t *lock, const void *value) {
+    // a reader interrupting the write on this core would spin forever
+    uint32_t save = save_and_disable_interrupts();
+    uint32_t seq = lock->seq;
+    __atomic_store_n(&lock->seq, seq + 1, __ATOMIC_RELAXED);
+    // mark the write in progress before any of the data changes
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(lock->data, value, lock->size);
+    __atomic_store_n(&lock->seq, seq + 2, __ATOMIC_RELEASE);
+    restore_interrupts(save);
+}
+
+
+uint32_t seqlock_read(const seqlock_t *lock, void *value) {
+    uint32_t seq;
+    do {
+        seq = __atomic_load_n(&lock->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;   // a write is in progress on the other core
+        }
+        memcpy(value, lock->data, lock->size);
+        // finish copying before checking that no write overlapped it
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || __atomic_load_n(&lock->seq, __ATOMIC_RELAXED) != seq);
+    return seq;
+}
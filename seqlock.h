@@ -0,0 +1,45 @@
+#ifndef _SEQLOCK_H_
+#define _SEQLOCK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** \file seqlock.h
+ *
+ * \brief Versioned snapshot of a shared struct.
+ *
+ * One writer replaces the whole value at a time; readers copy it out without
+ * taking a lock and retry if a write overlapped the copy, so a reader never
+ * sees fields from two different writes. The writer masks interrupts on its
+ * own core for the length of the copy, so readers may run in an IRQ on the
+ * writer's core as well as on the other core.
+ */
+
+typedef struct seqlock_t {
+    volatile uint32_t seq;  // odd while a write is in progress
+    void *data;
+    size_t size;
+} seqlock_t;
+
+/**
+ * \brief Initialize a snapshot over caller-provided storage.
+ *
+ * \param lock Snapshot.
+ * \param data size bytes, holding the initial value.
+ * \param size Size of the value.
+ */
+void seqlock_init(seqlock_t *lock, void *data, size_t size);
+
+/**
+ * \brief Replace the value. Writers must not overlap each other.
+ */
+void seqlock_write(seqlock_t *lock, const void *value);
+
+/**
+ * \brief Copy a consistent value out.
+ *
+ * \return Version of the value, 0 before the first write.
+ */
+uint32_t seqlock_read(const seqlock_t *lock, void *value);
+
+#endif // _SEQLOCK_H_
@@ -0,0 +1,21 @@
+#ifndef _HARDWARE_FLASH_H
+#define _HARDWARE_FLASH_H
+
+// Host build: on-board flash is a host buffer with NOR semantics, mapped at
+// XIP_BASE for reads. It starts erased, or from the file named by SIM_FLASH,
+// which keeps what the firmware programs across runs.
+
+#include "pico/types.h"
+
+#define FLASH_PAGE_SIZE         (1u << 8)
+#define FLASH_SECTOR_SIZE       (1u << 12)
+#define PICO_FLASH_SIZE_BYTES   (4 * 1024 * 1024)
+
+#define XIP_BASE ((uintptr_t)sim_flash_memory())
+
+const uint8_t *sim_flash_memory(void);
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef _HARDWARE_GPIO_H
+#define _HARDWARE_GPIO_H
+
+// Host build: pin functions and pulls are only recorded, the simulated board
+// wiring reads them back
+
+#include "pico/types.h"
+
+#define NUM_BANK0_GPIOS 30
+
+typedef enum gpio_function_rp2350 {
+    GPIO_FUNC_HSTX = 0,
+    GPIO_FUNC_SPI = 1,
+    GPIO_FUNC_UART = 2,
+    GPIO_FUNC_I2C = 3,
+    GPIO_FUNC_PWM = 4,
+    GPIO_FUNC_SIO = 5,
+    GPIO_FUNC_PIO0 = 6,
+    GPIO_FUNC_PIO1 = 7,
+    GPIO_FUNC_PIO2 = 8,
+    GPIO_FUNC_NULL = 0x1f,
+} gpio_function_t;
+
+#define GPIO_OUT 1
+#define GPIO_IN 0
+
+void gpio_init(uint gpio);
+void gpio_set_function(uint gpio, gpio_function_t fn);
+gpio_function_t gpio_get_function(uint gpio);
+void gpio_set_pulls(uint gpio, bool up, bool down);
+
+static inline void gpio_pull_up(uint gpio) {
+    gpio_set_pulls(gpio, true, false);
+}
+
+static inline void gpio_pull_down(uint gpio) {
+    gpio_set_pulls(gpio, false, true);
+}
+
+static inline void gpio_disable_pulls(uint gpio) {
+    gpio_set_pulls(gpio, false, false);
+}
+
+#endif
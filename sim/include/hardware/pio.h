@@ -0,0 +1,39 @@
+#ifndef _HARDWARE_PIO_H
+#define _HARDWARE_PIO_H
+
+// Host build: PIO blocks only hand out state machines; the dht and tach
+// libraries are replaced by sim_dht.c and sim_tach.c
+
+#include "pico/types.h"
+
+#define NUM_PIOS 3
+#define NUM_PIO_STATE_MACHINES 4
+
+typedef struct pio_hw {
+    uint index;
+    uint8_t sm_claimed;
+} pio_hw_t;
+
+typedef pio_hw_t *PIO;
+
+extern pio_hw_t sim_pio_hw[NUM_PIOS];
+
+#define pio0 (&sim_pio_hw[0])
+#define pio1 (&sim_pio_hw[1])
+#define pio2 (&sim_pio_hw[2])
+
+static inline uint pio_get_index(PIO pio) {
+    return pio->index;
+}
+
+static inline PIO pio_get_instance(uint instance) {
+    return &sim_pio_hw[instance];
+}
+
+void pio_sm_claim(PIO pio, uint sm);
+void pio_sm_unclaim(PIO pio, uint sm);
+int pio_claim_unused_sm(PIO pio, bool required);
+bool pio_sm_is_claimed(PIO pio, uint sm);
+void pio_gpio_init(PIO pio, uint pin);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef _HARDWARE_SYNC_H
+#define _HARDWARE_SYNC_H
+
+// Host build: each core is a thread, and its "interrupts" (alarms, lwIP
+// callbacks) only run from that core's sleeps and waits, so masking them is a
+// no-op. Spin locks are host mutexes, which serialize the two cores.
+
+#include <pthread.h>
+#include "pico/types.h"
+
+#define NUM_SPIN_LOCKS 32
+
+typedef pthread_mutex_t spin_lock_t;
+
+static inline uint32_t save_and_disable_interrupts(void) {
+    return 0;
+}
+
+static inline void restore_interrupts(uint32_t status) {
+    (void)status;
+}
+
+static inline void __dmb(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+// set the event flag of every core and wake the others from __wfe()
+void __sev(void);
+
+// return at once if this core's event flag was set, otherwise sleep until the
+// next event, alarm or (on core 0) network activity and handle it
+void __wfe(void);
+
+static inline void __wfi(void) {
+    __wfe();
+}
+
+int spin_lock_claim_unused(bool required);
+void spin_lock_unclaim(uint lock_num);
+spin_lock_t *spin_lock_instance(uint lock_num);
+
+static inline uint32_t spin_lock_blocking(spin_lock_t *lock) {
+    uint32_t save = save_and_disable_interrupts();
+    pthread_mutex_lock(lock);
+    return save;
+}
+
+static inline void spin_unlock(spin_lock_t *lock, uint32_t saved_irq) {
+    pthread_mutex_unlock(lock);
+    restore_interrupts(saved_irq);
+}
+
+#endif
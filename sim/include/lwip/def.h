@@ -0,0 +1,12 @@
+#ifndef LWIP_HDR_DEF_H
+#define LWIP_HDR_DEF_H
+
+#include "lwip/arch.h"
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PP_HTONL(x) __builtin_bswap32((u32_t)(x))
+#else
+#define PP_HTONL(x) ((u32_t)(x))
+#endif
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef LWIP_HDR_IP_H
+#define LWIP_HDR_IP_H
+
+// Host build: socket options of a PCB. Only the UDP PCB has them, and only
+// SOF_BROADCAST does anything: it sets SO_BROADCAST on the host socket.
+
+#include "lwip/ip_addr.h"
+
+#define SOF_REUSEADDR 0x04U
+#define SOF_KEEPALIVE 0x08U
+#define SOF_BROADCAST 0x20U
+
+#define ip_set_option(pcb, opt) ((pcb)->so_options = (u8_t)((pcb)->so_options | (opt)))
+#define ip_reset_option(pcb, opt) ((pcb)->so_options = (u8_t)((pcb)->so_options & ~(opt)))
+#define ip_get_option(pcb, opt) ((pcb)->so_options & (opt))
+
+#endif
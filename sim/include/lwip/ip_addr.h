@@ -0,0 +1,34 @@
+#ifndef LWIP_HDR_IP_ADDR_H
+#define LWIP_HDR_IP_ADDR_H
+
+#include <stdbool.h>
+#include "lwip/def.h"
+
+enum lwip_ip_addr_type {
+    IPADDR_TYPE_V4 = 0U,
+    IPADDR_TYPE_V6 = 6U,
+    IPADDR_TYPE_ANY = 46U,
+};
+
+typedef struct ip4_addr {
+    u32_t addr;     // network byte order
+} ip4_addr_t;
+
+typedef ip4_addr_t ip_addr_t;
+
+char *ip4addr_ntoa(const ip4_addr_t *addr);
+int ip4addr_aton(const char *cp, ip4_addr_t *addr);
+
+static inline bool ip_addr_ismulticast(const ip_addr_t *addr) {
+    return (addr->addr & PP_HTONL(0xf0000000UL)) == PP_HTONL(0xe0000000UL);
+}
+
+static inline int ipaddr_aton(const char *cp, ip_addr_t *addr) {
+    return ip4addr_aton(cp, addr);
+}
+
+static inline char *ipaddr_ntoa(const ip_addr_t *addr) {
+    return ip4addr_ntoa(addr);
+}
+
+#endif
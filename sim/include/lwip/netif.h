@@ -0,0 +1,16 @@
+#ifndef LWIP_HDR_NETIF_H
+#define LWIP_HDR_NETIF_H
+
+#include "lwip/ip_addr.h"
+
+struct netif {
+    struct netif *next;
+    ip4_addr_t ip_addr;
+};
+
+// the simulated station interface, on the host's loopback address
+extern struct netif *netif_list;
+
+#define netif_ip4_addr(netif) ((const ip4_addr_t *)&((netif)->ip_addr))
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef LWIP_HDR_OPT_H
+#define LWIP_HDR_OPT_H
+
+// Host build: the firmware's own lwipopts.h sizes the simulated TCP buffers
+
+#include "lwipopts.h"
+
+#ifndef TCP_MSS
+#define TCP_MSS 536
+#endif
+#ifndef TCP_SND_BUF
+#define TCP_SND_BUF (2 * TCP_MSS)
+#endif
+#ifndef TCP_WND
+#define TCP_WND (4 * TCP_MSS)
+#endif
+#ifndef TCP_SND_QUEUELEN
+#define TCP_SND_QUEUELEN ((4 * (TCP_SND_BUF) + (TCP_MSS - 1)) / (TCP_MSS))
+#endif
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef LWIP_HDR_PBUF_H
+#define LWIP_HDR_PBUF_H
+
+// Host build: heap-allocated PBUF_RAM buffers, enough for the receive path
+
+#include "lwip/err.h"
+
+typedef enum {
+    PBUF_TRANSPORT,
+    PBUF_IP,
+    PBUF_LINK,
+    PBUF_RAW,
+} pbuf_layer;
+
+typedef enum {
+    PBUF_RAM,
+    PBUF_ROM,
+    PBUF_REF,
+    PBUF_POOL,
+} pbuf_type;
+
+struct pbuf {
+    struct pbuf *next;
+    void *payload;
+    u16_t tot_len;
+    u16_t len;
+    u8_t type_internal;
+    u8_t flags;
+    u16_t ref;
+};
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type);
+u8_t pbuf_free(struct pbuf *p);
+void pbuf_ref(struct pbuf *p);
+void pbuf_cat(struct pbuf *head, struct pbuf *tail);
+struct pbuf *pbuf_free_header(struct pbuf *q, u16_t size);
+u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset);
+u8_t pbuf_get_at(const struct pbuf *p, u16_t offset);
+
+#endif
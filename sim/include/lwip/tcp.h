@@ -0,0 +1,84 @@
+#ifndef LWIP_HDR_TCP_H
+#define LWIP_HDR_TCP_H
+
+// Host build: the lwIP raw TCP API on top of non-blocking POSIX sockets.
+//
+// Data handed to the kernel counts as acknowledged, so tcp_sent callbacks and
+// send buffer space follow the host socket rather than the peer. Callbacks
+// run from the simulation loop, and queued data is flushed after each
+// callback returns, like tcp_input() and tcp_slowtmr() do on the device.
+
+#include "lwip/opt.h"
+#include "lwip/err.h"
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+
+#define TCP_WRITE_FLAG_COPY 0x01
+#define TCP_WRITE_FLAG_MORE 0x02
+
+#define TCP_PRIO_NORMAL 64
+
+struct tcp_pcb;
+
+typedef err_t (*tcp_accept_fn)(void *arg, struct tcp_pcb *newpcb, err_t err);
+typedef err_t (*tcp_recv_fn)(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
+typedef err_t (*tcp_sent_fn)(void *arg, struct tcp_pcb *tpcb, u16_t len);
+typedef err_t (*tcp_poll_fn)(void *arg, struct tcp_pcb *tpcb);
+typedef void (*tcp_err_fn)(void *arg, err_t err);
+
+struct tcp_pcb {
+    struct tcp_pcb *next;
+    int fd;
+    u8_t state;
+    u8_t flags;
+    void *callback_arg;
+    tcp_accept_fn accept;
+    tcp_recv_fn recv;
+    tcp_sent_fn sent;
+    tcp_poll_fn poll;
+    tcp_err_fn errf;
+    u8_t pollinterval;
+    u8_t polltmr;
+    u16_t snd_buf;                      // free send buffer space
+    u16_t snd_queuelen;                 // segments not yet acknowledged
+    u16_t snd_unsent;                   // bytes not yet given to the kernel
+    u16_t snd_acked;                    // bytes given to the kernel, not yet reported via sent
+    u16_t seg_len[TCP_SND_QUEUELEN];    // segment sizes, oldest first
+    u16_t unsent_count;
+    struct {
+        const u8_t *data;               // the caller's memory, or copy
+        u16_t len;
+        u8_t *copy;                     // TCP_WRITE_FLAG_COPY writes only
+    } unsent[TCP_SND_QUEUELEN];         // writes not yet given to the kernel, oldest first
+    u32_t rcv_wnd;
+    struct pbuf *refused_data;
+};
+
+struct tcp_pcb *tcp_new(void);
+struct tcp_pcb *tcp_new_ip_type(u8_t type);
+err_t tcp_bind(struct tcp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port);
+struct tcp_pcb *tcp_listen_with_backlog(struct tcp_pcb *pcb, u8_t backlog);
+
+static inline struct tcp_pcb *tcp_listen(struct tcp_pcb *pcb) {
+    return tcp_listen_with_backlog(pcb, 0xff);
+}
+
+void tcp_arg(struct tcp_pcb *pcb, void *arg);
+void tcp_accept(struct tcp_pcb *pcb, tcp_accept_fn accept);
+void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv);
+void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent);
+void tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn poll, u8_t interval);
+void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err);
+void tcp_setprio(struct tcp_pcb *pcb, u8_t prio);
+
+err_t tcp_write(struct tcp_pcb *pcb, const void *dataptr, u16_t len, u8_t apiflags);
+err_t tcp_output(struct tcp_pcb *pcb);
+void tcp_recved(struct tcp_pcb *pcb, u16_t len);
+err_t tcp_close(struct tcp_pcb *pcb);
+void tcp_abort(struct tcp_pcb *pcb);
+void tcp_nagle_disable(struct tcp_pcb *pcb);
+
+#define tcp_sndbuf(pcb) ((pcb)->snd_buf)
+#define tcp_sndqueuelen(pcb) ((pcb)->snd_queuelen)
+
+#endif
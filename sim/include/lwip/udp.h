@@ -0,0 +1,21 @@
+#ifndef LWIP_HDR_UDP_H
+#define LWIP_HDR_UDP_H
+
+// Host build: the lwIP raw UDP API, send side only, on a host datagram socket
+
+#include "lwip/opt.h"
+#include "lwip/err.h"
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+
+struct udp_pcb {
+    u8_t so_options;    // SOF_* set with ip_set_option()
+    int fd;
+    bool broadcast;     // SO_BROADCAST set on fd
+};
+
+struct udp_pcb *udp_new_ip_type(u8_t type);
+err_t udp_sendto(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *dst_ip, u16_t dst_port);
+void udp_remove(struct udp_pcb *pcb);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef _PICO_CYW43_ARCH_H
+#define _PICO_CYW43_ARCH_H
+
+// Host build: joins succeed after a delay unless an outage is simulated;
+// lwIP is served from the simulation loop on the host's own network stack.
+
+#include "pico/stdlib.h"
+#include "lwip/ip_addr.h"
+#include "lwip/netif.h"
+
+#define CYW43_AUTH_OPEN             0
+#define CYW43_AUTH_WPA_TKIP_PSK     0x00200002
+#define CYW43_AUTH_WPA2_AES_PSK     0x00400004
+#define CYW43_AUTH_WPA2_MIXED_PSK   0x00400006
+
+#define CYW43_ITF_STA   0
+
+#define CYW43_LINK_DOWN     0
+#define CYW43_LINK_JOIN     1
+#define CYW43_LINK_NOIP     2
+#define CYW43_LINK_UP       3
+#define CYW43_LINK_FAIL     (-1)
+#define CYW43_LINK_NONET    (-2)
+#define CYW43_LINK_BADAUTH  (-3)
+
+typedef struct cyw43_t {
+    int link_status;
+} cyw43_t;
+
+extern cyw43_t cyw43_state;
+
+int cyw43_tcpip_link_status(cyw43_t *self, int itf);
+int cyw43_wifi_leave(cyw43_t *self, int itf);
+
+int cyw43_arch_init(void);
+void cyw43_arch_deinit(void);
+void cyw43_arch_enable_sta_mode(void);
+int cyw43_arch_wifi_connect_async(const char *ssid, const char *pw, uint32_t auth);
+
+void cyw43_arch_poll(void);
+void cyw43_arch_wait_for_work_until(absolute_time_t until);
+
+// single-threaded: lwIP callbacks only run from inside sleeps and polls
+static inline void cyw43_arch_lwip_begin(void) {}
+static inline void cyw43_arch_lwip_end(void) {}
+static inline void cyw43_arch_lwip_check(void) {}
+
+#endif
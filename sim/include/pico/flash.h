@@ -0,0 +1,17 @@
+#ifndef _PICO_FLASH_H
+#define _PICO_FLASH_H
+
+// Host build: no XIP to stall, so nothing needs pausing; the operation just runs.
+
+#include "pico/types.h"
+
+static inline bool flash_safe_execute_core_init(void) {
+    return true;
+}
+
+static inline int flash_safe_execute(void (*func)(void *), void *param, uint32_t enter_exit_timeout_ms) {
+    func(param);
+    return PICO_OK;
+}
+
+#endif
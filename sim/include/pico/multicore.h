@@ -0,0 +1,25 @@
+#ifndef _PICO_MULTICORE_H
+#define _PICO_MULTICORE_H
+
+// Host build: core 1 runs on its own host thread, the inter-core FIFOs are
+// four words deep like the RP2350's, and pushes and pops signal the other
+// core with __sev() the way the SDK does.
+
+#include "pico/types.h"
+#include "pico/platform.h"
+#include "pico/time.h"
+
+void multicore_launch_core1(void (*entry)(void));
+
+// core 1 stops at its next sleep or wait, then this returns
+void multicore_reset_core1(void);
+
+bool multicore_fifo_rvalid(void);
+bool multicore_fifo_wready(void);
+void multicore_fifo_push_blocking(uint32_t data);
+bool multicore_fifo_push_timeout_us(uint32_t data, uint64_t timeout_us);
+uint32_t multicore_fifo_pop_blocking(void);
+bool multicore_fifo_pop_timeout_us(uint64_t timeout_us, uint32_t *out);
+void multicore_fifo_drain(void);
+
+#endif
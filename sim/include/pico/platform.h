@@ -0,0 +1,12 @@
+#ifndef _PICO_PLATFORM_H
+#define _PICO_PLATFORM_H
+
+// Host build: each simulated core is a host thread
+
+#include "pico/types.h"
+
+#define NUM_CORES 2
+
+uint get_core_num(void);
+
+#endif
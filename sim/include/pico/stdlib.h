@@ -0,0 +1,17 @@
+#ifndef _PICO_STDLIB_H
+#define _PICO_STDLIB_H
+
+// Host build: the subset of pico/stdlib.h the firmware uses
+
+#include <stdio.h>
+#include "pico/types.h"
+#include "pico/platform.h"
+#include "pico/time.h"
+#include "hardware/gpio.h"
+
+bool stdio_init_all(void);
+
+// busy loops let the simulation run alarms and network work
+void tight_loop_contents(void);
+
+#endif
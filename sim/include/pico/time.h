@@ -0,0 +1,148 @@
+#ifndef _PICO_TIME_H
+#define _PICO_TIME_H
+
+// Host build: timestamps, sleeps, alarms and repeating timers on the
+// simulation's virtual clock. Every alarm pool belongs to one core, the
+// default pool to core 0, and its callbacks run from that core's simulation
+// loop, which stands in for the timer IRQ.
+
+#include "pico/types.h"
+
+#define PICO_TIME_DEFAULT_ALARM_POOL_MAX_TIMERS 16
+
+#define at_the_end_of_time ((absolute_time_t)INT64_MAX)
+#define nil_time ((absolute_time_t)0)
+
+uint64_t time_us_64(void);
+
+static inline uint32_t time_us_32(void) {
+    return (uint32_t)time_us_64();
+}
+
+static inline absolute_time_t get_absolute_time(void) {
+    return time_us_64();
+}
+
+static inline uint64_t to_us_since_boot(absolute_time_t t) {
+    return t;
+}
+
+static inline uint32_t to_ms_since_boot(absolute_time_t t) {
+    return (uint32_t)(t / 1000);
+}
+
+static inline absolute_time_t delayed_by_us(absolute_time_t t, uint64_t us) {
+    return t + us;
+}
+
+static inline absolute_time_t delayed_by_ms(absolute_time_t t, uint32_t ms) {
+    return t + ms * 1000ull;
+}
+
+static inline absolute_time_t make_timeout_time_us(uint64_t us) {
+    return delayed_by_us(get_absolute_time(), us);
+}
+
+static inline absolute_time_t make_timeout_time_ms(uint32_t ms) {
+    return delayed_by_ms(get_absolute_time(), ms);
+}
+
+static inline int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to) {
+    return (int64_t)(to - from);
+}
+
+static inline bool time_reached(absolute_time_t t) {
+    return time_us_64() >= t;
+}
+
+// sleeping runs due alarms and serves the simulated network until the deadline
+void sleep_until(absolute_time_t target);
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+void busy_wait_us(uint64_t delay_us);
+void busy_wait_ms(uint32_t delay_ms);
+
+static inline void busy_wait_us_32(uint32_t delay_us) {
+    busy_wait_us(delay_us);
+}
+
+typedef int32_t alarm_id_t;
+
+typedef struct alarm_pool alarm_pool_t;
+
+/*
+ * Return 0 to stop, >0 to fire again that many us after the callback
+ * returns, <0 to fire again -n us after the previous target time.
+ */
+typedef int64_t (*alarm_callback_t)(alarm_id_t id, void *user_data);
+
+alarm_pool_t *alarm_pool_get_default(void);
+
+// the pool's callbacks run on the core that creates it
+alarm_pool_t *alarm_pool_create_with_unused_hardware_alarm(uint max_timers);
+
+alarm_id_t alarm_pool_add_alarm_at(alarm_pool_t *pool, absolute_time_t time, alarm_callback_t callback, void *user_data,
+                                   bool fire_if_past);
+
+static inline alarm_id_t alarm_pool_add_alarm_in_us(alarm_pool_t *pool, uint64_t us, alarm_callback_t callback,
+                                                    void *user_data, bool fire_if_past) {
+    return alarm_pool_add_alarm_at(pool, make_timeout_time_us(us), callback, user_data, fire_if_past);
+}
+
+static inline alarm_id_t alarm_pool_add_alarm_in_ms(alarm_pool_t *pool, uint32_t ms, alarm_callback_t callback,
+                                                    void *user_data, bool fire_if_past) {
+    return alarm_pool_add_alarm_at(pool, make_timeout_time_ms(ms), callback, user_data, fire_if_past);
+}
+
+bool alarm_pool_cancel_alarm(alarm_pool_t *pool, alarm_id_t alarm_id);
+
+static inline alarm_id_t add_alarm_at(absolute_time_t time, alarm_callback_t callback, void *user_data, bool fire_if_past) {
+    return alarm_pool_add_alarm_at(alarm_pool_get_default(), time, callback, user_data, fire_if_past);
+}
+
+static inline alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback, void *user_data, bool fire_if_past) {
+    return add_alarm_at(make_timeout_time_us(us), callback, user_data, fire_if_past);
+}
+
+static inline alarm_id_t add_alarm_in_ms(uint32_t ms, alarm_callback_t callback, void *user_data, bool fire_if_past) {
+    return add_alarm_at(make_timeout_time_ms(ms), callback, user_data, fire_if_past);
+}
+
+static inline bool cancel_alarm(alarm_id_t alarm_id) {
+    return alarm_pool_cancel_alarm(alarm_pool_get_default(), alarm_id);
+}
+
+typedef struct repeating_timer repeating_timer_t;
+
+typedef bool (*repeating_timer_callback_t)(repeating_timer_t *rt);
+
+struct repeating_timer {
+    int64_t delay_us;
+    alarm_pool_t *pool;
+    alarm_id_t alarm_id;
+    repeating_timer_callback_t callback;
+    void *user_data;
+};
+
+bool alarm_pool_add_repeating_timer_us(alarm_pool_t *pool, int64_t delay_us, repeating_timer_callback_t callback,
+                                       void *user_data, repeating_timer_t *out);
+
+static inline bool alarm_pool_add_repeating_timer_ms(alarm_pool_t *pool, int32_t delay_ms, repeating_timer_callback_t callback,
+                                                     void *user_data, repeating_timer_t *out) {
+    return alarm_pool_add_repeating_timer_us(pool, delay_ms * (int64_t)1000, callback, user_data, out);
+}
+
+static inline bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void *user_data, repeating_timer_t *out) {
+    return alarm_pool_add_repeating_timer_us(alarm_pool_get_default(), delay_us, callback, user_data, out);
+}
+
+static inline bool add_repeating_timer_ms(int32_t delay_ms, repeating_timer_callback_t callback, void *user_data, repeating_timer_t *out) {
+    return add_repeating_timer_us(delay_ms * (int64_t)1000, callback, user_data, out);
+}
+
+bool cancel_repeating_timer(repeating_timer_t *timer);
+
+// wait for an event or until timeout_timestamp; true once the timeout is reached
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp);
+
+#endif
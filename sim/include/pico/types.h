@@ -0,0 +1,21 @@
+#ifndef _PICO_TYPES_H
+#define _PICO_TYPES_H
+
+// Host build: the subset of pico/types.h the firmware uses
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned int uint;
+
+// microseconds of virtual time since the simulated boot
+typedef uint64_t absolute_time_t;
+
+enum pico_error_codes {
+    PICO_OK = 0,
+    PICO_ERROR_TIMEOUT = -1,
+    PICO_ERROR_GENERIC = -2,
+};
+
+#endif
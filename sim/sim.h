@@ -0,0 +1,113 @@
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include "pico/types.h"
+#include "pico/time.h"
+
+/** \file sim.h
+ *
+ * \brief Host simulation internals shared by the SDK, lwIP and driver shims.
+ *
+ * Each core runs on its own host thread. Time is virtual, scaled from the
+ * host's monotonic clock, and a core's alarm callbacks (and on core 0 the
+ * lwIP callbacks) only run while that core sleeps or polls, which is where it
+ * would take interrupts on the board.
+ */
+
+/**
+ * \brief Run alarms and serve the network until the virtual time reaches deadline.
+ */
+void sim_run_until(absolute_time_t deadline);
+
+/**
+ * \brief Run due alarms and ready network work without waiting.
+ */
+void sim_run_pending(void);
+
+/**
+ * \brief Wait for the next alarm, network event or until, and handle it.
+ */
+void sim_wait_for_event(absolute_time_t until);
+
+/**
+ * \brief Host milliseconds until the virtual time reaches wake, for poll().
+ */
+int sim_host_timeout_ms(absolute_time_t wake);
+
+/**
+ * \brief Wait up to wake for socket events and run the lwIP callbacks they trigger.
+ */
+void sim_net_poll(absolute_time_t wake);
+
+/**
+ * \brief Wake a core from its wait: new alarm, FIFO data or event.
+ */
+void sim_core_signal(uint core);
+
+/**
+ * \brief Read end of the calling core's wake pipe, for poll().
+ */
+int sim_core_wake_fd(void);
+
+/**
+ * \brief Empty the calling core's wake pipe after poll() reported it.
+ */
+void sim_core_drain_wake(void);
+
+/**
+ * \brief Wait on the calling core's wake pipe alone, up to wake.
+ *
+ * Core 1 exits its thread here once multicore_reset_core1() asks it to.
+ */
+void sim_core_wait(absolute_time_t wake);
+
+/**
+ * \brief Clear the calling core's event flag, returning whether it was set.
+ */
+bool sim_core_take_event(void);
+
+/**
+ * \brief Alarm pool whose callbacks run on the calling core, for simulated peripheral IRQs.
+ */
+alarm_pool_t *sim_core_irq_pool(void);
+
+/**
+ * \brief Give the simulated netif its address once Wi-Fi "connects".
+ */
+void sim_net_link_up(void);
+
+/**
+ * \brief Read a numeric SIM_* environment setting.
+ */
+double sim_env(const char *name, double fallback);
+
+/**
+ * \brief Uniform random value in [-1, 1] for sensor noise and fault injection.
+ */
+double sim_random(void);
+
+/**
+ * \brief Duty cycle of the PWM output driving gpio, 0 to 1.
+ */
+double sim_pwm_gpio_duty(uint gpio);
+
+/**
+ * \brief Enclosure temperature and relative humidity seen by a sensor on data_pin.
+ *
+ * \return false if no sensor is wired to data_pin.
+ */
+bool sim_world_read_climate(uint data_pin, double *temperature_c, double *humidity);
+
+/**
+ * \brief Falling edges produced so far by the fan tach wired to pin.
+ */
+uint32_t sim_world_tach_edges(uint pin);
+
+/**
+ * \brief Time of one tach edge, counted like sim_world_tach_edges().
+ *
+ * \return false if the edge hasn't happened or is too old to be kept.
+ */
+bool sim_world_tach_edge_time(uint pin, uint32_t edge, absolute_time_t *time);
+
+#endif // _SIM_H_
@@ -0,0 +1,68 @@
+#include "sim.h"
+
+#include <stdio.h>
+#include "pico/cyw43_arch.h"
+
+// The host is always online; joining only brings up the simulated netif. A
+// join takes SIM_WIFI_JOIN_MS, and from SIM_WIFI_DOWN_AT_S for SIM_WIFI_DOWN_S
+// the access point is gone: the link drops and joins find no network.
+// SIM_RADIO_FAIL=1 fails cyw43_arch_init, as a board with a dead radio does.
+
+cyw43_t cyw43_state;
+
+static bool joining;
+static absolute_time_t join_done;
+
+
+static bool ap_down(void) {
+    double down_at_s = sim_env("SIM_WIFI_DOWN_AT_S", 0);
+    double now_s = time_us_64() / 1e6;
+    return down_at_s > 0 && now_s >= down_at_s && now_s < down_at_s + sim_env("SIM_WIFI_DOWN_S", 20);
+}
+
+int cyw43_arch_init(void) {
+    return sim_env("SIM_RADIO_FAIL", 0) != 0 ? -1 : 0;
+}
+
+void cyw43_arch_deinit(void) {
+}
+
+void cyw43_arch_enable_sta_mode(void) {
+}
+
+int cyw43_arch_wifi_connect_async(const char *ssid, const char *pw, uint32_t auth) {
+    joining = true;
+    join_done = time_us_64() + (absolute_time_t)(sim_env("SIM_WIFI_JOIN_MS", 500) * 1000);
+    cyw43_state.link_status = CYW43_LINK_JOIN;
+    return 0;
+}
+
+int cyw43_wifi_leave(cyw43_t *self, int itf) {
+    joining = false;
+    self->link_status = CYW43_LINK_DOWN;
+    return 0;
+}
+
+int cyw43_tcpip_link_status(cyw43_t *self, int itf) {
+    if (joining && time_us_64() >= join_done) {
+        joining = false;
+        if (ap_down()) {
+            self->link_status = CYW43_LINK_NONET;
+        } else {
+            sim_net_link_up();
+            self->link_status = CYW43_LINK_UP;
+        }
+    } else if (self->link_status == CYW43_LINK_UP && ap_down()) {
+        printf("sim: access point gone\n");
+        self->link_status = CYW43_LINK_DOWN;
+    }
+    return self->link_status;
+}
+
+void cyw43_arch_poll(void) {
+    sim_run_pending();
+}
+
+void cyw43_arch_wait_for_work_until(absolute_time_t until) {
+    sim_wait_for_event(until);
+}
@@ -0,0 +1,446 @@
+#include "sim.h"
+
+#include <dht.h>
+#include <hardware/gpio.h>
+#include <hardware/sync.h>
+#include <pico/stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Host build of the dht library. Each frame is encoded from the enclosure
+// model when it would have finished arriving on the wire, then checksummed
+// and decoded like dht.c does. SIM_DHT_ERROR_PCT percent of the frames are
+// lost (timeout) or corrupted (bad checksum). A scanner reads all the frames
+// of a scan when its window ends, where dht.c copies them in one DMA pass.
+
+static const uint DHT_MEASUREMENT_TIMEOUT_US = 6000;
+static const uint DHT_FRAME_US = 4300; // sensor response and 40 bits, after the start pulse
+
+// frame arrival stands in for the DMA completion IRQ, taken on the core that
+// initialized the first sensor. The measurement timeout runs there too (on
+// the board it is in the default pool), so frames and timeouts keep their
+// order however the host schedules the core threads.
+static alarm_id_t frame_alarm[NUM_PIOS][NUM_PIO_STATE_MACHINES];
+static alarm_pool_t *irq_pool;
+
+static spin_lock_t *dht_lock;
+
+//
+// misc
+//
+
+static uint get_start_pulse_duration_us(dht_model_t model) {
+    return (model == DHT21 || model == DHT22) ? 1000 : 18000;
+}
+
+static uint32_t get_measurement_timeout_us(dht_model_t model) {
+    return get_start_pulse_duration_us(model) + DHT_MEASUREMENT_TIMEOUT_US;
+}
+
+// tenths of a degree C
+static int16_t decode_temperature(dht_model_t model, uint8_t b0, uint8_t b1) {
+    int16_t temperature;
+    switch (model) {
+    case DHT11:
+        if (b1 & 0x80) {
+            // below-zero temperature not supported
+            temperature = 0;
+        } else {
+            temperature = b0 * 10 + (b1 & 0x7F);
+        }
+        break;
+    case DHT12:
+        temperature = b0 * 10 + (b1 & 0x7F);
+        if (b1 & 0x80) {
+            temperature = -temperature;
+        }
+        break;
+    case DHT21:
+    case DHT22:
+        temperature = ((b0 & 0x7F) << 8) + b1;
+        if (b0 & 0x80) {
+            temperature = -temperature;
+        }
+        break;
+    default:
+        assert(false); // invalid model
+    }
+    return temperature;
+}
+
+// tenths of %RH
+static uint16_t decode_humidity(dht_model_t model, uint8_t b0, uint8_t b1) {
+    uint16_t humidity;
+    switch (model) {
+    case DHT11:
+    case DHT12:
+        humidity = b0 * 10 + b1;
+        break;
+    case DHT21:
+    case DHT22:
+        humidity = (b0 << 8) + b1;
+        break;
+    default:
+        assert(false); // invalid model
+    }
+    return humidity;
+}
+
+static void encode_frame(dht_model_t model, double temperature_c, double humidity, uint8_t *data) {
+    // 0.1 resolution, with about one count of reading noise
+    int t10 = (int)lround(temperature_c * 10 + sim_random());
+    int h10 = (int)lround(humidity * 10 + sim_random());
+    h10 = h10 < 0 ? 0 : h10 > 1000 ? 1000 : h10;
+    uint t_abs = abs(t10);
+
+    switch (model) {
+    case DHT11:
+    case DHT12:
+        if (model == DHT11 && t10 < 0) {
+            t_abs = 0;
+        }
+        data[0] = h10 / 10;
+        data[1] = h10 % 10;
+        data[2] = t_abs / 10;
+        data[3] = (t_abs % 10) | (model == DHT12 && t10 < 0 ? 0x80 : 0);
+        break;
+    case DHT21:
+    case DHT22:
+        data[0] = h10 >> 8;
+        data[1] = h10 & 0xFF;
+        data[2] = (t_abs >> 8) | (t10 < 0 ? 0x80 : 0);
+        data[3] = t_abs & 0xFF;
+        break;
+    default:
+        assert(false); // invalid model
+    }
+    data[4] = data[0] + data[1] + data[2] + data[3];
+}
+
+// Sample the sensor on data_pin; returns false if the frame never arrives
+static bool receive_frame(dht_model_t model, uint data_pin, uint8_t *data) {
+    double temperature_c;
+    double humidity;
+    if (!sim_world_read_climate(data_pin, &temperature_c, &humidity)) {
+        return false;
+    }
+    encode_frame(model, temperature_c, humidity, data);
+
+    double error_pct = sim_env("SIM_DHT_ERROR_PCT", 0);
+    double roll = (sim_random() + 1) * 50;
+    if (roll < error_pct / 2) {
+        return false;
+    } else if (roll < error_pct) {
+        data[roll < error_pct * 3 / 4 ? 4 : 1] ^= 0x01; // single bit error
+    }
+    return true;
+}
+
+static void complete_measurement(dht_t *dht, bool frame_received) {
+    uint32_t save = spin_lock_blocking(dht_lock);
+    if (!dht->busy) {
+        spin_unlock(dht_lock, save);
+        return;
+    }
+
+    dht_result_t result;
+    if (!frame_received) {
+        result = DHT_RESULT_TIMEOUT;
+    } else {
+        uint8_t checksum = dht->data[0] + dht->data[1] + dht->data[2] + dht->data[3];
+        result = dht->data[4] == checksum ? DHT_RESULT_OK : DHT_RESULT_BAD_CHECKSUM;
+    }
+    dht->result = result;
+    dht->busy = false;
+    alarm_id_t alarm = dht->timeout_alarm;
+    alarm_id_t frame = frame_alarm[pio_get_index(dht->pio)][dht->sm];
+    dht->timeout_alarm = 0;
+    frame_alarm[pio_get_index(dht->pio)][dht->sm] = 0;
+    spin_unlock(dht_lock, save);
+
+    if (alarm > 0) {
+        alarm_pool_cancel_alarm(irq_pool, alarm);
+    }
+    if (frame > 0) {
+        alarm_pool_cancel_alarm(irq_pool, frame);
+    }
+    if (dht->callback != NULL) {
+        dht->callback(dht, result, dht->user_data);
+    }
+}
+
+static int64_t frame_received_callback(alarm_id_t id, void *user_data) {
+    dht_t *dht = (dht_t *)user_data;
+    frame_alarm[pio_get_index(dht->pio)][dht->sm] = 0;
+    // a lost frame is left to the timeout
+    if (receive_frame(dht->model, dht->data_pin, dht->data)) {
+        complete_measurement(dht, true);
+    }
+    return 0; // don't reschedule
+}
+
+static int64_t measurement_timeout_callback(alarm_id_t id, void *user_data) {
+    dht_t *dht = (dht_t *)user_data;
+    dht->timeout_alarm = 0;
+    complete_measurement(dht, false);
+    return 0; // don't reschedule
+}
+
+static void claim_lock(void) {
+    if (dht_lock == NULL) {
+        dht_lock = spin_lock_instance(spin_lock_claim_unused(true /* required */));
+    }
+    if (irq_pool == NULL) {
+        irq_pool = sim_core_irq_pool();
+    }
+}
+
+//
+// public interface
+//
+
+void dht_init(dht_t *dht, dht_model_t model, PIO pio, uint8_t data_pin, bool pull_up) {
+    assert(pio == pio0 || pio == pio1);
+
+    claim_lock();
+    memset(dht, 0, sizeof(dht_t));
+    dht->model = model;
+    dht->pio = pio;
+    dht->sm = pio_claim_unused_sm(pio, true /* required */);
+    dht->data_pin = data_pin;
+    dht->result = DHT_RESULT_TIMEOUT; // no data yet
+
+    pio_gpio_init(pio, data_pin);
+    gpio_set_pulls(data_pin, pull_up, false /* down */);
+}
+
+void dht_deinit(dht_t *dht) {
+    assert(dht->pio != NULL); // not initialized
+
+    dht->callback = NULL;
+    complete_measurement(dht, false);
+    pio_sm_unclaim(dht->pio, dht->sm);
+    dht->pio = NULL;
+}
+
+void dht_start_measurement(dht_t *dht) {
+    assert(dht->pio != NULL); // not initialized
+    assert(!dht->busy); // another measurement in progress
+
+    memset(dht->data, 0, sizeof(dht->data));
+    dht->busy = true;
+    dht->start_time = time_us_32();
+    frame_alarm[pio_get_index(dht->pio)][dht->sm] = alarm_pool_add_alarm_in_us(irq_pool,
+        get_start_pulse_duration_us(dht->model) + DHT_FRAME_US, frame_received_callback, dht, true /* fire_if_past */);
+    alarm_id_t alarm = alarm_pool_add_alarm_in_us(irq_pool, get_measurement_timeout_us(dht->model), measurement_timeout_callback, dht,
+                                                  true /* fire_if_past */);
+    // if no alarm slot is free, the timeout is still enforced by dht_poll_measurement()
+    dht->timeout_alarm = alarm > 0 ? alarm : 0;
+}
+
+void dht_set_callback(dht_t *dht, dht_callback_t callback, void *user_data) {
+    uint32_t save = spin_lock_blocking(dht_lock);
+    dht->callback = callback;
+    dht->user_data = user_data;
+    spin_unlock(dht_lock, save);
+}
+
+dht_result_t dht_poll_measurement_tenths(dht_t *dht, uint16_t *humidity, int16_t *temperature) {
+    assert(dht->pio != NULL); // not initialized
+
+    if (dht->busy) {
+        if (time_us_32() - dht->start_time < get_measurement_timeout_us(dht->model)) {
+            return DHT_RESULT_IN_PROGRESS;
+        }
+        complete_measurement(dht, false);
+    }
+    dht_result_t result = dht->result;
+    if (result != DHT_RESULT_OK) {
+        return result;
+    }
+    if (humidity != NULL) {
+        *humidity = decode_humidity(dht->model, dht->data[0], dht->data[1]);
+    }
+    if (temperature != NULL) {
+        *temperature = decode_temperature(dht->model, dht->data[2], dht->data[3]);
+    }
+    return DHT_RESULT_OK;
+}
+
+dht_result_t dht_poll_measurement(dht_t *dht, float *humidity, float *temperature_c) {
+    uint16_t humidity_tenths;
+    int16_t temperature_tenths;
+    dht_result_t result = dht_poll_measurement_tenths(dht, &humidity_tenths, &temperature_tenths);
+    if (result == DHT_RESULT_OK) {
+        if (humidity != NULL)       *humidity = humidity_tenths / 10.0f;
+        if (temperature_c != NULL)  *temperature_c = temperature_tenths / 10.0f;
+    }
+    return result;
+}
+
+dht_result_t dht_finish_measurement_blocking_tenths(dht_t *dht, uint16_t *humidity, int16_t *temperature) {
+    dht_result_t result;
+    while ((result = dht_poll_measurement_tenths(dht, humidity, temperature)) == DHT_RESULT_IN_PROGRESS) {
+        tight_loop_contents();
+    }
+    return result;
+}
+
+dht_result_t dht_finish_measurement_blocking(dht_t *dht, float *humidity, float *temperature_c) {
+    dht_result_t result;
+    while ((result = dht_poll_measurement(dht, humidity, temperature_c)) == DHT_RESULT_IN_PROGRESS) {
+        tight_loop_contents();
+    }
+    return result;
+}
+
+//
+// multi-sensor scanner
+//
+
+static void complete_scan(dht_scanner_t *scanner) {
+    uint32_t save = spin_lock_blocking(dht_lock);
+    if (!scanner->busy || scanner->draining) {
+        spin_unlock(dht_lock, save);
+        return;
+    }
+    scanner->draining = true;
+    alarm_id_t alarm = scanner->timeout_alarm;
+    scanner->timeout_alarm = 0;
+    spin_unlock(dht_lock, save);
+
+    if (alarm > 0) {
+        alarm_pool_cancel_alarm(irq_pool, alarm);
+    }
+    for (uint i = 0; i < scanner->count; i++) {
+        dht_scanner_sensor_t *sensor = &scanner->sensors[i];
+        if (!(scanner->scan_mask & (1u << i))) {
+            continue;
+        }
+        if (receive_frame(sensor->model, sensor->data_pin, sensor->data)) {
+            uint8_t checksum = sensor->data[0] + sensor->data[1] + sensor->data[2] + sensor->data[3];
+            sensor->result = sensor->data[4] == checksum ? DHT_RESULT_OK : DHT_RESULT_BAD_CHECKSUM;
+        } else {
+            sensor->result = DHT_RESULT_TIMEOUT;
+        }
+    }
+
+    save = spin_lock_blocking(dht_lock);
+    scanner->draining = false;
+    scanner->busy = false;
+    spin_unlock(dht_lock, save);
+}
+
+static int64_t scan_timeout_callback(alarm_id_t id, void *user_data) {
+    dht_scanner_t *scanner = (dht_scanner_t *)user_data;
+    scanner->timeout_alarm = 0;
+    complete_scan(scanner);
+    return 0; // don't reschedule
+}
+
+void dht_scanner_init(dht_scanner_t *scanner) {
+    claim_lock();
+    memset(scanner, 0, sizeof(dht_scanner_t));
+}
+
+int dht_scanner_add(dht_scanner_t *scanner, dht_model_t model, uint8_t data_pin, bool pull_up, bool required) {
+    assert(scanner->count < DHT_SCANNER_MAX_SENSORS);
+
+    for (uint p = 0; p < NUM_PIOS; p++) {
+        PIO pio = pio_get_instance(p);
+        int sm = pio_claim_unused_sm(pio, false /* required */);
+        if (sm < 0) {
+            continue;
+        }
+        dht_scanner_sensor_t *sensor = &scanner->sensors[scanner->count];
+        memset(sensor, 0, sizeof(dht_scanner_sensor_t));
+        sensor->pio = pio;
+        sensor->model = model;
+        sensor->sm = sm;
+        sensor->data_pin = data_pin;
+        sensor->result = DHT_RESULT_TIMEOUT; // no data yet
+
+        pio_gpio_init(pio, data_pin);
+        gpio_set_pulls(data_pin, pull_up, false /* down */);
+        return scanner->count++;
+    }
+    if (required) {
+        fprintf(stderr, "sim: no PIO state machine left for the DHT sensor on GPIO%u\n", data_pin);
+        exit(1);
+    }
+    return -1;
+}
+
+void dht_scanner_deinit(dht_scanner_t *scanner) {
+    uint32_t save = spin_lock_blocking(dht_lock);
+    scanner->busy = false;
+    alarm_id_t alarm = scanner->timeout_alarm;
+    scanner->timeout_alarm = 0;
+    spin_unlock(dht_lock, save);
+    if (alarm > 0) {
+        alarm_pool_cancel_alarm(irq_pool, alarm);
+    }
+    for (uint i = 0; i < scanner->count; i++) {
+        pio_sm_unclaim(scanner->sensors[i].pio, scanner->sensors[i].sm);
+    }
+    scanner->count = 0;
+}
+
+void dht_scanner_start(dht_scanner_t *scanner, uint32_t mask) {
+    assert(!scanner->busy); // another scan in progress
+    mask &= (1u << scanner->count) - 1;
+
+    uint32_t timeout_us = 0;
+    for (uint i = 0; i < scanner->count; i++) {
+        dht_scanner_sensor_t *sensor = &scanner->sensors[i];
+        if (mask & (1u << i)) {
+            memset(sensor->data, 0, sizeof(sensor->data));
+            sensor->result = DHT_RESULT_IN_PROGRESS;
+            if (get_measurement_timeout_us(sensor->model) > timeout_us) {
+                timeout_us = get_measurement_timeout_us(sensor->model);
+            }
+        }
+    }
+    if (mask == 0) {
+        return;
+    }
+
+    scanner->scan_mask = mask;
+    scanner->timeout_us = timeout_us;
+    scanner->draining = false;
+    scanner->busy = true;
+    scanner->start_time = time_us_32();
+    alarm_id_t alarm = alarm_pool_add_alarm_in_us(irq_pool, timeout_us, scan_timeout_callback, scanner, true /* fire_if_past */);
+    // if no alarm slot is free, the window is still ended by dht_scanner_poll()
+    scanner->timeout_alarm = alarm > 0 ? alarm : 0;
+}
+
+bool dht_scanner_poll(dht_scanner_t *scanner) {
+    if (scanner->busy && !scanner->draining && time_us_32() - scanner->start_time >= scanner->timeout_us) {
+        complete_scan(scanner);
+    }
+    return !scanner->busy;
+}
+
+dht_result_t dht_scanner_get_result_tenths(const dht_scanner_t *scanner, uint index, uint16_t *humidity, int16_t *temperature) {
+    assert(index < scanner->count);
+
+    if (scanner->busy && (scanner->scan_mask & (1u << index))) {
+        return DHT_RESULT_IN_PROGRESS;
+    }
+    const dht_scanner_sensor_t *sensor = &scanner->sensors[index];
+    dht_result_t result = sensor->result;
+    if (result != DHT_RESULT_OK) {
+        return result;
+    }
+    if (humidity != NULL) {
+        *humidity = decode_humidity(sensor->model, sensor->data[0], sensor->data[1]);
+    }
+    if (temperature != NULL) {
+        *temperature = decode_temperature(sensor->model, sensor->data[2], sensor->data[3]);
+    }
+    return DHT_RESULT_OK;
+}
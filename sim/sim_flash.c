@@ -0,0 +1,65 @@
+#include "sim.h"
+
+#include <hardware/flash.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Flash contents, mapped from SIM_FLASH so programmed data survives a restart
+// of the simulation like it survives a reset of the board.
+
+static uint8_t *flash;
+
+const uint8_t *sim_flash_memory(void) {
+    if (flash != NULL) {
+        return flash;
+    }
+    const char *path = getenv("SIM_FLASH");
+    if (path != NULL && *path != '\0') {
+        int fd = open(path, O_RDWR | O_CREAT, 0644);
+        off_t size = fd < 0 ? -1 : lseek(fd, 0, SEEK_END);
+        if (size == 0) {
+            // a new file is erased flash
+            uint8_t erased[FLASH_SECTOR_SIZE];
+            memset(erased, 0xFF, sizeof(erased));
+            for (size = 0; size < PICO_FLASH_SIZE_BYTES; size += sizeof(erased)) {
+                if (write(fd, erased, sizeof(erased)) != sizeof(erased))    break;
+            }
+        }
+        if (size != PICO_FLASH_SIZE_BYTES) {
+            fprintf(stderr, "sim: can't use %s as flash\n", path);
+            exit(1);
+        }
+        flash = mmap(NULL, PICO_FLASH_SIZE_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    } else {
+        flash = mmap(NULL, PICO_FLASH_SIZE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (flash != MAP_FAILED)    memset(flash, 0xFF, PICO_FLASH_SIZE_BYTES);
+    }
+    if (flash == MAP_FAILED) {
+        perror("sim: flash");
+        exit(1);
+    }
+    return flash;
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    assert(flash_offs % FLASH_SECTOR_SIZE == 0 && count % FLASH_SECTOR_SIZE == 0);
+    assert(flash_offs + count <= PICO_FLASH_SIZE_BYTES);
+    sim_flash_memory();
+    memset(flash + flash_offs, 0xFF, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+    assert(flash_offs % FLASH_PAGE_SIZE == 0 && count % FLASH_PAGE_SIZE == 0);
+    assert(flash_offs + count <= PICO_FLASH_SIZE_BYTES);
+    sim_flash_memory();
+    // programming only clears bits
+    for (size_t i = 0; i < count; i++) {
+        flash[flash_offs + i] &= data[i];
+    }
+}
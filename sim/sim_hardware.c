@@ -0,0 +1,128 @@
+#include "sim.h"
+
+#include <hardware/gpio.h>
+#include <hardware/pio.h>
+#include <hardware/pwm.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Register state of the peripherals the firmware touches, kept only so the
+// simulated board can read pin functions and PWM levels back.
+
+typedef struct pwm_slice_t {
+    uint16_t wrap;
+    uint16_t level[2];
+    bool enabled;
+} pwm_slice_t;
+
+static gpio_function_t gpio_function[NUM_BANK0_GPIOS];
+static pwm_slice_t pwm_slices[NUM_PWM_SLICES];
+
+pio_hw_t sim_pio_hw[NUM_PIOS] = {{0, 0}, {1, 0}, {2, 0}};
+
+static void check_gpio(uint gpio) {
+    if (gpio >= NUM_BANK0_GPIOS) {
+        fprintf(stderr, "sim: invalid GPIO %u\n", gpio);
+        abort();
+    }
+}
+
+//
+// gpio
+//
+
+void gpio_init(uint gpio) {
+    check_gpio(gpio);
+    gpio_function[gpio] = GPIO_FUNC_SIO;
+}
+
+void gpio_set_function(uint gpio, gpio_function_t fn) {
+    check_gpio(gpio);
+    gpio_function[gpio] = fn;
+}
+
+gpio_function_t gpio_get_function(uint gpio) {
+    check_gpio(gpio);
+    return gpio_function[gpio];
+}
+
+void gpio_set_pulls(uint gpio, bool up, bool down) {
+    check_gpio(gpio);
+}
+
+//
+// pwm
+//
+
+void pwm_set_clkdiv_int_frac(uint slice_num, uint8_t integer, uint8_t fract) {
+    assert(slice_num < NUM_PWM_SLICES);
+    assert(integer >= 1);
+}
+
+void pwm_set_wrap(uint slice_num, uint16_t wrap) {
+    assert(slice_num < NUM_PWM_SLICES);
+    pwm_slices[slice_num].wrap = wrap;
+}
+
+void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level) {
+    assert(slice_num < NUM_PWM_SLICES && chan < 2);
+    pwm_slices[slice_num].level[chan] = level;
+}
+
+void pwm_set_enabled(uint slice_num, bool enabled) {
+    assert(slice_num < NUM_PWM_SLICES);
+    pwm_slices[slice_num].enabled = enabled;
+}
+
+double sim_pwm_gpio_duty(uint gpio) {
+    check_gpio(gpio);
+    const pwm_slice_t *slice = &pwm_slices[pwm_gpio_to_slice_num(gpio)];
+    if (gpio_function[gpio] != GPIO_FUNC_PWM || !slice->enabled) {
+        return 0;
+    }
+    // the counter runs 0..wrap, the output is high while it is below level
+    double duty = slice->level[pwm_gpio_to_channel(gpio)] / (slice->wrap + 1.0);
+    return duty > 1 ? 1 : duty;
+}
+
+//
+// pio
+//
+
+void pio_sm_claim(PIO pio, uint sm) {
+    assert(sm < NUM_PIO_STATE_MACHINES);
+    if (pio->sm_claimed & (1u << sm)) {
+        fprintf(stderr, "sim: PIO%u SM%u already claimed\n", pio->index, sm);
+        abort();
+    }
+    pio->sm_claimed |= 1u << sm;
+}
+
+void pio_sm_unclaim(PIO pio, uint sm) {
+    assert(sm < NUM_PIO_STATE_MACHINES);
+    pio->sm_claimed &= ~(1u << sm);
+}
+
+int pio_claim_unused_sm(PIO pio, bool required) {
+    for (uint sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++) {
+        if (!(pio->sm_claimed & (1u << sm))) {
+            pio->sm_claimed |= 1u << sm;
+            return sm;
+        }
+    }
+    if (required) {
+        fprintf(stderr, "sim: no free state machine on PIO%u\n", pio->index);
+        abort();
+    }
+    return -1;
+}
+
+bool pio_sm_is_claimed(PIO pio, uint sm) {
+    assert(sm < NUM_PIO_STATE_MACHINES);
+    return pio->sm_claimed & (1u << sm);
+}
+
+void pio_gpio_init(PIO pio, uint pin) {
+    gpio_set_function(pin, GPIO_FUNC_PIO0 + pio->index);
+}
@@ -0,0 +1,595 @@
+#include "sim.h"
+
+#include "lwip/ip.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+#include "lwip/udp.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// lwIP raw TCP and UDP APIs on non-blocking host sockets, see lwip/tcp.h and lwip/udp.h
+
+#define TCP_TMR_INTERVAL_US 250000  // flush timer, poll callbacks run every other tick
+
+enum {
+    PCB_NEW,
+    PCB_LISTEN,
+    PCB_ACTIVE,
+    PCB_CLOSING,    // tcp_close() called, unsent data is still flushed
+    PCB_DEAD,       // freed on the way out of sim_net_poll()
+};
+
+#define PCB_FLAG_FIN_RECEIVED 0x01
+
+static struct netif sim_netif;
+struct netif *netif_list = &sim_netif;
+
+static struct tcp_pcb *pcbs;
+static absolute_time_t next_tick;
+static bool slow_tick;
+
+//
+// pbuf
+//
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type) {
+    struct pbuf *p = malloc(sizeof(struct pbuf) + length);
+    if (p == NULL) {
+        return NULL;
+    }
+    p->next = NULL;
+    p->payload = p + 1;
+    p->tot_len = length;
+    p->len = length;
+    p->type_internal = type;
+    p->flags = 0;
+    p->ref = 1;
+    return p;
+}
+
+u8_t pbuf_free(struct pbuf *p) {
+    u8_t count = 0;
+    while (p != NULL && --p->ref == 0) {
+        struct pbuf *next = p->next;
+        free(p);
+        count++;
+        p = next;
+    }
+    return count;
+}
+
+void pbuf_ref(struct pbuf *p) {
+    p->ref++;
+}
+
+void pbuf_cat(struct pbuf *head, struct pbuf *tail) {
+    struct pbuf *p;
+    for (p = head; p->next != NULL; p = p->next) {
+        p->tot_len += tail->tot_len;
+    }
+    p->tot_len += tail->tot_len;
+    p->next = tail;
+}
+
+struct pbuf *pbuf_free_header(struct pbuf *q, u16_t size) {
+    struct pbuf *p = q;
+    while (size > 0 && p != NULL) {
+        if (size >= p->len) {
+            struct pbuf *head = p;
+            size -= p->len;
+            p = p->next;
+            head->next = NULL;
+            pbuf_free(head);
+        } else {
+            p->payload = (u8_t *)p->payload + size;
+            p->len -= size;
+            p->tot_len -= size;
+            size = 0;
+        }
+    }
+    return p;
+}
+
+u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset) {
+    u16_t copied = 0;
+    for (; p != NULL && len > 0; p = p->next) {
+        if (offset >= p->len) {
+            offset -= p->len;
+            continue;
+        }
+        u16_t n = p->len - offset;
+        if (n > len)    n = len;
+        memcpy((u8_t *)dataptr + copied, (const u8_t *)p->payload + offset, n);
+        copied += n;
+        len -= n;
+        offset = 0;
+    }
+    return copied;
+}
+
+u8_t pbuf_get_at(const struct pbuf *p, u16_t offset) {
+    for (; p != NULL; p = p->next) {
+        if (offset < p->len) {
+            return ((const u8_t *)p->payload)[offset];
+        }
+        offset -= p->len;
+    }
+    return 0;
+}
+
+//
+// netif
+//
+
+char *ip4addr_ntoa(const ip4_addr_t *addr) {
+    static char str[16];
+    const u8_t *b = (const u8_t *)&addr->addr;
+    snprintf(str, sizeof(str), "%u.%u.%u.%u", b[0], b[1], b[2], b[3]);
+    return str;
+}
+
+int ip4addr_aton(const char *cp, ip4_addr_t *addr) {
+    struct in_addr in;
+    if (inet_pton(AF_INET, cp, &in) != 1) {
+        return 0;
+    }
+    addr->addr = in.s_addr;
+    return 1;
+}
+
+void sim_net_link_up(void) {
+    // stands in for the DHCP lease; clients connect over loopback
+    sim_netif.ip_addr.addr = htonl(INADDR_LOOPBACK);
+}
+
+//
+// udp
+//
+
+struct udp_pcb *udp_new_ip_type(u8_t type) {
+    struct udp_pcb *pcb = malloc(sizeof(struct udp_pcb));
+    if (pcb == NULL) {
+        return NULL;
+    }
+    pcb->so_options = 0;
+    pcb->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    pcb->broadcast = false;
+    fcntl(pcb->fd, F_SETFL, O_NONBLOCK);
+    return pcb;
+}
+
+err_t udp_sendto(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *dst_ip, u16_t dst_port) {
+    u8_t buf[1500];
+    u16_t len = pbuf_copy_partial(p, buf, sizeof(buf), 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(dst_port) };
+    addr.sin_addr.s_addr = dst_ip->addr;
+    if ((pcb->so_options & SOF_BROADCAST) && !pcb->broadcast) {
+        int on = 1;
+        setsockopt(pcb->fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+        pcb->broadcast = true;
+    }
+    if (sendto(pcb->fd, buf, len, 0, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        // without SOF_BROADCAST lwIP refuses a broadcast destination, as the host does
+        if (errno == EACCES) {
+            return ERR_VAL;
+        }
+        // like a full queue on the device, a datagram the host won't take is dropped
+        return errno == ENETUNREACH || errno == EHOSTUNREACH ? ERR_RTE : ERR_MEM;
+    }
+    return ERR_OK;
+}
+
+void udp_remove(struct udp_pcb *pcb) {
+    close(pcb->fd);
+    free(pcb);
+}
+
+//
+// tcp
+//
+
+static struct tcp_pcb *pcb_new(void) {
+    struct tcp_pcb *pcb = calloc(1, sizeof(struct tcp_pcb));
+    if (pcb == NULL) {
+        return NULL;
+    }
+    pcb->fd = -1;
+    pcb->state = PCB_NEW;
+    pcb->snd_buf = TCP_SND_BUF;
+    pcb->rcv_wnd = TCP_WND;
+    pcb->next = pcbs;
+    pcbs = pcb;
+    return pcb;
+}
+
+static void pcb_close_fd(struct tcp_pcb *pcb, bool reset) {
+    if (pcb->fd < 0) {
+        return;
+    }
+    if (reset) {
+        struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+        setsockopt(pcb->fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    }
+    close(pcb->fd);
+    pcb->fd = -1;
+}
+
+// connection lost underneath the application; the pcb is gone when errf runs
+static void pcb_fail(struct tcp_pcb *pcb, err_t err) {
+    tcp_err_fn errf = pcb->errf;
+    void *arg = pcb->callback_arg;
+    pcb_close_fd(pcb, true);
+    pcb->state = PCB_DEAD;
+    if (errf != NULL) {
+        errf(arg, err);
+    }
+}
+
+struct tcp_pcb *tcp_new(void) {
+    return pcb_new();
+}
+
+struct tcp_pcb *tcp_new_ip_type(u8_t type) {
+    return pcb_new();
+}
+
+err_t tcp_bind(struct tcp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return ERR_MEM;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = ipaddr != NULL ? ipaddr->addr : htonl(INADDR_ANY),
+    };
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("sim: bind");
+        close(fd);
+        return errno == EADDRINUSE ? ERR_USE : ERR_VAL;
+    }
+    pcb->fd = fd;
+    return ERR_OK;
+}
+
+struct tcp_pcb *tcp_listen_with_backlog(struct tcp_pcb *pcb, u8_t backlog) {
+    if (pcb->fd < 0 || listen(pcb->fd, backlog) < 0) {
+        return NULL;
+    }
+    pcb->state = PCB_LISTEN;
+    return pcb;
+}
+
+void tcp_arg(struct tcp_pcb *pcb, void *arg) {
+    pcb->callback_arg = arg;
+}
+
+void tcp_accept(struct tcp_pcb *pcb, tcp_accept_fn accept) {
+    pcb->accept = accept;
+}
+
+void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv) {
+    pcb->recv = recv;
+}
+
+void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent) {
+    pcb->sent = sent;
+}
+
+void tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn poll, u8_t interval) {
+    pcb->poll = poll;
+    pcb->pollinterval = interval;
+    pcb->polltmr = 0;
+}
+
+void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err) {
+    pcb->errf = err;
+}
+
+void tcp_setprio(struct tcp_pcb *pcb, u8_t prio) {
+}
+
+void tcp_nagle_disable(struct tcp_pcb *pcb) {
+    int on = 1;
+    if (pcb->fd >= 0) {
+        setsockopt(pcb->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+}
+
+err_t tcp_write(struct tcp_pcb *pcb, const void *dataptr, u16_t len, u8_t apiflags) {
+    if (pcb->state != PCB_ACTIVE) {
+        return ERR_CONN;
+    }
+    if (len == 0) {
+        return ERR_OK;
+    }
+    u16_t segments = (len + TCP_MSS - 1) / TCP_MSS;
+    if (len > pcb->snd_buf || pcb->snd_queuelen + segments > TCP_SND_QUEUELEN) {
+        return ERR_MEM;
+    }
+
+    // like lwIP, data is only copied with TCP_WRITE_FLAG_COPY; otherwise the
+    // caller's memory is read when it goes out, so reusing it early shows up
+    // as corrupted output
+    u8_t *copy = NULL;
+    if (apiflags & TCP_WRITE_FLAG_COPY) {
+        copy = malloc(len);
+        if (copy == NULL) {
+            return ERR_MEM;
+        }
+        memcpy(copy, dataptr, len);
+        dataptr = copy;
+    }
+    pcb->unsent[pcb->unsent_count].data = dataptr;
+    pcb->unsent[pcb->unsent_count].len = len;
+    pcb->unsent[pcb->unsent_count++].copy = copy;
+    pcb->snd_unsent += len;
+    pcb->snd_buf -= len;
+    for (u16_t left = len; left > 0; ) {
+        u16_t seg = left < TCP_MSS ? left : TCP_MSS;
+        pcb->seg_len[pcb->snd_queuelen++] = seg;
+        left -= seg;
+    }
+    return ERR_OK;
+}
+
+err_t tcp_output(struct tcp_pcb *pcb) {
+    if ((pcb->state != PCB_ACTIVE && pcb->state != PCB_CLOSING) || pcb->snd_unsent == 0) {
+        return ERR_OK;
+    }
+    // everything queued goes out in one send, like a segment batch
+    struct iovec iov[TCP_SND_QUEUELEN];
+    for (u16_t i = 0; i < pcb->unsent_count; i++) {
+        iov[i] = (struct iovec){ .iov_base = (void *)pcb->unsent[i].data, .iov_len = pcb->unsent[i].len };
+    }
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = pcb->unsent_count };
+    ssize_t n = sendmsg(pcb->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            pcb_fail(pcb, ERR_RST);
+        }
+        return ERR_OK;
+    }
+    pcb->snd_unsent -= n;
+    pcb->snd_acked += n;
+    while (n > 0) {
+        if (n < pcb->unsent[0].len) {
+            pcb->unsent[0].data += n;
+            pcb->unsent[0].len -= n;
+            break;
+        }
+        n -= pcb->unsent[0].len;
+        free(pcb->unsent[0].copy);
+        memmove(pcb->unsent, pcb->unsent + 1, --pcb->unsent_count * sizeof(pcb->unsent[0]));
+    }
+    return ERR_OK;
+}
+
+void tcp_recved(struct tcp_pcb *pcb, u16_t len) {
+    pcb->rcv_wnd += len;
+    if (pcb->rcv_wnd > TCP_WND)     pcb->rcv_wnd = TCP_WND;
+}
+
+err_t tcp_close(struct tcp_pcb *pcb) {
+    if (pcb->state == PCB_ACTIVE) {
+        // the fd is closed once the queued data has been flushed
+        pcb->state = PCB_CLOSING;
+        tcp_output(pcb);
+    } else if (pcb->state != PCB_DEAD) {
+        pcb_close_fd(pcb, false);
+        pcb->state = PCB_DEAD;
+    }
+    return ERR_OK;
+}
+
+void tcp_abort(struct tcp_pcb *pcb) {
+    if (pcb->state != PCB_DEAD) {
+        pcb_fail(pcb, ERR_ABRT);
+    }
+}
+
+//
+// simulation loop
+//
+
+// hand received data to the application, keeping it if refused
+static void pcb_deliver(struct tcp_pcb *pcb, struct pbuf *p) {
+    err_t err;
+    if (pcb->recv != NULL) {
+        err = pcb->recv(pcb->callback_arg, pcb, p, ERR_OK);
+    } else if (p != NULL) {
+        tcp_recved(pcb, p->tot_len);
+        pbuf_free(p);
+        err = ERR_OK;
+    } else {
+        err = tcp_close(pcb);
+    }
+    if (err == ERR_ABRT) {
+        return;
+    }
+    if (err != ERR_OK && p != NULL) {
+        pcb->refused_data = p;
+    }
+    tcp_output(pcb);
+}
+
+static void pcb_receive(struct tcp_pcb *pcb) {
+    u16_t len = pcb->rcv_wnd < TCP_MSS ? pcb->rcv_wnd : TCP_MSS;
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, len, PBUF_RAM);
+    ssize_t n = recv(pcb->fd, p->payload, len, MSG_DONTWAIT);
+    if (n > 0) {
+        p->len = p->tot_len = n;
+        pcb->rcv_wnd -= n;
+        pcb_deliver(pcb, p);
+        return;
+    }
+    pbuf_free(p);
+    if (n == 0) {
+        pcb->flags |= PCB_FLAG_FIN_RECEIVED;
+        pcb_deliver(pcb, NULL);
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        pcb_fail(pcb, ERR_RST);
+    }
+}
+
+static void pcb_accept(struct tcp_pcb *listener) {
+    int fd;
+    while (listener->state == PCB_LISTEN && (fd = accept(listener->fd, NULL, NULL)) >= 0) {
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        struct tcp_pcb *pcb = pcb_new();
+        if (pcb == NULL) {
+            close(fd);
+            continue;
+        }
+        pcb->fd = fd;
+        pcb->state = PCB_ACTIVE;
+        pcb->callback_arg = listener->callback_arg;
+
+        err_t err = listener->accept != NULL ? listener->accept(listener->callback_arg, pcb, ERR_OK) : ERR_VAL;
+        if (err == ERR_ABRT) {
+            continue;
+        } else if (err != ERR_OK) {
+            tcp_abort(pcb);
+            continue;
+        }
+        tcp_output(pcb);
+    }
+}
+
+// report data the kernel took as acknowledged, freeing send buffer space
+static void pcb_report_sent(struct tcp_pcb *pcb) {
+    u16_t len = pcb->snd_acked;
+    pcb->snd_acked = 0;
+    pcb->snd_buf += len;
+    for (u16_t left = len; left > 0; ) {
+        if (pcb->seg_len[0] <= left) {
+            left -= pcb->seg_len[0];
+            memmove(pcb->seg_len, pcb->seg_len + 1, --pcb->snd_queuelen * sizeof(pcb->seg_len[0]));
+        } else {
+            pcb->seg_len[0] -= left;
+            left = 0;
+        }
+    }
+    if (pcb->sent != NULL && pcb->sent(pcb->callback_arg, pcb, len) == ERR_ABRT) {
+        return;
+    }
+    tcp_output(pcb);
+}
+
+static void pcb_tick(struct tcp_pcb *pcb) {
+    tcp_output(pcb);
+    if (slow_tick && pcb->state == PCB_ACTIVE && pcb->poll != NULL && ++pcb->polltmr >= pcb->pollinterval) {
+        pcb->polltmr = 0;
+        if (pcb->poll(pcb->callback_arg, pcb) == ERR_ABRT) {
+            return;
+        }
+        tcp_output(pcb);
+    }
+}
+
+void sim_net_poll(absolute_time_t wake) {
+    if (next_tick == 0) {
+        next_tick = time_us_64() + TCP_TMR_INTERVAL_US;
+    }
+    uint count = 0;
+    for (struct tcp_pcb *pcb = pcbs; pcb != NULL; pcb = pcb->next) {
+        count++;
+    }
+    struct pollfd fds[count + 2];
+    struct tcp_pcb *owners[count + 1];
+    uint n = 0;
+    for (struct tcp_pcb *pcb = pcbs; pcb != NULL; pcb = pcb->next) {
+        short events = 0;
+        if (pcb->state == PCB_LISTEN) {
+            events = POLLIN;
+        } else if (pcb->state == PCB_ACTIVE || pcb->state == PCB_CLOSING) {
+            if (pcb->state == PCB_ACTIVE && pcb->rcv_wnd > 0 && pcb->refused_data == NULL && !(pcb->flags & PCB_FLAG_FIN_RECEIVED)) {
+                events |= POLLIN;
+            }
+            if (pcb->snd_unsent > 0) {
+                events |= POLLOUT;
+            }
+        }
+        if (events != 0) {
+            fds[n] = (struct pollfd){ .fd = pcb->fd, .events = events };
+            owners[n++] = pcb;
+        }
+    }
+
+    // core 1 wakes core 0 through its pipe, alongside the sockets
+    fds[n] = (struct pollfd){ .fd = sim_core_wake_fd(), .events = POLLIN };
+    if (poll(fds, n + 1, sim_host_timeout_ms(wake < next_tick ? wake : next_tick)) > 0) {
+        if (fds[n].revents != 0) {
+            sim_core_drain_wake();
+        }
+        for (uint i = 0; i < n; i++) {
+            struct tcp_pcb *pcb = owners[i];
+            if (fds[i].revents == 0 || pcb->state == PCB_DEAD) {
+                continue;
+            }
+            if (pcb->state == PCB_LISTEN) {
+                pcb_accept(pcb);
+                continue;
+            }
+            if (fds[i].revents & POLLOUT) {
+                tcp_output(pcb);
+            }
+            if (pcb->state == PCB_ACTIVE && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                pcb_receive(pcb);
+            }
+        }
+    }
+
+    bool tick = time_us_64() >= next_tick;
+    if (tick) {
+        next_tick += TCP_TMR_INTERVAL_US;
+        slow_tick = !slow_tick;
+    }
+    for (struct tcp_pcb *pcb = pcbs; pcb != NULL; pcb = pcb->next) {
+        if (pcb->state == PCB_ACTIVE && pcb->refused_data != NULL) {
+            struct pbuf *p = pcb->refused_data;
+            pcb->refused_data = NULL;
+            pcb_deliver(pcb, p);
+        }
+        // lwIP keeps reporting acks after tcp_close() until the data is out
+        if ((pcb->state == PCB_ACTIVE || pcb->state == PCB_CLOSING) && pcb->snd_acked > 0) {
+            pcb_report_sent(pcb);
+        }
+        if (tick) {
+            pcb_tick(pcb);
+        }
+        if (pcb->state == PCB_CLOSING && pcb->snd_unsent == 0) {
+            pcb_close_fd(pcb, false);
+            pcb->state = PCB_DEAD;
+        }
+    }
+
+    // nothing refers to dead pcbs any more once the callbacks have returned
+    for (struct tcp_pcb **link = &pcbs; *link != NULL; ) {
+        struct tcp_pcb *pcb = *link;
+        if (pcb->state == PCB_DEAD) {
+            *link = pcb->next;
+            pbuf_free(pcb->refused_data);
+            for (u16_t i = 0; i < pcb->unsent_count; i++) {
+                free(pcb->unsent[i].copy);
+            }
+            free(pcb);
+        } else {
+            link = &pcb->next;
+        }
+    }
+}
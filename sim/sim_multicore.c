@@ -0,0 +1,252 @@
+#include "sim.h"
+
+#include <hardware/sync.h>
+#include <pico/multicore.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Core 1 is a host thread. Each core sleeps in poll() on its own wake pipe
+// (core 0 alongside its sockets), which the other core writes to on __sev(),
+// on FIFO traffic and when it adds an alarm to a pool this core owns.
+
+#define FIFO_DEPTH 4
+
+typedef struct fifo_t {
+    uint32_t data[FIFO_DEPTH];
+    uint head;
+    uint count;
+} fifo_t;
+
+static __thread uint core_num;
+
+static pthread_once_t wake_once = PTHREAD_ONCE_INIT;
+static int wake_pipe[NUM_CORES][2];
+static bool event_flag[NUM_CORES];
+
+static pthread_t core1_thread;
+static bool core1_running;
+static bool core1_reset;
+
+static fifo_t fifos[NUM_CORES];     // fifos[n] is read by core n
+static pthread_mutex_t fifo_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t spin_lock_mutex = PTHREAD_MUTEX_INITIALIZER;
+static spin_lock_t spin_locks[NUM_SPIN_LOCKS];
+static uint32_t spin_locks_claimed;
+
+uint get_core_num(void) {
+    return core_num;
+}
+
+//
+// wake pipes and events
+//
+
+static void create_wake_pipes(void) {
+    for (uint i = 0; i < NUM_CORES; i++) {
+        if (pipe(wake_pipe[i]) != 0) {
+            perror("sim: pipe");
+            abort();
+        }
+        for (uint end = 0; end < 2; end++) {
+            fcntl(wake_pipe[i][end], F_SETFL, fcntl(wake_pipe[i][end], F_GETFL) | O_NONBLOCK);
+        }
+    }
+}
+
+void sim_core_signal(uint core) {
+    pthread_once(&wake_once, create_wake_pipes);
+    char byte = 0;
+    // a full pipe already holds a pending wake
+    if (write(wake_pipe[core][1], &byte, 1) < 0 && errno != EAGAIN) {
+        perror("sim: wake");
+    }
+}
+
+int sim_core_wake_fd(void) {
+    pthread_once(&wake_once, create_wake_pipes);
+    return wake_pipe[core_num][0];
+}
+
+void sim_core_drain_wake(void) {
+    char buf[64];
+    while (read(sim_core_wake_fd(), buf, sizeof(buf)) > 0) {}
+}
+
+void sim_core_wait(absolute_time_t wake) {
+    struct pollfd fd = { .fd = sim_core_wake_fd(), .events = POLLIN };
+    if (poll(&fd, 1, sim_host_timeout_ms(wake)) > 0) {
+        sim_core_drain_wake();
+    }
+    if (core_num == 1 && __atomic_load_n(&core1_reset, __ATOMIC_ACQUIRE)) {
+        pthread_exit(NULL);
+    }
+}
+
+bool sim_core_take_event(void) {
+    return __atomic_exchange_n(&event_flag[core_num], false, __ATOMIC_ACQ_REL);
+}
+
+void __sev(void) {
+    for (uint i = 0; i < NUM_CORES; i++) {
+        __atomic_store_n(&event_flag[i], true, __ATOMIC_RELEASE);
+        if (i != core_num) {
+            sim_core_signal(i);
+        }
+    }
+}
+
+//
+// spin locks
+//
+
+int spin_lock_claim_unused(bool required) {
+    int lock_num = -1;
+    pthread_mutex_lock(&spin_lock_mutex);
+    for (uint i = 0; i < NUM_SPIN_LOCKS && lock_num < 0; i++) {
+        if (!(spin_locks_claimed & (1u << i))) {
+            spin_locks_claimed |= 1u << i;
+            pthread_mutex_init(&spin_locks[i], NULL);
+            lock_num = i;
+        }
+    }
+    pthread_mutex_unlock(&spin_lock_mutex);
+    if (lock_num < 0 && required) {
+        fprintf(stderr, "sim: no spin locks are available\n");
+        abort();
+    }
+    return lock_num;
+}
+
+void spin_lock_unclaim(uint lock_num) {
+    pthread_mutex_lock(&spin_lock_mutex);
+    spin_locks_claimed &= ~(1u << lock_num);
+    pthread_mutex_unlock(&spin_lock_mutex);
+}
+
+spin_lock_t *spin_lock_instance(uint lock_num) {
+    return &spin_locks[lock_num];
+}
+
+//
+// core 1
+//
+
+static void *core1_entry(void *arg) {
+    core_num = 1;
+    ((void (*)(void))arg)();
+    return NULL;
+}
+
+void multicore_launch_core1(void (*entry)(void)) {
+    if (core1_running) {
+        fprintf(stderr, "sim: core 1 is already running\n");
+        abort();
+    }
+    core1_reset = false;
+    if (pthread_create(&core1_thread, NULL, core1_entry, (void *)entry) != 0) {
+        perror("sim: core 1");
+        abort();
+    }
+    core1_running = true;
+}
+
+void multicore_reset_core1(void) {
+    if (!core1_running) {
+        return;
+    }
+    __atomic_store_n(&core1_reset, true, __ATOMIC_RELEASE);
+    sim_core_signal(1);
+    pthread_join(core1_thread, NULL);
+    core1_running = false;
+
+    pthread_mutex_lock(&fifo_mutex);
+    fifos[0].count = fifos[1].count = 0;
+    pthread_mutex_unlock(&fifo_mutex);
+}
+
+//
+// inter-core FIFO
+//
+
+bool multicore_fifo_rvalid(void) {
+    pthread_mutex_lock(&fifo_mutex);
+    bool valid = fifos[core_num].count > 0;
+    pthread_mutex_unlock(&fifo_mutex);
+    return valid;
+}
+
+bool multicore_fifo_wready(void) {
+    pthread_mutex_lock(&fifo_mutex);
+    bool ready = fifos[core_num ^ 1].count < FIFO_DEPTH;
+    pthread_mutex_unlock(&fifo_mutex);
+    return ready;
+}
+
+static void fifo_write(uint32_t data) {
+    pthread_mutex_lock(&fifo_mutex);
+    fifo_t *fifo = &fifos[core_num ^ 1];
+    fifo->data[(fifo->head + fifo->count++) % FIFO_DEPTH] = data;
+    pthread_mutex_unlock(&fifo_mutex);
+    __sev();
+}
+
+static uint32_t fifo_read(void) {
+    pthread_mutex_lock(&fifo_mutex);
+    fifo_t *fifo = &fifos[core_num];
+    uint32_t data = fifo->data[fifo->head];
+    fifo->head = (fifo->head + 1) % FIFO_DEPTH;
+    fifo->count--;
+    pthread_mutex_unlock(&fifo_mutex);
+    __sev();
+    return data;
+}
+
+// the SDK spins with tight_loop_contents() here; sleeping on the event the
+// reader raises keeps the host idle instead
+void multicore_fifo_push_blocking(uint32_t data) {
+    while (!multicore_fifo_wready()) {
+        __wfe();
+    }
+    fifo_write(data);
+}
+
+bool multicore_fifo_push_timeout_us(uint32_t data, uint64_t timeout_us) {
+    absolute_time_t end_time = make_timeout_time_us(timeout_us);
+    while (!multicore_fifo_wready()) {
+        if (best_effort_wfe_or_timeout(end_time)) {
+            return false;
+        }
+    }
+    fifo_write(data);
+    return true;
+}
+
+uint32_t multicore_fifo_pop_blocking(void) {
+    while (!multicore_fifo_rvalid()) {
+        __wfe();
+    }
+    return fifo_read();
+}
+
+bool multicore_fifo_pop_timeout_us(uint64_t timeout_us, uint32_t *out) {
+    absolute_time_t end_time = make_timeout_time_us(timeout_us);
+    while (!multicore_fifo_rvalid()) {
+        if (best_effort_wfe_or_timeout(end_time)) {
+            return false;
+        }
+    }
+    *out = fifo_read();
+    return true;
+}
+
+void multicore_fifo_drain(void) {
+    pthread_mutex_lock(&fifo_mutex);
+    fifos[core_num].count = 0;
+    pthread_mutex_unlock(&fifo_mutex);
+}
@@ -0,0 +1,193 @@
+#include "sim.h"
+
+#include <tach.h>
+#include <hardware/gpio.h>
+#include <assert.h>
+#include <string.h>
+
+// Host build of the tach library: the ring is filled from the simulated fan's
+// edge times instead of by PIO and DMA, everything else matches tach.c.
+
+static const uint TICK_FREQUENCY = 1000000;     // 1 us timestamps
+static const uint32_t LOST_TICKS = 0;           // the simulated edge times are exact
+static const uint32_t IDLE_CHECK_US = 20000;    // update rate while no period is known
+static const uint32_t MIN_CHECK_US = 1000;
+static const uint8_t STALL_CHECKS = 3;          // half periods without an edge: 1.5 periods
+static const uint32_t MAX_PERIOD_US = 200000;   // slowest measurable pulse, 150 RPM at 2 pulses per rev
+
+#define RING_MASK (TACH_RING_SIZE - 1)
+
+// every tach, updated by one shared alarm on the pool of the first
+static tach_t *tach_by_sm[NUM_PIOS][NUM_PIO_STATE_MACHINES];
+static uint8_t tach_count;
+static alarm_pool_t *dispatch_pool;
+static alarm_id_t dispatch_alarm;
+
+// Copy the edges since the last update into the ring, stamped like the PIO
+// program does: a 1 us down-counter. Returns the index of the next edge.
+static uint32_t ring_head(tach_t *tach) {
+    uint32_t edges = sim_world_tach_edges(tach->pin);
+    uint32_t edge = tach->count + ((edges - tach->count) > TACH_RING_SIZE ? edges - tach->count - TACH_RING_SIZE : 0);
+    for (; edge != edges; edge++) {
+        absolute_time_t time;
+        if (sim_world_tach_edge_time(tach->pin, edge, &time)) {
+            tach->ring[edge & RING_MASK] = ~(uint32_t)time;
+        }
+    }
+    return edges & RING_MASK;
+}
+
+// Mean of the last periods, leaving out those more than 25 % off their median
+static void tach_estimate(tach_t *tach) {
+    uint n = tach->run_edges - 1;
+    if (n > tach->config.average_pulses)    n = tach->config.average_pulses;
+
+    uint32_t periods[TACH_MAX_AVERAGE];
+    uint32_t sorted[TACH_MAX_AVERAGE] = {0};
+    uint32_t newer = tach->ring[(tach->head - 1) & RING_MASK];
+    for (uint i = 0; i < n; i++) {
+        // X counts down, older timestamps are larger
+        uint32_t older = tach->ring[(tach->head - 2 - i) & RING_MASK];
+        periods[i] = older - newer + LOST_TICKS;
+        newer = older;
+        // insertion sort, n is small
+        uint j = i;
+        for (; j > 0 && sorted[j - 1] > periods[i]; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = periods[i];
+    }
+    uint32_t median = sorted[n / 2];
+
+    uint32_t sum = 0;
+    uint used = 0;
+    for (uint i = 0; i < n; i++) {
+        if (periods[i] >= median - median / 4 && periods[i] <= median + median / 4) {
+            sum += periods[i];
+            used++;
+        }
+    }
+    uint32_t per_minute = 60u * TICK_FREQUENCY / tach->config.pulses_per_rev;
+    tach->period_us = median;
+    tach->rpm = (per_minute * used + sum / 2) / sum;
+    tach->stalled = false;
+}
+
+// Update one tach from its new edges, returning the delay to its next check
+static uint32_t tach_check(tach_t *tach) {
+    uint32_t head = ring_head(tach);
+    uint32_t edges = (head - tach->head) & RING_MASK;
+    tach->head = head;
+    tach->count += edges;
+
+    if (edges > 0) {
+        tach->quiet_checks = 0;
+        tach->run_edges += edges;
+        if (tach->run_edges > TACH_RING_SIZE)   tach->run_edges = TACH_RING_SIZE;
+        if (tach->run_edges >= 2) {
+            tach_estimate(tach);
+        }
+    } else if (tach->run_edges > 0) {
+        // after a lone edge there is no period to expect, allow the slowest one
+        uint limit = tach->period_us != 0 ? STALL_CHECKS : MAX_PERIOD_US / IDLE_CHECK_US;
+        if (++tach->quiet_checks >= limit) {
+            // an expected pulse is overdue, older edges no longer describe the fan
+            tach->rpm = 0;
+            tach->period_us = 0;
+            tach->run_edges = 0;
+            tach->stalled = true;
+        }
+    }
+
+    // half a period apart, so a missing pulse shows within one period
+    if (tach->period_us == 0) {
+        return IDLE_CHECK_US;
+    }
+    return tach->period_us / 2 > MIN_CHECK_US ? tach->period_us / 2 : MIN_CHECK_US;
+}
+
+// The one alarm behind every tach: checks those that are due, then sleeps
+// until the earliest next check
+static int64_t dispatch_alarm_callback(alarm_id_t id, void *user_data) {
+    absolute_time_t now = get_absolute_time();
+    // a tach added meanwhile is first checked within IDLE_CHECK_US
+    int64_t next_us = IDLE_CHECK_US;
+    for (uint p = 0; p < NUM_PIOS; p++) {
+        for (uint sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++) {
+            tach_t *tach = tach_by_sm[p][sm];
+            if (tach == NULL) {
+                continue;
+            }
+            if (absolute_time_diff_us(now, tach->next_check) <= 0) {
+                tach->next_check = delayed_by_us(now, tach_check(tach));
+            }
+            int64_t until_us = absolute_time_diff_us(now, tach->next_check);
+            if (until_us < next_us)     next_us = until_us;
+        }
+    }
+    return next_us > MIN_CHECK_US ? next_us : MIN_CHECK_US;
+}
+
+// Register an initialized tach with the dispatcher, starting it with the first
+static void dispatch_add(tach_t *tach, alarm_pool_t *pool) {
+    pool = pool ? pool : alarm_pool_get_default();
+    assert(dispatch_pool == NULL || dispatch_pool == pool); // all tachs update on one core
+    tach->next_check = make_timeout_time_us(IDLE_CHECK_US);
+    tach_by_sm[pio_get_index(tach->pio)][tach->sm] = tach;
+    if (tach_count++ == 0) {
+        dispatch_pool = pool;
+        dispatch_alarm = alarm_pool_add_alarm_in_us(pool, IDLE_CHECK_US, dispatch_alarm_callback, NULL, true);
+    }
+}
+
+static void dispatch_remove(tach_t *tach) {
+    tach_by_sm[pio_get_index(tach->pio)][tach->sm] = NULL;
+    if (--tach_count == 0) {
+        alarm_pool_cancel_alarm(dispatch_pool, dispatch_alarm);
+        dispatch_pool = NULL;
+    }
+}
+
+//
+// public interface
+//
+
+tach_config_t tach_default_config(void) {
+    tach_config_t config = {
+        .pulses_per_rev = 2,
+        .average_pulses = 8,
+        .blank_us = 300,
+    };
+    return config;
+}
+
+void tach_init(tach_t *tach, PIO pio, uint8_t pin, const tach_config_t *config, alarm_pool_t *pool) {
+    assert(pio == pio0 || pio == pio1);
+    assert(config->pulses_per_rev > 0);
+    assert(config->average_pulses > 0 && config->average_pulses <= TACH_MAX_AVERAGE);
+
+    memset(tach, 0, sizeof(tach_t));
+    tach->pio = pio;
+    tach->sm = pio_claim_unused_sm(pio, true /* required */);
+    tach->pin = pin;
+    tach->config = *config;
+    tach->stalled = true;
+
+    pio_gpio_init(pio, pin);
+    gpio_pull_up(pin);
+    tach->count = sim_world_tach_edges(pin);
+    tach->head = tach->count & RING_MASK;
+
+    dispatch_add(tach, pool);
+}
+
+void tach_deinit(tach_t *tach) {
+    assert(tach->pio != NULL); // not initialized
+
+    dispatch_remove(tach);
+    pio_sm_unclaim(tach->pio, tach->sm);
+
+    tach->rpm = 0;
+    tach->stalled = true;
+    tach->pio = NULL;
+}
@@ -0,0 +1,329 @@
+#include "sim.h"
+
+#include <hardware/sync.h>
+#include <pico/stdlib.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Virtual time runs SIM_SPEED times faster than the host clock, so long
+// thermal runs and idle timeouts can be replayed in seconds.
+
+typedef struct alarm_slot_t {
+    alarm_id_t id;      // 0 when free
+    absolute_time_t target;
+    alarm_callback_t callback;
+    void *user_data;
+    bool firing;
+    bool cancelled;     // cancelled from inside its own callback
+} alarm_slot_t;
+
+// one per hardware alarm; the first is the default pool, owned by core 0
+struct alarm_pool {
+    bool in_use;
+    uint core;
+    uint max_timers;
+    alarm_slot_t slots[PICO_TIME_DEFAULT_ALARM_POOL_MAX_TIMERS];
+};
+
+#define NUM_ALARM_POOLS 4
+
+// pools are shared between the cores, slots only change with alarm_mutex held
+static alarm_pool_t pools[NUM_ALARM_POOLS] = {
+    { .in_use = true, .core = 0, .max_timers = PICO_TIME_DEFAULT_ALARM_POOL_MAX_TIMERS },
+};
+static pthread_mutex_t alarm_mutex = PTHREAD_MUTEX_INITIALIZER;
+static alarm_id_t next_alarm_id = 1;
+
+static double speed;
+static uint64_t host_start_us;
+
+static uint64_t host_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+uint64_t time_us_64(void) {
+    if (host_start_us == 0) {
+        host_start_us = host_time_us();
+        speed = sim_env("SIM_SPEED", 1);
+        if (speed <= 0)     speed = 1;
+    }
+    return (uint64_t)((host_time_us() - host_start_us) * speed);
+}
+
+double sim_env(const char *name, double fallback) {
+    const char *value = getenv(name);
+    return value != NULL && *value != '\0' ? strtod(value, NULL) : fallback;
+}
+
+double sim_random(void) {
+    static bool seeded = false;
+    if (!seeded) {
+        srand((unsigned)sim_env("SIM_SEED", 1));
+        seeded = true;
+    }
+    return 2.0 * rand() / RAND_MAX - 1.0;
+}
+
+int sim_host_timeout_ms(absolute_time_t wake) {
+    absolute_time_t now = time_us_64();
+    if (wake <= now) {
+        return 0;
+    }
+    double ms = (wake - now) / speed / 1000.0 + 1;  // round up, never wake early
+    return ms > 1000 ? 1000 : (int)ms;
+}
+
+//
+// alarms
+//
+
+alarm_pool_t *alarm_pool_get_default(void) {
+    return &pools[0];
+}
+
+alarm_pool_t *alarm_pool_create_with_unused_hardware_alarm(uint max_timers) {
+    pthread_mutex_lock(&alarm_mutex);
+    alarm_pool_t *pool = NULL;
+    for (uint i = 1; i < NUM_ALARM_POOLS && pool == NULL; i++) {
+        if (!pools[i].in_use) {
+            pool = &pools[i];
+            pool->in_use = true;
+            pool->core = get_core_num();
+            pool->max_timers = max_timers < PICO_TIME_DEFAULT_ALARM_POOL_MAX_TIMERS ? max_timers : PICO_TIME_DEFAULT_ALARM_POOL_MAX_TIMERS;
+        }
+    }
+    pthread_mutex_unlock(&alarm_mutex);
+    if (pool == NULL) {
+        fprintf(stderr, "sim: no free hardware alarm\n");
+        abort();
+    }
+    return pool;
+}
+
+alarm_pool_t *sim_core_irq_pool(void) {
+    static alarm_pool_t *core_pools[NUM_CORES];
+    uint core = get_core_num();
+    if (core == 0) {
+        return alarm_pool_get_default();
+    }
+    if (core_pools[core] == NULL) {
+        core_pools[core] = alarm_pool_create_with_unused_hardware_alarm(PICO_TIME_DEFAULT_ALARM_POOL_MAX_TIMERS);
+    }
+    return core_pools[core];
+}
+
+static alarm_slot_t *next_due_alarm(uint core, absolute_time_t now) {
+    alarm_slot_t *next = NULL;
+    for (uint p = 0; p < NUM_ALARM_POOLS; p++) {
+        if (!pools[p].in_use || pools[p].core != core) {
+            continue;
+        }
+        for (uint i = 0; i < pools[p].max_timers; i++) {
+            alarm_slot_t *slot = &pools[p].slots[i];
+            if (slot->id != 0 && !slot->firing && slot->target <= now && (next == NULL || slot->target < next->target)) {
+                next = slot;
+            }
+        }
+    }
+    return next;
+}
+
+static absolute_time_t next_alarm_time(uint core) {
+    absolute_time_t next = at_the_end_of_time;
+    pthread_mutex_lock(&alarm_mutex);
+    for (uint p = 0; p < NUM_ALARM_POOLS; p++) {
+        if (!pools[p].in_use || pools[p].core != core) {
+            continue;
+        }
+        for (uint i = 0; i < pools[p].max_timers; i++) {
+            alarm_slot_t *slot = &pools[p].slots[i];
+            if (slot->id != 0 && !slot->firing && slot->target < next) {
+                next = slot->target;
+            }
+        }
+    }
+    pthread_mutex_unlock(&alarm_mutex);
+    return next;
+}
+
+// fire this core's due alarms in target order, like its timer IRQs would
+static void fire_alarms(void) {
+    uint core = get_core_num();
+    pthread_mutex_lock(&alarm_mutex);
+    alarm_slot_t *slot;
+    while ((slot = next_due_alarm(core, time_us_64())) != NULL) {
+        slot->firing = true;
+        slot->cancelled = false;
+        pthread_mutex_unlock(&alarm_mutex);
+        int64_t ret = slot->callback(slot->id, slot->user_data);
+        pthread_mutex_lock(&alarm_mutex);
+        slot->firing = false;
+        if (ret == 0 || slot->cancelled) {
+            slot->id = 0;
+        } else if (ret > 0) {
+            slot->target = time_us_64() + ret;
+        } else {
+            slot->target -= ret;
+        }
+    }
+    pthread_mutex_unlock(&alarm_mutex);
+}
+
+alarm_id_t alarm_pool_add_alarm_at(alarm_pool_t *pool, absolute_time_t time, alarm_callback_t callback, void *user_data,
+                                   bool fire_if_past) {
+    if (!fire_if_past && time <= time_us_64()) {
+        return 0;
+    }
+    alarm_id_t id = -1;     // pool full
+    pthread_mutex_lock(&alarm_mutex);
+    for (uint i = 0; i < pool->max_timers; i++) {
+        alarm_slot_t *slot = &pool->slots[i];
+        if (slot->id == 0) {
+            slot->id = id = next_alarm_id++;
+            if (next_alarm_id <= 0)     next_alarm_id = 1;
+            slot->target = time;
+            slot->callback = callback;
+            slot->user_data = user_data;
+            slot->firing = false;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&alarm_mutex);
+    // the owning core may be asleep past the new target
+    if (id > 0 && pool->core != get_core_num()) {
+        sim_core_signal(pool->core);
+    }
+    return id;
+}
+
+bool alarm_pool_cancel_alarm(alarm_pool_t *pool, alarm_id_t alarm_id) {
+    bool found = false;
+    pthread_mutex_lock(&alarm_mutex);
+    for (uint i = 0; i < pool->max_timers && !found; i++) {
+        alarm_slot_t *slot = &pool->slots[i];
+        if (alarm_id > 0 && slot->id == alarm_id) {
+            if (slot->firing) {
+                slot->cancelled = true;
+            } else {
+                slot->id = 0;
+            }
+            found = true;
+        }
+    }
+    pthread_mutex_unlock(&alarm_mutex);
+    return found;
+}
+
+static int64_t repeating_timer_callback(alarm_id_t id, void *user_data) {
+    repeating_timer_t *rt = (repeating_timer_t *)user_data;
+    if (rt->callback(rt)) {
+        return rt->delay_us;
+    }
+    rt->alarm_id = 0;
+    return 0;
+}
+
+bool alarm_pool_add_repeating_timer_us(alarm_pool_t *pool, int64_t delay_us, repeating_timer_callback_t callback,
+                                       void *user_data, repeating_timer_t *out) {
+    if (delay_us == 0)  delay_us = 1;
+    out->pool = pool;
+    out->callback = callback;
+    out->delay_us = delay_us;
+    out->user_data = user_data;
+    out->alarm_id = alarm_pool_add_alarm_in_us(pool, delay_us >= 0 ? delay_us : -delay_us, repeating_timer_callback, out, true);
+    return out->alarm_id > 0;
+}
+
+bool cancel_repeating_timer(repeating_timer_t *timer) {
+    bool cancelled = false;
+    if (timer->alarm_id > 0) {
+        cancelled = alarm_pool_cancel_alarm(timer->pool, timer->alarm_id);
+        timer->alarm_id = 0;
+    }
+    return cancelled;
+}
+
+//
+// simulation loop
+//
+
+// core 0 serves the network while it waits, the other cores only their wake pipe
+static void wait_until(absolute_time_t wake) {
+    if (get_core_num() == 0) {
+        sim_net_poll(wake);
+    } else {
+        sim_core_wait(wake);
+    }
+}
+
+void sim_run_pending(void) {
+    fire_alarms();
+    wait_until(0);
+    fire_alarms();
+}
+
+void sim_run_until(absolute_time_t deadline) {
+    do {
+        fire_alarms();
+        absolute_time_t wake = next_alarm_time(get_core_num());
+        wait_until(wake < deadline ? wake : deadline);
+    } while (time_us_64() < deadline);
+    fire_alarms();
+}
+
+void sim_wait_for_event(absolute_time_t until) {
+    fire_alarms();
+    absolute_time_t wake = next_alarm_time(get_core_num());
+    wait_until(wake < until ? wake : until);
+    fire_alarms();
+}
+
+void sleep_until(absolute_time_t target) {
+    sim_run_until(target);
+}
+
+void sleep_us(uint64_t us) {
+    sim_run_until(make_timeout_time_us(us));
+}
+
+void sleep_ms(uint32_t ms) {
+    sim_run_until(make_timeout_time_ms(ms));
+}
+
+void busy_wait_us(uint64_t delay_us) {
+    sim_run_until(make_timeout_time_us(delay_us));
+}
+
+void busy_wait_ms(uint32_t delay_ms) {
+    sim_run_until(make_timeout_time_ms(delay_ms));
+}
+
+void tight_loop_contents(void) {
+    sim_run_pending();
+}
+
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp) {
+    if (time_reached(timeout_timestamp)) {
+        return true;
+    }
+    if (!sim_core_take_event()) {
+        sim_wait_for_event(timeout_timestamp);
+    }
+    return time_reached(timeout_timestamp);
+}
+
+void __wfe(void) {
+    if (!sim_core_take_event()) {
+        sim_wait_for_event(at_the_end_of_time);
+        sim_core_take_event();
+    }
+}
+
+bool stdio_init_all(void) {
+    // logs interleave with the test client's output, don't hold them back
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    return true;
+}
@@ -0,0 +1,164 @@
+#include "sim.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+
+// Physical model of the simulated board. One enclosure is heated by a
+// constant load and loses heat to the room, passively and through the fans;
+// every sensor reads the enclosure air. The default wiring of temp_sens.c is
+// a subset of the one here.
+
+#define EDGE_HISTORY 64     // recent edge times kept per fan, a power of two
+
+typedef struct sim_fan_t {
+    uint pwm_pin;
+    uint tach_pin;
+    double rpm;
+    double edges;   // tach falling edges, fractional until the next one
+    uint64_t edge_us[EDGE_HISTORY];     // time of edge n, counting from 0, in edge_us[n % EDGE_HISTORY]
+} sim_fan_t;
+
+// more than temp_sens.c wires by default, so a second zone can be tried
+static sim_fan_t fans[] = {
+    { .pwm_pin = 16, .tach_pin = 17 },
+    { .pwm_pin = 18, .tach_pin = 19 },
+    { .pwm_pin = 20, .tach_pin = 21 },
+};
+
+static const uint dht_pins[] = { 15, 14 };
+
+#define NUM_FANS (sizeof(fans) / sizeof(fans[0]))
+#define NUM_DHTS (sizeof(dht_pins) / sizeof(dht_pins[0]))
+
+static const double FAN_PULSES_PER_REV = 2;
+static const double FAN_SPIN_UP_S = 2.0;            // rpm time constant
+static const double HEAT_CAPACITY_J_PER_K = 60;
+static const double PASSIVE_CONDUCTANCE_W_PER_K = 0.1;
+static const double FAN_CONDUCTANCE_W_PER_K = 0.5;  // per fan, at full speed
+static const double STEP_S = 0.05;
+
+static struct {
+    bool initialized;
+    absolute_time_t last_update;
+    double ambient_c;
+    double ambient_rh;
+    double heat_w;
+    double fan_max_rpm;
+    bool fan_stalled;
+    absolute_time_t fan_stall_at;   // 0 for never
+    double temperature_c;
+} world;
+
+// the DHT and the tach read the model from their alarms, which may run on either core
+static pthread_mutex_t world_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void world_init(void) {
+    world.ambient_c = sim_env("SIM_AMBIENT_C", 22);
+    world.ambient_rh = sim_env("SIM_AMBIENT_RH", 50);
+    world.heat_w = sim_env("SIM_HEAT_W", 1.5);
+    world.fan_max_rpm = sim_env("SIM_FAN_MAX_RPM", 2000);
+    world.fan_stalled = sim_env("SIM_FAN_STALL", 0) != 0;
+    world.fan_stall_at = (absolute_time_t)(sim_env("SIM_FAN_STALL_AT_S", 0) * 1e6);
+    world.temperature_c = sim_env("SIM_START_C", world.ambient_c);
+    world.last_update = time_us_64();
+    world.initialized = true;
+
+    printf("sim: ambient %.1f C %.0f %%RH, load %.2f W, fan %.0f RPM max%s\n", world.ambient_c, world.ambient_rh,
+           world.heat_w, world.fan_max_rpm, world.fan_stalled ? " (stalled)" : "");
+}
+
+// integrate from the last update to now in fixed steps
+static void world_update(void) {
+    if (!world.initialized) {
+        world_init();
+    }
+    absolute_time_t now = time_us_64();
+    double step_start_us = world.last_update;
+    double remaining_s = (now - world.last_update) / 1e6;
+    world.last_update = now;
+
+    while (remaining_s > 0) {
+        double dt = remaining_s < STEP_S ? remaining_s : STEP_S;
+        remaining_s -= dt;
+        if (world.fan_stall_at != 0 && step_start_us >= world.fan_stall_at && !world.fan_stalled) {
+            printf("sim: fan seized\n");
+            world.fan_stalled = true;
+        }
+
+        double conductance = PASSIVE_CONDUCTANCE_W_PER_K;
+        for (uint i = 0; i < NUM_FANS; i++) {
+            sim_fan_t *fan = &fans[i];
+            if (world.fan_stalled) {
+                // seized, stops dead
+                fan->rpm = 0;
+            } else {
+                double target_rpm = sim_pwm_gpio_duty(fan->pwm_pin) * world.fan_max_rpm;
+                fan->rpm += (target_rpm - fan->rpm) * (1 - exp(-dt / FAN_SPIN_UP_S));
+            }
+            // time each edge crossed during the step, interpolated
+            double rate = fan->rpm / 60 * FAN_PULSES_PER_REV;
+            double edges = fan->edges + rate * dt;
+            for (double edge = floor(fan->edges) + 1; edge <= edges; edge++) {
+                uint64_t n = (uint64_t)edge - 1;
+                fan->edge_us[n % EDGE_HISTORY] = (uint64_t)(step_start_us + (edge - fan->edges) / rate * 1e6);
+            }
+            fan->edges = edges;
+            conductance += FAN_CONDUCTANCE_W_PER_K * fan->rpm / world.fan_max_rpm;
+        }
+        world.temperature_c += (world.heat_w - conductance * (world.temperature_c - world.ambient_c)) * dt / HEAT_CAPACITY_J_PER_K;
+        step_start_us += dt * 1e6;
+    }
+}
+
+// Magnus formula, hPa
+static double saturation_pressure(double temperature_c) {
+    return 6.112 * exp(17.62 * temperature_c / (243.12 + temperature_c));
+}
+
+bool sim_world_read_climate(uint data_pin, double *temperature_c, double *humidity) {
+    uint i = 0;
+    while (i < NUM_DHTS && dht_pins[i] != data_pin) {
+        i++;
+    }
+    if (i == NUM_DHTS) {
+        return false;   // nothing wired, the sensor never answers
+    }
+    pthread_mutex_lock(&world_mutex);
+    world_update();
+
+    // the enclosure holds the room's absolute humidity, so RH drops as it warms
+    double rh = world.ambient_rh * saturation_pressure(world.ambient_c) / saturation_pressure(world.temperature_c);
+    *temperature_c = world.temperature_c;
+    *humidity = rh > 100 ? 100 : rh;
+    pthread_mutex_unlock(&world_mutex);
+    return true;
+}
+
+uint32_t sim_world_tach_edges(uint pin) {
+    uint32_t edges = 0;     // pulled up, no edges
+    pthread_mutex_lock(&world_mutex);
+    world_update();
+    for (uint i = 0; i < NUM_FANS; i++) {
+        if (fans[i].tach_pin == pin) {
+            edges = (uint32_t)fmod(fans[i].edges, 4294967296.0);
+        }
+    }
+    pthread_mutex_unlock(&world_mutex);
+    return edges;
+}
+
+bool sim_world_tach_edge_time(uint pin, uint32_t edge, absolute_time_t *time) {
+    bool found = false;
+    pthread_mutex_lock(&world_mutex);
+    for (uint i = 0; i < NUM_FANS; i++) {
+        uint32_t edges = (uint32_t)fmod(fans[i].edges, 4294967296.0);
+        // only the last EDGE_HISTORY edges are kept
+        if (fans[i].tach_pin == pin && edges - edge - 1 < EDGE_HISTORY) {
+            *time = fans[i].edge_us[edge % EDGE_HISTORY];
+            found = true;
+        }
+    }
+    pthread_mutex_unlock(&world_mutex);
+    return found;
+}
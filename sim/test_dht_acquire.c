@@ -0,0 +1,180 @@
+// Host test of dht_acquire.c against scripted sensors on a fake scanner and clock.
+//
+// A DHT polled inside its minimum interval may answer with garbage or a stale
+// conversion, so no start pulse may come sooner than the model's interval
+// after the last one the sensor answered, with a good frame or a bad
+// checksum. A read that timed out got no answer and may be retried sooner.
+// Run with `make test`.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dht_acquire.h"
+
+#define CONVERSION_US 5000     // start pulse to result
+#define POLL_US 1000           // how often the control loop polls
+#define RUN_US (600 * 1000000ull)
+
+#define MAX_SENSORS 4
+
+typedef struct fake_sensor_t {
+    uint32_t starts;
+    uint64_t started_us;
+    uint64_t answered_us;           // start of the last read answered, 0 for none
+    uint64_t min_gap_us;            // between any two starts
+    uint64_t max_gap_us;
+    uint64_t min_answered_gap_us;   // from the last answered start to the next start
+    dht_result_t result;
+} fake_sensor_t;
+
+static uint64_t now_us;
+static uint64_t scan_started_us;
+static bool running;
+static uint32_t scan_mask;
+static uint32_t scans;
+static fake_sensor_t fakes[MAX_SENSORS];
+static dht_result_t (*script)(uint32_t read);
+
+uint64_t time_us_64(void) {
+    return now_us;
+}
+
+void dht_scanner_start(dht_scanner_t *scanner, uint32_t mask) {
+    (void)scanner;
+    for (uint i = 0; i < MAX_SENSORS; i++) {
+        fake_sensor_t *f = &fakes[i];
+        if (!(mask & (1u << i))) {
+            continue;
+        }
+        if (f->starts > 0) {
+            uint64_t gap = now_us - f->started_us;
+            if (gap < f->min_gap_us)    f->min_gap_us = gap;
+            if (gap > f->max_gap_us)    f->max_gap_us = gap;
+        }
+        if (f->answered_us != 0 && now_us - f->answered_us < f->min_answered_gap_us) {
+            f->min_answered_gap_us = now_us - f->answered_us;
+        }
+        f->started_us = now_us;
+        f->starts++;
+    }
+    scan_started_us = now_us;
+    scan_mask = mask;
+    running = true;
+    scans++;
+}
+
+bool dht_scanner_poll(dht_scanner_t *scanner) {
+    (void)scanner;
+    if (running && now_us - scan_started_us >= CONVERSION_US) {
+        running = false;
+        for (uint i = 0; i < MAX_SENSORS; i++) {
+            fake_sensor_t *f = &fakes[i];
+            if (scan_mask & (1u << i)) {
+                f->result = script(f->starts - 1);
+                if (f->result != DHT_RESULT_TIMEOUT) {
+                    f->answered_us = f->started_us;
+                }
+            }
+        }
+    }
+    return !running;
+}
+
+dht_result_t dht_scanner_get_result_tenths(const dht_scanner_t *scanner, uint index, uint16_t *humidity,
+                                           int16_t *temperature) {
+    (void)scanner;
+    if (running && (scan_mask & (1u << index))) {
+        return DHT_RESULT_IN_PROGRESS;
+    }
+    if (fakes[index].result == DHT_RESULT_OK) {
+        *humidity = 500;
+        *temperature = 250;
+    }
+    return fakes[index].result;
+}
+
+static dht_result_t never(uint32_t read) {
+    (void)read;
+    return DHT_RESULT_OK;
+}
+
+static dht_result_t no_answer(uint32_t read) {
+    (void)read;
+    return DHT_RESULT_TIMEOUT;
+}
+
+static dht_result_t bad_checksums(uint32_t read) {
+    (void)read;
+    return DHT_RESULT_BAD_CHECKSUM;
+}
+
+static dht_result_t every_fifth_times_out(uint32_t read) {
+    return read % 5 == 4 ? DHT_RESULT_TIMEOUT : DHT_RESULT_OK;
+}
+
+static dht_result_t bursts(uint32_t read) {
+    return read % 10 < 3 ? DHT_RESULT_TIMEOUT : read % 10 < 6 ? DHT_RESULT_BAD_CHECKSUM : DHT_RESULT_OK;
+}
+
+static dht_result_t random_results(uint32_t read) {
+    (void)read;
+    return (dht_result_t)(rand() % 3);
+}
+
+static int failures;
+
+// want_fast: a retry comes inside the interval; want_max_gap_us: the backoff reaches it
+static void run(const char *name, dht_model_t model, uint sensors, dht_result_t (*pattern)(uint32_t), bool want_fast,
+                uint64_t want_max_gap_us) {
+    dht_scanner_t scanner;
+    dht_acquire_t acqs[MAX_SENSORS];
+    dht_result_t results[MAX_SENSORS];
+    now_us = 1000000;
+    running = false;
+    scans = 0;
+    script = pattern;
+    for (uint i = 0; i < sensors; i++) {
+        fakes[i] = (fake_sensor_t){ .min_gap_us = UINT64_MAX, .min_answered_gap_us = UINT64_MAX };
+        dht_acquire_init(&acqs[i], model);
+    }
+    for (uint64_t end = now_us + RUN_US; now_us < end; now_us += POLL_US) {
+        dht_acquire_poll(&scanner, acqs, sensors, results);
+    }
+
+    uint64_t interval_us = model == DHT11 ? 1000000 : 2000000;
+    bool ok = true;
+    uint32_t reads = 0;
+    for (uint i = 0; i < sensors; i++) {
+        const fake_sensor_t *f = &fakes[i];
+        ok = ok && f->starts > 1 && f->min_answered_gap_us >= interval_us
+             && (!want_fast || f->min_gap_us < interval_us)
+             && (want_max_gap_us == 0 || f->max_gap_us >= want_max_gap_us);
+        reads += f->starts;
+    }
+    // sensors reading at the same pace share their scans
+    if (pattern == never) {
+        ok = ok && scans == fakes[0].starts;
+    }
+    const fake_sensor_t *f = &fakes[0];
+    printf("%-4s %-28s %5u reads in %5u scans, gaps %6.3f s to %6.3f s, %6.3f s after an answer\n", ok ? "ok" : "FAIL",
+           name, reads, scans, f->min_gap_us / 1e6, f->max_gap_us / 1e6,
+           f->min_answered_gap_us == UINT64_MAX ? 0 : f->min_answered_gap_us / 1e6);
+    if (!ok) {
+        failures++;
+    }
+}
+
+int main(void) {
+    srand(1);
+    run("DHT22 never failing", DHT22, 1, never, false, 0);
+    run("DHT22 no answer", DHT22, 1, no_answer, true, DHT_ACQUIRE_MAX_BACKOFF_MS * 1000ull);
+    run("DHT22 bad checksums", DHT22, 1, bad_checksums, false, DHT_ACQUIRE_MAX_BACKOFF_MS * 1000ull);
+    run("DHT22 every 5th times out", DHT22, 1, every_fifth_times_out, true, 0);
+    run("DHT22 failure bursts", DHT22, 1, bursts, true, 0);
+    run("DHT22 random results", DHT22, 1, random_results, true, 0);
+    run("DHT11 no answer", DHT11, 1, no_answer, true, DHT_ACQUIRE_MAX_BACKOFF_MS * 1000ull);
+    run("DHT11 random results", DHT11, 1, random_results, true, 0);
+    run("4x DHT22 never failing", DHT22, 4, never, false, 0);
+    run("4x DHT22 random results", DHT22, 4, random_results, true, 0);
+    return failures ? 1 : 0;
+}
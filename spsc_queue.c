@@ -0,0 +1,40 @@
+#include "spsc_queue.h"
+
+#include <assert.h>
+#include <string.h>
+
+
+void spsc_queue_init(spsc_queue_t *queue, void *storage, uint16_t element_size, uint16_t capacity) {
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    queue->storage = storage;
+    queue->element_size = element_size;
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->dropped = 0;
+}
+
+
+bool spsc_queue_push(spsc_queue_t *queue, const void *element) {
+    uint32_t head = queue->head;
+    if (head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) >= queue->capacity) {
+        queue->dropped++;
+        return false;
+    }
+    memcpy(queue->storage + (head & (queue->capacity - 1)) * queue->element_size, element, queue->element_size);
+    // publish the slot only once it is fully written
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+
+bool spsc_queue_pop(spsc_queue_t *queue, void *element) {
+    uint32_t tail = queue->tail;
+    if (__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == tail) {
+        return false;
+    }
+    memcpy(element, queue->storage + (tail & (queue->capacity - 1)) * queue->element_size, queue->element_size);
+    // hand the slot back only once it has been copied out
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef _SPSC_QUEUE_H_
+#define _SPSC_QUEUE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** \file spsc_queue.h
+ *
+ * \brief Lock-free single-producer single-consumer queue.
+ *
+ * Fixed-size elements in caller-provided storage. The producer and consumer
+ * may run on different cores; each index is only written by one side and is
+ * published with release/acquire ordering, so no lock or interrupt masking
+ * is needed.
+ */
+
+typedef struct spsc_queue_t {
+    uint8_t *storage;
+    uint16_t element_size;
+    uint16_t capacity;          // elements, a power of two
+    volatile uint32_t head;     // elements pushed, written by the producer only
+    volatile uint32_t tail;     // elements popped, written by the consumer only
+    volatile uint32_t dropped;  // pushes refused because the queue was full
+} spsc_queue_t;
+
+/**
+ * \brief Initialize an empty queue.
+ *
+ * \param queue Queue.
+ * \param storage element_size * capacity bytes.
+ * \param element_size Size of one element.
+ * \param capacity Number of elements, must be a power of two.
+ */
+void spsc_queue_init(spsc_queue_t *queue, void *storage, uint16_t element_size, uint16_t capacity);
+
+/**
+ * \brief Copy an element in. Producer side only.
+ *
+ * \return false if the queue is full; the element is dropped and counted.
+ */
+bool spsc_queue_push(spsc_queue_t *queue, const void *element);
+
+/**
+ * \brief Copy the oldest element out. Consumer side only.
+ *
+ * \return false if the queue is empty.
+ */
+bool spsc_queue_pop(spsc_queue_t *queue, void *element);
+
+#endif // _SPSC_QUEUE_H_
@@ -0,0 +1,126 @@
+#ifndef _TACH_H_
+#define _TACH_H_
+
+#include <hardware/pio.h>
+#include <pico/time.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file tach.h
+ *
+ * \brief Fan tachometer library.
+ *
+ * A PIO state machine timestamps every falling tach edge with a 1 us tick and
+ * DMA copies the timestamps into a ring, so there is no per-edge interrupt.
+ * A timer alarm reads the ring: the speed is the mean of the last few pulse
+ * periods, leaving out periods far from their median (missed or doubled
+ * edges). Each tach is checked every half expected period, so a fan that
+ * stops is reported as stalled at most one period after a pulse went missing.
+ *
+ * All tachs share one alarm, which checks those that are due from a table
+ * indexed by PIO block and state machine, so a board with many fans costs a
+ * single alarm slot. Tachs on the same PIO block share one copy of the
+ * program, so up to four fit in a block.
+ */
+
+#define TACH_RING_SIZE 32           // captured edges, a power of two
+#define TACH_MAX_AVERAGE 16         // most periods averaged per reading
+
+/**
+ * \brief Tachometer settings.
+ */
+typedef struct tach_config_t {
+    uint8_t pulses_per_rev;     // tach pulses per revolution, 2 for most PC fans
+    uint8_t average_pulses;     // periods averaged per reading, 1 to TACH_MAX_AVERAGE
+    uint16_t blank_us;          // edge blanking, limits the highest measurable pulse rate
+} tach_config_t;
+
+/**
+ * \brief Fan tachometer.
+ */
+typedef struct tach_t {
+    uint32_t ring[TACH_RING_SIZE] __attribute__((aligned(TACH_RING_SIZE * sizeof(uint32_t))));  // raw edge timestamps
+    PIO pio;
+    uint8_t pio_program_offset;
+    uint8_t sm;
+    uint8_t dma_chan;
+    uint8_t pin;
+    tach_config_t config;
+    uint32_t head;              // ring index the next edge goes to
+    uint32_t count;             // edges seen
+    uint32_t run_edges;         // edges since the fan was last stalled, up to TACH_RING_SIZE
+    uint32_t period_us;         // median pulse period, 0 while stalled
+    uint8_t quiet_checks;       // checks in a row without a new edge
+    volatile uint32_t rpm;
+    volatile bool stalled;
+    absolute_time_t next_check;
+} tach_t;
+
+/**
+ * \brief Default settings: 2 pulses per revolution, 8 periods averaged, 300 us blanking.
+ */
+tach_config_t tach_default_config(void);
+
+/**
+ * \brief Initialize tachometer and start measuring.
+ *
+ * The library claims one state machine from the given PIO instance and one DMA
+ * channel. The first tach claims the shared alarm from the given pool, so every
+ * estimate is updated on the core that owns that pool; later tachs must pass the
+ * same pool. Initialize and deinitialize tachs on that core.
+ *
+ * \param tach Tachometer.
+ * \param pio PIO block to use (pio0 or pio1).
+ * \param pin Tach input pin. The internal pull-up is enabled.
+ * \param config Settings.
+ * \param pool Alarm pool for the shared update alarm, NULL for the default pool.
+ */
+void tach_init(tach_t *tach, PIO pio, uint8_t pin, const tach_config_t *config, alarm_pool_t *pool);
+
+/**
+ * \brief Stop measuring and release the state machine and DMA channel.
+ *
+ * \param tach Tachometer.
+ */
+void tach_deinit(tach_t *tach);
+
+/**
+ * \brief Get the raw edge count.
+ *
+ * \param tach Tachometer.
+ * \return Falling edges seen since init, as of the last update, wrapping at 2^32.
+ */
+static inline uint32_t tach_get_count(const tach_t *tach) {
+    return tach->count;
+}
+
+/**
+ * \brief Get the fan speed.
+ *
+ * \param tach Tachometer.
+ * \return Revolutions per minute, 0 when the fan is stalled.
+ */
+static inline uint32_t tach_get_rpm(const tach_t *tach) {
+    return tach->rpm;
+}
+
+/**
+ * \brief Whether the tach has stopped pulsing.
+ *
+ * True from init until the first pulse period is measured, and again once an
+ * expected pulse is overdue. Whether that is a fault depends on the duty the
+ * fan is driven with.
+ */
+static inline bool tach_is_stalled(const tach_t *tach) {
+    return tach->stalled;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TACH_H_
@@ -0,0 +1,231 @@
+#include <tach.h>
+#include <tach.pio.h>
+#include <hardware/clocks.h>
+#include <hardware/dma.h>
+#include <hardware/gpio.h>
+#include <pico/stdlib.h>
+#include <string.h>
+
+static const uint TICK_FREQUENCY = 1000000;     // 1 us timestamps, two PIO cycles per tick
+static const uint32_t LOST_TICKS = 2;           // per period, see tach.pio
+static const uint32_t IDLE_CHECK_US = 20000;    // update rate while no period is known
+static const uint32_t MIN_CHECK_US = 1000;
+static const uint8_t STALL_CHECKS = 3;          // half periods without an edge: 1.5 periods
+static const uint32_t MAX_PERIOD_US = 200000;   // slowest measurable pulse, 150 RPM at 2 pulses per rev
+
+#define RING_MASK (TACH_RING_SIZE - 1)
+
+// every tach, updated by one shared alarm on the pool of the first
+static tach_t *tach_by_sm[NUM_PIOS][NUM_PIO_STATE_MACHINES];
+static uint8_t tach_count;
+static alarm_pool_t *dispatch_pool;
+static alarm_id_t dispatch_alarm;
+
+// tachs on the same PIO block share a copy of the program
+static uint8_t tach_program_offset[NUM_PIOS];
+static uint8_t tach_program_users[NUM_PIOS];
+
+static void tach_program_init(PIO pio, uint sm, uint offset, uint pin, uint32_t blank_ticks) {
+    pio_sm_config c = tach_program_get_default_config(offset);
+    uint32_t sys_clock_frequency = clock_get_hz(clk_sys);
+    sm_config_set_clkdiv(&c, sys_clock_frequency / (2.0f * TICK_FREQUENCY));
+    // configuring jmp pin is enough, we don't need any other input pins
+    sm_config_set_jmp_pin(&c, pin);
+    sm_config_set_in_shift(&c, false /* shift_right */, true /* autopush */, 32 /* push_threshold */);
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX);
+    // start in the low state, so a pin that is already low isn't taken for an edge
+    pio_sm_init(pio, sm, offset + tach_offset_low, &c);
+    pio_sm_set_consecutive_pindirs(pio, sm, pin, 1, false /* is_out */);
+
+    // the blanking length stays in OSR
+    pio_sm_put(pio, sm, blank_ticks);
+    pio_sm_exec(pio, sm, pio_encode_pull(/* if_empty */ false, /* block */ true));
+    pio_sm_set_enabled(pio, sm, true);
+}
+
+static void configure_dma_channel(uint chan, PIO pio, uint sm, uint32_t *ring) {
+    dma_channel_config c = dma_channel_get_default_config(chan);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, false /* is_tx */));
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    // the write address wraps within the ring
+    channel_config_set_ring(&c, true /* write */, __builtin_ctz(TACH_RING_SIZE * sizeof(uint32_t)));
+    // all ones: endless on RP2350, years of edges on RP2040
+    dma_channel_configure(chan, &c, ring, &pio->rxf[sm], 0xFFFFFFFF, true /* trigger */);
+}
+
+// Ring index DMA writes the next edge to
+static uint32_t ring_head(const tach_t *tach) {
+    uintptr_t write_addr = dma_channel_hw_addr(tach->dma_chan)->write_addr;
+    return ((write_addr - (uintptr_t)tach->ring) / sizeof(uint32_t)) & RING_MASK;
+}
+
+// Mean of the last periods, leaving out those more than 25 % off their median
+static void tach_estimate(tach_t *tach) {
+    uint n = tach->run_edges - 1;
+    if (n > tach->config.average_pulses)    n = tach->config.average_pulses;
+
+    uint32_t periods[TACH_MAX_AVERAGE];
+    uint32_t sorted[TACH_MAX_AVERAGE] = {0};
+    uint32_t newer = tach->ring[(tach->head - 1) & RING_MASK];
+    for (uint i = 0; i < n; i++) {
+        // X counts down, older timestamps are larger
+        uint32_t older = tach->ring[(tach->head - 2 - i) & RING_MASK];
+        periods[i] = older - newer + LOST_TICKS;
+        newer = older;
+        // insertion sort, n is small
+        uint j = i;
+        for (; j > 0 && sorted[j - 1] > periods[i]; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = periods[i];
+    }
+    uint32_t median = sorted[n / 2];
+
+    uint32_t sum = 0;
+    uint used = 0;
+    for (uint i = 0; i < n; i++) {
+        if (periods[i] >= median - median / 4 && periods[i] <= median + median / 4) {
+            sum += periods[i];
+            used++;
+        }
+    }
+    uint32_t per_minute = 60u * TICK_FREQUENCY / tach->config.pulses_per_rev;
+    tach->period_us = median;
+    tach->rpm = (per_minute * used + sum / 2) / sum;
+    tach->stalled = false;
+}
+
+// Update one tach from its new edges, returning the delay to its next check
+static uint32_t tach_check(tach_t *tach) {
+    uint32_t head = ring_head(tach);
+    uint32_t edges = (head - tach->head) & RING_MASK;
+    tach->head = head;
+    tach->count += edges;
+
+    if (edges > 0) {
+        tach->quiet_checks = 0;
+        tach->run_edges += edges;
+        if (tach->run_edges > TACH_RING_SIZE)   tach->run_edges = TACH_RING_SIZE;
+        if (tach->run_edges >= 2) {
+            tach_estimate(tach);
+        }
+    } else if (tach->run_edges > 0) {
+        // after a lone edge there is no period to expect, allow the slowest one
+        uint limit = tach->period_us != 0 ? STALL_CHECKS : MAX_PERIOD_US / IDLE_CHECK_US;
+        if (++tach->quiet_checks >= limit) {
+            // an expected pulse is overdue, older edges no longer describe the fan
+            tach->rpm = 0;
+            tach->period_us = 0;
+            tach->run_edges = 0;
+            tach->stalled = true;
+        }
+    }
+
+    // half a period apart, so a missing pulse shows within one period
+    if (tach->period_us == 0) {
+        return IDLE_CHECK_US;
+    }
+    return tach->period_us / 2 > MIN_CHECK_US ? tach->period_us / 2 : MIN_CHECK_US;
+}
+
+// The one alarm behind every tach: checks those that are due, then sleeps
+// until the earliest next check
+static int64_t dispatch_alarm_callback(alarm_id_t id, void *user_data) {
+    absolute_time_t now = get_absolute_time();
+    // a tach added meanwhile is first checked within IDLE_CHECK_US
+    int64_t next_us = IDLE_CHECK_US;
+    for (uint p = 0; p < NUM_PIOS; p++) {
+        for (uint sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++) {
+            tach_t *tach = tach_by_sm[p][sm];
+            if (tach == NULL) {
+                continue;
+            }
+            if (absolute_time_diff_us(now, tach->next_check) <= 0) {
+                tach->next_check = delayed_by_us(now, tach_check(tach));
+            }
+            int64_t until_us = absolute_time_diff_us(now, tach->next_check);
+            if (until_us < next_us)     next_us = until_us;
+        }
+    }
+    return next_us > MIN_CHECK_US ? next_us : MIN_CHECK_US;
+}
+
+// Register an initialized tach with the dispatcher, starting it with the first
+static void dispatch_add(tach_t *tach, alarm_pool_t *pool) {
+    pool = pool ? pool : alarm_pool_get_default();
+    assert(dispatch_pool == NULL || dispatch_pool == pool); // all tachs update on one core
+    tach->next_check = make_timeout_time_us(IDLE_CHECK_US);
+    tach_by_sm[pio_get_index(tach->pio)][tach->sm] = tach;
+    if (tach_count++ == 0) {
+        dispatch_pool = pool;
+        dispatch_alarm = alarm_pool_add_alarm_in_us(pool, IDLE_CHECK_US, dispatch_alarm_callback, NULL, true);
+    }
+}
+
+static void dispatch_remove(tach_t *tach) {
+    tach_by_sm[pio_get_index(tach->pio)][tach->sm] = NULL;
+    if (--tach_count == 0) {
+        alarm_pool_cancel_alarm(dispatch_pool, dispatch_alarm);
+        dispatch_pool = NULL;
+    }
+}
+
+//
+// public interface
+//
+
+tach_config_t tach_default_config(void) {
+    tach_config_t config = {
+        .pulses_per_rev = 2,
+        .average_pulses = 8,
+        .blank_us = 300,
+    };
+    return config;
+}
+
+void tach_init(tach_t *tach, PIO pio, uint8_t pin, const tach_config_t *config, alarm_pool_t *pool) {
+    assert(pio == pio0 || pio == pio1);
+    assert(config->pulses_per_rev > 0);
+    assert(config->average_pulses > 0 && config->average_pulses <= TACH_MAX_AVERAGE);
+
+    memset(tach, 0, sizeof(tach_t));
+    tach->pio = pio;
+    uint pio_index = pio_get_index(pio);
+    if (tach_program_users[pio_index]++ == 0) {
+        tach_program_offset[pio_index] = pio_add_program(pio, &tach_program);
+    }
+    tach->pio_program_offset = tach_program_offset[pio_index];
+    tach->sm = pio_claim_unused_sm(pio, true /* required */);
+    tach->dma_chan = dma_claim_unused_channel(true /* required */);
+    tach->pin = pin;
+    tach->config = *config;
+    tach->stalled = true;
+
+    pio_gpio_init(pio, pin);
+    gpio_pull_up(pin);
+    configure_dma_channel(tach->dma_chan, pio, tach->sm, tach->ring);
+    tach->head = ring_head(tach);
+    // one blanking loop iteration per tick, and a tick is 1 us
+    tach_program_init(pio, tach->sm, tach->pio_program_offset, pin, config->blank_us);
+
+    dispatch_add(tach, pool);
+}
+
+void tach_deinit(tach_t *tach) {
+    assert(tach->pio != NULL); // not initialized
+
+    dispatch_remove(tach);
+    pio_sm_set_enabled(tach->pio, tach->sm, false);
+    dma_channel_abort(tach->dma_chan);
+    dma_channel_unclaim(tach->dma_chan);
+    pio_sm_unclaim(tach->pio, tach->sm);
+    if (--tach_program_users[pio_get_index(tach->pio)] == 0) {
+        pio_remove_program(tach->pio, &tach_program, tach->pio_program_offset);
+    }
+
+    tach->rpm = 0;
+    tach->stalled = true;
+    tach->pio = NULL;
+}
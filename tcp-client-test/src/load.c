@@ -0,0 +1,473 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "types/index.h"
+
+// Load generator: many connections, a weighted command mix, open-loop pacing
+// at a target rate (or closed-loop as fast as replies come back), optional
+// pipelining, and latency percentiles per command.
+
+#define MAX_CONNECTIONS 256
+#define MAX_DEPTH 16
+#define MAX_MIX 16
+#define DRAIN_US 2000000            // wait for outstanding replies after the run
+
+// log-linear buckets: exact below 32 us, then 16 per power of two (< 6 % error)
+#define HIST_SUB 16
+#define HIST_BUCKETS (34 * HIST_SUB)
+
+typedef struct {
+    uint64_t bucket[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t max_us;
+} latency_hist_t;
+
+typedef struct {
+    char cmd[BUFFER_SIZE];
+    int weight;
+    int commands;               // ';'-separated commands, one blank line each in text replies
+    latency_hist_t hist;
+} mix_entry_t;
+
+typedef struct {
+    uint64_t scheduled_us;      // latency is measured from here, not from the send
+    int entry;
+    uint16_t id;
+} pending_t;
+
+typedef struct {
+    int sock;                   // -1 once closed
+    pending_t pending[MAX_DEPTH];
+    int head;                   // oldest request in flight
+    int in_flight;
+    int blank_lines;            // text: terminators still expected for the oldest request
+    int after_newline;          // text: last byte seen was '\n'
+    uint8_t rx[BUFFER_SIZE * 2];
+    size_t rx_len;
+    uint8_t tx[BUFFER_SIZE * 2];
+    size_t tx_len;
+} load_conn_t;
+
+static mix_entry_t mix[MAX_MIX];
+static int mix_len;
+static int mix_weight;
+static load_conn_t conns[MAX_CONNECTIONS];
+static latency_hist_t total_hist;
+static uint64_t sent, completed, errors, late;
+
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+
+static int hist_bucket(uint64_t us) {
+    if (us < 2 * HIST_SUB) {
+        return us;
+    }
+    int shift = 63 - __builtin_clzll(us) - 4;
+    int b = shift * HIST_SUB + (int)(us >> shift);
+    return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;
+}
+
+
+// Midpoint of a bucket's range
+static double hist_value_us(int b) {
+    if (b < 2 * HIST_SUB) {
+        return b;
+    }
+    int shift = b / HIST_SUB - 1;
+    uint64_t low = (uint64_t)(b % HIST_SUB + HIST_SUB) << shift;
+    return low + ((1ull << shift) - 1) / 2.0;
+}
+
+
+static void hist_record(latency_hist_t *hist, uint64_t us) {
+    hist->bucket[hist_bucket(us)]++;
+    hist->count++;
+    if (us > hist->max_us) {
+        hist->max_us = us;
+    }
+}
+
+
+static double hist_percentile_ms(const latency_hist_t *hist, double p) {
+    uint64_t rank = (uint64_t)(p * hist->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += hist->bucket[b];
+        if (seen >= rank) {
+            double us = hist_value_us(b);
+            return (us < hist->max_us ? us : hist->max_us) / 1000.0;
+        }
+    }
+    return hist->max_us / 1000.0;
+}
+
+
+static void print_percentiles(const char *name, const latency_hist_t *hist) {
+    if (hist->count == 0) {
+        printf("%-24.24s %8d\n", name, 0);
+        return;
+    }
+    printf("%-24.24s %8llu %8.2f %8.2f %8.2f %8.2f\n", name, (unsigned long long)hist->count,
+           hist_percentile_ms(hist, 0.50), hist_percentile_ms(hist, 0.90), hist_percentile_ms(hist, 0.99),
+           hist->max_us / 1000.0);
+}
+
+
+// One row per power of two of milliseconds
+static void print_histogram(const latency_hist_t *hist) {
+    uint64_t rows[24] = {0};
+    uint64_t most = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        double ms = hist_value_us(b) / 1000.0;
+        int row = 0;
+        while (row < 23 && ms >= (1 << row) / 4.0) {
+            row++;
+        }
+        rows[row] += hist->bucket[b];
+    }
+    for (int row = 0; row < 24; row++) {
+        if (rows[row] > most)   most = rows[row];
+    }
+    int first = 0, last = 23;
+    while (first < last && rows[first] == 0)    first++;
+    while (last > first && rows[last] == 0)     last--;
+    for (int row = first; row <= last; row++) {
+        int bar = most ? (int)(rows[row] * 40 / most) : 0;
+        printf("  < %8.2f ms %10llu |%.*s\n", (1 << row) / 4.0, (unsigned long long)rows[row], bar,
+               "########################################");
+    }
+}
+
+
+// "cmd*weight,cmd,..."; a command may itself be a ';' batch
+static int parse_mix(const char *spec) {
+    mix_len = 0;
+    mix_weight = 0;
+    while (*spec != '\0') {
+        if (mix_len == MAX_MIX) {
+            fprintf(stderr, "At most %d commands in a mix\n", MAX_MIX);
+            return -1;
+        }
+        mix_entry_t *entry = &mix[mix_len];
+        size_t len = strcspn(spec, ",");
+        const char *star = memchr(spec, '*', len);
+        size_t cmd_len = star ? (size_t)(star - spec) : len;
+        if (cmd_len == 0 || cmd_len >= sizeof(entry->cmd)) {
+            fprintf(stderr, "Bad command in mix\n");
+            return -1;
+        }
+        memset(entry, 0, sizeof(*entry));
+        memcpy(entry->cmd, spec, cmd_len);
+        entry->weight = star ? atoi(star + 1) : 1;
+        if (entry->weight <= 0) {
+            fprintf(stderr, "Bad weight for %s\n", entry->cmd);
+            return -1;
+        }
+        // the reply of a streaming command has no end to wait for
+        entry->commands = 1;
+        for (const char *p = entry->cmd; ; p++) {
+            p += strspn(p, "; ");
+            if (strncmp(p, "history", 7) == 0 || strncmp(p, "subscribe", 9) == 0) {
+                fprintf(stderr, "history and subscribe can't be part of a load mix\n");
+                return -1;
+            }
+            if ((p = strchr(p, ';')) == NULL)   break;
+            if (p[strspn(p, "; ")] != '\0')     entry->commands++;
+        }
+        mix_weight += entry->weight;
+        mix_len++;
+        spec += len;
+        if (*spec == ',')   spec++;
+    }
+    return mix_len > 0 ? 0 : -1;
+}
+
+
+static void close_conn(load_conn_t *c) {
+    if (c->sock >= 0) {
+        close(c->sock);
+        c->sock = -1;
+    }
+    // whatever was in flight is lost
+    errors += c->in_flight;
+    c->in_flight = 0;
+}
+
+
+static int open_conn(load_conn_t *c, const struct sockaddr_in *addr) {
+    memset(c, 0, sizeof(*c));
+    c->sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->sock < 0) {
+        return -1;
+    }
+    if (connect(c->sock, (const struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        close(c->sock);
+        c->sock = -1;
+        return -1;
+    }
+    fcntl(c->sock, F_SETFL, fcntl(c->sock, F_GETFL) | O_NONBLOCK);
+    return 0;
+}
+
+
+static void flush_tx(load_conn_t *c) {
+    while (c->tx_len > 0) {
+        ssize_t n = send(c->sock, c->tx, c->tx_len, 0);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)    close_conn(c);
+            return;
+        }
+        memmove(c->tx, c->tx + n, c->tx_len - n);
+        c->tx_len -= n;
+    }
+}
+
+
+// Queue one request from the mix; -1 if the connection's send buffer is full
+static int issue(load_conn_t *c, int binary, uint64_t scheduled_us) {
+    int r = rand() % mix_weight;
+    int e = 0;
+    while (r >= mix[e].weight) {
+        r -= mix[e].weight;
+        e++;
+    }
+    const char *cmd = mix[e].cmd;
+    size_t len = strlen(cmd);
+    if (c->tx_len + PROTOCOL_HEADER_SIZE + len + 1 > sizeof(c->tx)) {
+        return -1;
+    }
+
+    pending_t *p = &c->pending[(c->head + c->in_flight) % MAX_DEPTH];
+    p->scheduled_us = scheduled_us;
+    p->entry = e;
+    p->id = (uint16_t)sent;
+    if (c->in_flight == 0) {
+        c->blank_lines = mix[e].commands;
+    }
+    c->in_flight++;
+    sent++;
+
+    uint8_t *out = c->tx + c->tx_len;
+    if (binary) {
+        out[0] = PROTOCOL_MAGIC;
+        out[1] = 0;
+        out[2] = p->id & 0xFF;
+        out[3] = p->id >> 8;
+        out[4] = len & 0xFF;
+        out[5] = len >> 8;
+        memcpy(out + PROTOCOL_HEADER_SIZE, cmd, len);
+        c->tx_len += PROTOCOL_HEADER_SIZE + len;
+    } else {
+        memcpy(out, cmd, len);
+        out[len] = '\n';
+        c->tx_len += len + 1;
+    }
+    flush_tx(c);
+    return 0;
+}
+
+
+static void complete(load_conn_t *c, uint64_t now) {
+    pending_t *p = &c->pending[c->head];
+    uint64_t us = now > p->scheduled_us ? now - p->scheduled_us : 0;
+    hist_record(&mix[p->entry].hist, us);
+    hist_record(&total_hist, us);
+    completed++;
+    c->head = (c->head + 1) % MAX_DEPTH;
+    c->in_flight--;
+    c->blank_lines = c->in_flight ? mix[c->pending[c->head].entry].commands : 0;
+}
+
+
+// Match the received bytes to the requests in flight, in order
+static void parse_rx(load_conn_t *c, int binary, uint64_t now) {
+    size_t pos = 0;
+    if (binary) {
+        while (c->rx_len - pos >= PROTOCOL_HEADER_SIZE) {
+            const uint8_t *h = c->rx + pos;
+            size_t frame_len = PROTOCOL_HEADER_SIZE + (h[4] | (h[5] << 8));
+            if (h[0] != PROTOCOL_MAGIC) {
+                fprintf(stderr, "Bad frame from server\n");
+                close_conn(c);
+                return;
+            }
+            if (c->rx_len - pos < frame_len) {
+                break;
+            }
+            uint16_t id = h[2] | (h[3] << 8);
+            if (!(h[1] & PROTOCOL_FLAG_MORE) && c->in_flight > 0) {
+                if (id != c->pending[c->head].id) {
+                    errors++;   // out of order
+                }
+                complete(c, now);
+            }
+            pos += frame_len;
+        }
+    } else {
+        for (; pos < c->rx_len; pos++) {
+            int newline = c->rx[pos] == '\n';
+            if (newline && c->after_newline && c->in_flight > 0 && --c->blank_lines == 0) {
+                complete(c, now);
+            }
+            c->after_newline = newline;
+        }
+    }
+    memmove(c->rx, c->rx + pos, c->rx_len - pos);
+    c->rx_len -= pos;
+}
+
+
+static void receive(load_conn_t *c, int binary) {
+    for (;;) {
+        if (c->rx_len == sizeof(c->rx)) {
+            fprintf(stderr, "Reply too long\n");
+            close_conn(c);
+            return;
+        }
+        ssize_t n = recv(c->sock, c->rx + c->rx_len, sizeof(c->rx) - c->rx_len, 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            close_conn(c);
+            return;
+        } else if (n < 0) {
+            return;
+        }
+        c->rx_len += n;
+        parse_rx(c, binary, now_us());
+        if (c->sock < 0)    return;
+    }
+}
+
+
+int run_load(const char *server_ip, const load_options_t *opts) {
+    if (parse_mix(opts->mix) < 0) {
+        return -1;
+    }
+    if (opts->connections < 1 || opts->connections > MAX_CONNECTIONS || opts->depth < 1 || opts->depth > MAX_DEPTH) {
+        fprintf(stderr, "Connections must be 1-%d and depth 1-%d\n", MAX_CONNECTIONS, MAX_DEPTH);
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(SERVER_PORT);
+    if (inet_pton(AF_INET, server_ip, &addr.sin_addr) <= 0) {
+        fprintf(stderr, "Invalid address %s\n", server_ip);
+        return -1;
+    }
+
+    int connected = 0;
+    for (int i = 0; i < opts->connections; i++) {
+        if (open_conn(&conns[i], &addr) == 0) {
+            connected++;
+        }
+    }
+    if (connected == 0) {
+        perror("Connection failed");
+        return -1;
+    }
+    printf("Load: %d/%d connections to %s:%d, depth %d, %s, %d s, %s framing\n", connected, opts->connections,
+           server_ip, SERVER_PORT, opts->depth, opts->rate > 0 ? "paced" : "closed loop", opts->duration_s,
+           opts->binary ? "binary" : "text");
+    if (opts->rate > 0) {
+        printf("Target rate %d req/s\n", opts->rate);
+    }
+
+    srand(1);
+    uint64_t start = now_us();
+    uint64_t end = start + (uint64_t)opts->duration_s * 1000000;
+    uint64_t interval = opts->rate > 0 ? 1000000 / opts->rate : 0;
+    uint64_t next_send = start;
+    int rr = 0;
+    struct pollfd fds[MAX_CONNECTIONS];
+
+    for (;;) {
+        uint64_t now = now_us();
+        int in_flight = 0, alive = 0;
+        for (int i = 0; i < opts->connections; i++) {
+            in_flight += conns[i].in_flight;
+            alive += conns[i].sock >= 0;
+        }
+        if (alive == 0 || (now >= end && (in_flight == 0 || now >= end + DRAIN_US))) {
+            break;
+        }
+
+        if (now < end && interval > 0) {
+            // open loop: every release is due at its own time, a request
+            // that has to wait for a free slot is late and its wait counts
+            while (next_send <= now) {
+                int i, tried;
+                for (tried = 0, i = rr; tried < opts->connections; tried++, i = (i + 1) % opts->connections) {
+                    if (conns[i].sock >= 0 && conns[i].in_flight < opts->depth)     break;
+                }
+                if (tried == opts->connections || issue(&conns[i], opts->binary, next_send) < 0) {
+                    late++;
+                    break;
+                }
+                rr = (i + 1) % opts->connections;
+                next_send += interval;
+            }
+        } else if (now < end) {
+            for (int i = 0; i < opts->connections; i++) {
+                while (conns[i].sock >= 0 && conns[i].in_flight < opts->depth &&
+                       issue(&conns[i], opts->binary, now) == 0) {}
+            }
+        }
+
+        for (int i = 0; i < opts->connections; i++) {
+            fds[i].fd = conns[i].sock;
+            fds[i].events = POLLIN | (conns[i].tx_len > 0 ? POLLOUT : 0);
+            fds[i].revents = 0;
+        }
+        int timeout_ms = 100;
+        if (interval > 0 && now < end && next_send > now) {
+            timeout_ms = (next_send - now + 999) / 1000;
+        }
+        if (poll(fds, opts->connections, timeout_ms) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        for (int i = 0; i < opts->connections; i++) {
+            if (conns[i].sock < 0 || fds[i].revents == 0) {
+                continue;
+            }
+            if (fds[i].revents & POLLOUT) {
+                flush_tx(&conns[i]);
+            }
+            if (conns[i].sock >= 0 && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                receive(&conns[i], opts->binary);
+            }
+        }
+    }
+
+    double elapsed = (now_us() - start) / 1e6;
+    for (int i = 0; i < opts->connections; i++) {
+        close_conn(&conns[i]);
+    }
+    printf("Sent %llu, completed %llu, errors %llu, late %llu in %.1f s\n", (unsigned long long)sent,
+           (unsigned long long)completed, (unsigned long long)errors, (unsigned long long)late, elapsed);
+    printf("Throughput: %.1f req/s\n\n", completed / elapsed);
+    printf("%-24s %8s %8s %8s %8s %8s\n", "latency (ms)", "count", "p50", "p90", "p99", "max");
+    for (int e = 0; e < mix_len; e++) {
+        print_percentiles(mix[e].cmd, &mix[e].hist);
+    }
+    if (mix_len > 1) {
+        print_percentiles("all", &total_hist);
+    }
+    printf("\n");
+    print_histogram(&total_hist);
+    return 0;
+}
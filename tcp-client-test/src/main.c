@@ -5,19 +5,280 @@
 #include <unistd.h>
 #include "types/index.h"
 
-#define SERVER_PORT 4242
-#define BUFFER_SIZE 1460
 
-int main() {
-    int sock;
+// Send one command, as a text line or as a binary frame
+int send_request(client_conn_t *conn, const char *cmd) {
+    uint8_t frame[PROTOCOL_HEADER_SIZE + BUFFER_SIZE];
+    size_t len = strcspn(cmd, "\r\n");
+    if (len > BUFFER_SIZE - 1) {
+        len = BUFFER_SIZE - 1;
+    }
+
+    conn->frame_left = 0;
+    conn->last_frame = 0;
+    if (conn->binary) {
+        uint16_t id = conn->next_id++;
+        frame[0] = PROTOCOL_MAGIC;
+        frame[1] = 0;
+        frame[2] = id & 0xFF;
+        frame[3] = id >> 8;
+        frame[4] = len & 0xFF;
+        frame[5] = len >> 8;
+        memcpy(frame + PROTOCOL_HEADER_SIZE, cmd, len);
+        len += PROTOCOL_HEADER_SIZE;
+    } else {
+        memcpy(frame, cmd, len);
+        frame[len++] = '\n';
+    }
+    return send(conn->sock, frame, len, 0) == (ssize_t)len ? 0 : -1;
+}
+
+
+// Make sure at least want raw bytes are buffered
+static int fill(client_conn_t *conn, size_t want) {
+    if (conn->pos > 0) {
+        memmove(conn->buf, conn->buf + conn->pos, conn->len - conn->pos);
+        conn->len -= conn->pos;
+        conn->pos = 0;
+    }
+    while (conn->len < want) {
+        ssize_t n = recv(conn->sock, conn->buf + conn->len, sizeof(conn->buf) - conn->len, 0);
+        if (n <= 0) {
+            perror("Receive failed");
+            return -1;
+        }
+        conn->len += n;
+    }
+    return 0;
+}
+
+
+// Read reply payload bytes; returns 0 at the end of a binary reply, -1 on error.
+// Text replies have no framing, the caller spots their end.
+ssize_t read_payload(client_conn_t *conn, uint8_t *out, size_t size) {
+    if (conn->binary) {
+        while (conn->frame_left == 0) {
+            if (conn->last_frame) {
+                return 0;
+            }
+            if (fill(conn, PROTOCOL_HEADER_SIZE) < 0) {
+                return -1;
+            }
+            const uint8_t *h = conn->buf + conn->pos;
+            if (h[0] != PROTOCOL_MAGIC) {
+                fprintf(stderr, "Bad frame from server\n");
+                return -1;
+            }
+            conn->last_frame = !(h[1] & PROTOCOL_FLAG_MORE);
+            conn->frame_left = h[4] | (h[5] << 8);
+            conn->pos += PROTOCOL_HEADER_SIZE;
+        }
+    }
+    if (conn->pos == conn->len && fill(conn, 1) < 0) {
+        return -1;
+    }
+    size_t n = conn->len - conn->pos;
+    if (conn->binary && n > conn->frame_left) {
+        n = conn->frame_left;
+    }
+    if (n > size) {
+        n = size;
+    }
+    memcpy(out, conn->buf + conn->pos, n);
+    conn->pos += n;
+    if (conn->binary) {
+        conn->frame_left -= n;
+    }
+    return n;
+}
+
+
+// Print a reply; a text reply ends with one blank line per command of the request
+static int receive_reply(client_conn_t *conn, const char *label, int commands) {
+    char reply[BUFFER_SIZE * 2];
+    size_t len = 0;
+    while (len < sizeof(reply) - 1) {
+        ssize_t n = read_payload(conn, (uint8_t *)reply + len, sizeof(reply) - 1 - len);
+        if (n < 0) {
+            return -1;
+        } else if (n == 0) {
+            break;
+        }
+        for (size_t i = len > 0 ? len : 1; i < len + n; i++) {
+            if (reply[i - 1] == '\n' && reply[i] == '\n') {
+                commands--;
+            }
+        }
+        len += n;
+        if (!conn->binary && commands <= 0) {
+            break;
+        }
+    }
+    reply[len] = '\0';
+    printf("%s%s", label, reply);
+    return 0;
+}
+
+
+// Print subscription pushes until the connection drops
+static int receive_stream(client_conn_t *conn) {
+    if (receive_reply(conn, "Response from server:\n", 1) < 0) {
+        return -1;
+    }
+    for (;;) {
+        conn->last_frame = 0;   // every push frame is complete on its own
+        if (receive_reply(conn, "", 1) < 0) {
+            return -1;
+        }
+    }
+}
+
+
+// Read one varint; returns 1 on success, 0 if more bytes are needed, -1 if malformed
+static int get_varint(const uint8_t *buf, size_t len, size_t *pos, uint32_t *value) {
+    uint32_t v = 0;
+    for (size_t p = *pos, shift = 0; p < len && shift < 35; shift += 7) {
+        uint8_t b = buf[p++];
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *value = v;
+            *pos = p;
+            return 1;
+        }
+    }
+    return len - *pos >= 5 ? -1 : 0;
+}
+
+
+static int32_t unzigzag(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+
+// Decode a history export: a "history\n" header followed by delta + varint
+// records and a single 0 byte end marker (see history.h on the server side)
+static int receive_history(client_conn_t *conn) {
+    uint8_t buf[BUFFER_SIZE * 2];
+    size_t len = 0, pos = 0;
+    int header_done = 0;
+    uint32_t time_ms = 0, flags = 0;
+    int32_t temperature = 0, humidity = 0, rpm = 0, duty = 0;
+    size_t count = 0;
+
+    for (;;) {
+        // replies to earlier commands of a batched request come before the header
+        uint8_t *nl;
+        while (!header_done && (nl = memchr(buf + pos, '\n', len - pos)) != NULL) {
+            int line_len = nl - (buf + pos);
+            if (line_len == 7 && memcmp(buf + pos, "history", 7) == 0) {
+                printf("time_ms,temperature_c,humidity,rpm,duty,flags\n");
+                header_done = 1;
+            } else {
+                printf("%.*s\n", line_len, (const char *)buf + pos);
+            }
+            pos = nl - buf + 1;
+        }
+        while (header_done && pos < len) {
+            size_t p = pos;
+            uint32_t v[6];
+            int r = 1;
+            for (int i = 0; i < 6 && r == 1; i++) {
+                r = get_varint(buf, len, &p, &v[i]);
+                if (r == 1 && i == 0 && v[0] == 0) {
+                    printf("%zu samples\n", count);
+                    if (!conn->binary) {
+                        // nothing follows the end marker, don't wait for more
+                        return 0;
+                    }
+                    // consume the end of a binary reply
+                    uint8_t rest[16];
+                    while ((r = read_payload(conn, rest, sizeof(rest))) > 0) {}
+                    return r;   // end of stream
+                }
+            }
+            if (r < 0) {
+                fprintf(stderr, "Malformed history stream\n");
+                return -1;
+            } else if (r == 0) {
+                break;  // record split across segments
+            }
+            time_ms += v[0] - 1;
+            temperature += unzigzag(v[1]);
+            humidity += unzigzag(v[2]);
+            rpm += unzigzag(v[3]);
+            duty += unzigzag(v[4]);
+            flags = v[5];
+            printf("%u,%.1f,%.1f,%d,%d,%u\n", time_ms, temperature / 10.0, humidity / 10.0, rpm, duty, flags);
+            count++;
+            pos = p;
+        }
+
+        // keep the unparsed tail and read more
+        memmove(buf, buf + pos, len - pos);
+        len -= pos;
+        pos = 0;
+        ssize_t n = read_payload(conn, buf + len, sizeof(buf) - len);
+        if (n <= 0) {
+            fprintf(stderr, "History stream ended early\n");
+            return -1;
+        }
+        len += n;
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+    client_conn_t conn = {0};
     struct sockaddr_in server_addr;
-    uint8_t buffer[BUFFER_SIZE];
+    const char *server_ip = SERVER_IP;
 
     int on = 1;
+    int load = 0;
+    int telemetry = 0;
+    int duration_given = 0;
+    load_options_t load_opts = { .connections = 4, .depth = 1, .rate = 0, .duration_s = 10, .mix = "status" };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "bluc:p:r:d:m:")) != -1) {
+        switch (opt) {
+            case 'b': conn.binary = 1; break;
+            case 'l': load = 1; break;
+            case 'u': telemetry = 1; break;
+            case 'c': load_opts.connections = atoi(optarg); break;
+            case 'p': load_opts.depth = atoi(optarg); break;
+            case 'r': load_opts.rate = atoi(optarg); break;
+            case 'd': load_opts.duration_s = atoi(optarg); duration_given = 1; break;
+            case 'm': load_opts.mix = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-b] [-l [-c conns] [-p depth] [-r rate] [-d seconds] [-m mix]] [server_ip]\n"
+                                "       %s -u [-d seconds] [group]\n"
+                                "  -b  use binary length-prefixed framing\n"
+                                "  -l  load test instead of the interactive shell\n"
+                                "  -u  receive UDP telemetry from group (" TELEMETRY_GROUP ") instead\n"
+                                "  -c  connections (4)\n"
+                                "  -p  requests in flight per connection (1)\n"
+                                "  -r  requests per second over all connections (0: as fast as replies come)\n"
+                                "  -d  duration in seconds (10)\n"
+                                "  -m  command mix, e.g. \"status*8,setpoint 25;status*1\" (status)\n", argv[0], argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (telemetry) {
+        // until interrupted unless a duration is given
+        return run_telemetry(optind < argc ? argv[optind] : TELEMETRY_GROUP, duration_given ? load_opts.duration_s : 0) < 0
+            ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    if (optind < argc) {
+        server_ip = argv[optind];
+    }
+    if (load) {
+        load_opts.binary = conn.binary;
+        return run_load(server_ip, &load_opts) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
 
     // Create socket
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
+    conn.sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (conn.sock < 0) {
         perror("Socket creation failed");
         return EXIT_FAILURE;
     }
@@ -26,25 +287,27 @@ int main() {
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(SERVER_PORT);
-    if (inet_pton(AF_INET, SERVER_IP, &server_addr.sin_addr) <= 0) {
+    if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) <= 0) {
         perror("Invalid address/ Address not supported");
-        close(sock);
+        close(conn.sock);
         return EXIT_FAILURE;
     }
 
     // Connect to server
-    if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+    if (connect(conn.sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
         perror("Connection failed");
-        close(sock);
+        close(conn.sock);
         return EXIT_FAILURE;
     }
 
-    printf("Connected to server %s:%d\n", SERVER_IP, SERVER_PORT);
+    printf("Connected to server %s:%d (%s framing)\n", server_ip, SERVER_PORT, conn.binary ? "binary" : "text");
 
     while (on) {
         printf("\nType 'help' to get a list of commands or 'exit' to quit.\n >> ");
-        uint8_t sent_cmd[BUFFER_SIZE];
-        fgets(sent_cmd, BUFFER_SIZE, stdin);
+        char sent_cmd[BUFFER_SIZE];
+        if (fgets(sent_cmd, BUFFER_SIZE, stdin) == NULL) {
+            break;
+        }
 
         if (strncmp(sent_cmd, "exit", 4) == 0) {
             on = 0;
@@ -54,28 +317,47 @@ int main() {
             printf("help - Show this help message\n");
             printf("exit - Exit the program\n");
             printf("status - show system status\n");
-            printf("setpwm <value> - set PWM value (0-100 or -1 for default control)\n\n");
+            printf("setpwm <value> - set PWM value (0-100 or -1 for default control)\n");
+            printf("history [from_ms] [to_ms] - dump stored samples as CSV\n");
+            printf("subscribe <interval_ms> [fields] - print pushed samples (temperature,humidity,rpm,duty; default all)\n");
+            printf("Several commands can be sent at once separated by ';', e.g. status;history\n\n");
             continue;
         } else {
             // Send request to server
-            send(sock, sent_cmd, BUFFER_SIZE, MSG_CONFIRM);
+            if (send_request(&conn, sent_cmd) < 0) {
+                perror("Send failed");
+                close(conn.sock);
+                return EXIT_FAILURE;
+            }
             printf("\nRequest sent: %s\n", sent_cmd);
         }
 
-        // Receive response from server
-        memset(buffer, 0, BUFFER_SIZE);
-        ssize_t bytes_received = recv(sock, buffer, BUFFER_SIZE-1, 0);
-        if (bytes_received < 0) {
-            perror("Receive failed");
-            close(sock);
-            return EXIT_FAILURE;
+        // commands may be batched with ';', the last one decides how the reply ends
+        const char *last_cmd = sent_cmd;
+        int commands = 1;
+        for (const char *p = sent_cmd; (p = strchr(p, ';')) != NULL; p++) {
+            p += strspn(p, "; ");
+            if (*p != '\0' && *p != '\n' && *p != '\r') {
+                last_cmd = p;
+                commands++;
+            }
+        }
+
+        int result;
+        if (strncmp(last_cmd, "history", 7) == 0) {
+            result = receive_history(&conn);
+        } else if (strncmp(last_cmd, "subscribe", 9) == 0) {
+            result = receive_stream(&conn);
         } else {
-            buffer[bytes_received] = '\0'; // Null-terminate the received data
-            printf("Response from server: %s", buffer);
+            result = receive_reply(&conn, "Response from server:\n", commands);
+        }
+        if (result < 0) {
+            close(conn.sock);
+            return EXIT_FAILURE;
         }
     }
 
     // Close the socket
-    close(sock);
+    close(conn.sock);
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,154 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "types/index.h"
+
+// Telemetry receiver: prints each datagram the board publishes (see
+// telemetry.h on the server side) and counts gaps in the sequence numbers.
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return p[0] | (uint16_t)p[1] << 8;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return get_u16(p) | (uint32_t)get_u16(p + 2) << 16;
+}
+
+// tenths as "-12.3"
+static const char *tenths(char *buf, size_t size, int value) {
+    snprintf(buf, size, "%s%d.%d", value < 0 ? "-" : "", (value < 0 ? -value : value) / 10,
+             (value < 0 ? -value : value) % 10);
+    return buf;
+}
+
+static void print_datagram(const uint8_t *buf, size_t len, uint32_t seq) {
+    char a[16], b[16];
+    if (len < TELEMETRY_HEADER_SIZE + 3) {
+        printf("#%u: truncated\n", seq);
+        return;
+    }
+    uint32_t time_ms = get_u32(buf + 6);
+    uint8_t sensors = buf[10], fans = buf[11], zones = buf[12];
+    if (len != TELEMETRY_HEADER_SIZE + 3 + sensors * 6u + fans * 3u + zones * 6u) {
+        printf("#%u: bad length %zu\n", seq, len);
+        return;
+    }
+    const uint8_t *p = buf + TELEMETRY_HEADER_SIZE + 3;
+    printf("#%u at %u ms\n", seq, time_ms);
+    for (uint8_t i = 0; i < sensors; i++, p += 6) {
+        uint16_t age = get_u16(p + 4);
+        if (age == 0xFFFF) {
+            printf("  sensor %u: no reading\n", i);
+        } else {
+            char c[16];
+            printf("  sensor %u: %s C, %s %%, read %s s ago\n", i, tenths(a, sizeof(a), (int16_t)get_u16(p)),
+                   tenths(b, sizeof(b), get_u16(p + 2)), tenths(c, sizeof(c), age));
+        }
+    }
+    for (uint8_t i = 0; i < fans; i++, p += 3) {
+        printf("  fan %u: %u RPM%s\n", i, get_u16(p), p[2] & TELEMETRY_FAN_STALLED ? " (stalled)" : "");
+    }
+    for (uint8_t i = 0; i < zones; i++, p += 6) {
+        int16_t temperature = (int16_t)get_u16(p);
+        printf("  zone %u: %s%s, setpoint %s C, duty %u %% (%s)\n", i,
+               temperature == INT16_MIN ? "no reading" : tenths(a, sizeof(a), temperature),
+               temperature == INT16_MIN ? "" : " C", tenths(b, sizeof(b), (int16_t)get_u16(p + 2)), p[4],
+               p[5] & TELEMETRY_ZONE_AUTO ? "auto" : "manual");
+    }
+}
+
+int run_telemetry(const char *group, int duration_s) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("Socket creation failed");
+        return -1;
+    }
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(TELEMETRY_PORT) };
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("Bind failed");
+        close(sock);
+        return -1;
+    }
+
+    // broadcasts arrive on the bound port as they are; a group must be joined
+    struct in_addr group_addr;
+    if (inet_pton(AF_INET, group, &group_addr) <= 0) {
+        fprintf(stderr, "Invalid group address %s\n", group);
+        close(sock);
+        return -1;
+    }
+    if (IN_MULTICAST(ntohl(group_addr.s_addr))) {
+        struct ip_mreq mreq = { .imr_multiaddr = group_addr, .imr_interface.s_addr = htonl(INADDR_ANY) };
+        if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            perror("Joining the group failed");
+            close(sock);
+            return -1;
+        }
+    }
+    printf("Listening for telemetry on %s:%d%s\n", group, TELEMETRY_PORT, duration_s > 0 ? "" : ", Ctrl-C to stop");
+
+    signal(SIGINT, on_signal);
+    time_t end = time(NULL) + duration_s;
+    uint64_t received = 0, lost = 0, late = 0, restarts = 0;
+    uint32_t next_seq = 0, last_time_ms = 0;
+    int started = 0;
+    while (!stop && (duration_s <= 0 || time(NULL) < end)) {
+        struct pollfd pfd = { .fd = sock, .events = POLLIN };
+        if (poll(&pfd, 1, 200) <= 0) {
+            continue;
+        }
+        uint8_t buf[TELEMETRY_MAX_SIZE];
+        ssize_t len = recv(sock, buf, sizeof(buf), 0);
+        if (len < TELEMETRY_HEADER_SIZE || buf[0] != TELEMETRY_MAGIC || buf[1] != TELEMETRY_VERSION) {
+            continue;   // not ours, or a format this receiver doesn't know
+        }
+        uint32_t seq = get_u32(buf + 2);
+        uint32_t time_ms = get_u32(buf + 6);
+        received++;
+        if (started && seq > next_seq) {
+            printf("-- %u lost\n", seq - next_seq);
+            lost += seq - next_seq;
+        } else if (started && seq < next_seq) {
+            // a late datagram is also older; a lower number with a newer time is a
+            // board that restarted (the log clock survives reboots, the numbering doesn't)
+            if (time_ms > last_time_ms || next_seq - seq > 1000) {
+                printf("-- sender restarted\n");
+                restarts++;
+            } else {
+                late++;
+                if (lost > 0)   lost--;     // counted as lost when the gap showed
+                printf("-- #%u out of order\n", seq);
+                print_datagram(buf, len, seq);
+                continue;
+            }
+        }
+        started = 1;
+        next_seq = seq + 1;
+        last_time_ms = time_ms;
+        print_datagram(buf, len, seq);
+    }
+    close(sock);
+
+    uint64_t expected = received + lost;
+    printf("\nReceived %llu, lost %llu (%.1f %%), out of order %llu, sender restarts %llu\n",
+           (unsigned long long)received, (unsigned long long)lost, expected ? 100.0 * lost / expected : 0.0,
+           (unsigned long long)late, (unsigned long long)restarts);
+    return 0;
+}
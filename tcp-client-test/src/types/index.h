@@ -1,17 +1,54 @@
 #ifndef TCP_CLIENT_TYPES_H
 #define TCP_CLIENT_TYPES_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 #define SERVER_IP "0.0.0.0"  // Replace with the actual server IP address
 #define SERVER_PORT 4242
+#define BUFFER_SIZE 1460
 
+// binary framing, see protocol.h on the server side
+#define PROTOCOL_MAGIC          0xB5
+#define PROTOCOL_HEADER_SIZE    6
+#define PROTOCOL_FLAG_MORE      0x01
+#define PROTOCOL_FLAG_PUSH      0x02
+
+// UDP telemetry, see telemetry.h on the server side
+#define TELEMETRY_GROUP         "239.255.42.42"
+#define TELEMETRY_PORT          4243
+#define TELEMETRY_MAGIC         0xB6
+#define TELEMETRY_VERSION       1
+#define TELEMETRY_HEADER_SIZE   10
+#define TELEMETRY_MAX_SIZE      256
+#define TELEMETRY_FAN_STALLED   0x01
+#define TELEMETRY_ZONE_AUTO     0x01
+
+typedef struct {
+    int sock;
+    int binary;                 // length-prefixed frames instead of text lines
+    uint16_t next_id;
+    uint8_t buf[BUFFER_SIZE * 2];   // raw bytes received, not yet consumed
+    size_t len;
+    size_t pos;
+    size_t frame_left;          // binary: payload bytes left in the current frame
+    int last_frame;             // binary: current frame ends the reply
+} client_conn_t;
+
+// load generator settings, see load.c
 typedef struct {
-    uint8_t *data;
-    size_t length;
-} tcp_message_t;
+    int binary;
+    int connections;
+    int depth;                  // requests in flight per connection
+    int rate;                   // requests per second over all connections, 0 for as fast as replies come
+    int duration_s;
+    const char *mix;            // "cmd*weight,cmd,..."
+} load_options_t;
 
-void send_message(int socket, tcp_message_t *message);
-tcp_message_t receive_message(int socket);
+int send_request(client_conn_t *conn, const char *cmd);
+ssize_t read_payload(client_conn_t *conn, uint8_t *out, size_t size);
+int run_load(const char *server_ip, const load_options_t *opts);
+int run_telemetry(const char *group, int duration_s);
 
-#endif // TCP_CLIENT_TYPES_H
\ No newline at end of file
+#endif // TCP_CLIENT_TYPES_H
@@ -0,0 +1,613 @@
+#include "tcp_server.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "pico/cyw43_arch.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+
+#include "format.h"
+#include "history.h"
+#include "perf.h"
+#include "protocol.h"
+
+#define DEBUG_printf printf
+#define BUF_SIZE 1460
+#define CMD_SIZE 512    // longest command accepted
+#define POLL_INTERVAL 2 // tcp_poll interval, in 500ms coarse timer ticks
+#define IDLE_POLLS (TCP_SERVER_IDLE_TIMEOUT_S * 2 / POLL_INTERVAL)
+#define TX_BUFS_PER_CONN 4  // transmit buffers one connection may hold, including those in flight
+#define TX_POOL_SIZE (TCP_SERVER_MAX_CONNECTIONS * TX_BUFS_PER_CONN)
+
+
+// Transmit buffer. Replies are framed in place and handed to lwIP by
+// reference, so a buffer stays out of the pool until its bytes are acked.
+typedef struct TX_BUF_T_ {
+    struct TX_BUF_T_ *next;     // pool free list, or the connection's unacked list
+    uint16_t unacked;           // bytes handed to tcp_write and not yet acked
+    uint8_t data[PROTOCOL_HEADER_SIZE + BUF_SIZE];  // one framed reply, or a batch of pushes
+} TX_BUF_T;
+
+
+struct TCP_CONN_T_ {
+    struct tcp_pcb *pcb;
+    TCP_CONN_T *next_free;      // pool free list link
+    bool closing;               // closed, waiting for lwIP to ack the buffers it still refers to
+    uint8_t buffer_recv[BUF_SIZE];
+    struct pbuf *recv_queue;    // received data not yet copied to buffer_recv, not yet acked
+    char cmd[CMD_SIZE];
+    uint8_t tx_held;            // transmit buffers taken from the pool
+    TX_BUF_T *tx_buf;           // buffer the next reply is built in
+    TX_BUF_T *unacked_head;     // written buffers, oldest first
+    TX_BUF_T *unacked_tail;
+    uint8_t *tx_data;           // framed reply in tx_buf not yet accepted by tcp_write
+    uint16_t tx_pending;
+    bool tx_more;               // more of the same stream follows, don't flush yet
+    uint16_t recv_len;
+    uint32_t skip_len;          // bytes of a rejected binary request still to drop
+    bool skip_line;             // drop through the end of a rejected text request
+    uint16_t idle_polls;
+    protocol_request_t request; // request being answered
+    bool history_active;        // history export streaming from the sent callback
+    history_encoder_t history;
+    uint8_t sub_fields;         // subscribed TCP_SERVER_FIELD_* mask, 0 if not subscribed
+    uint32_t sub_interval_ms;
+    uint32_t sub_last_ms;       // time of the last pushed sample
+    protocol_request_t sub_request;
+    TX_BUF_T *push_buf;         // framed pushes waiting for the send window
+    uint16_t push_len;
+};
+
+
+static TCP_SERVER_T server;
+static TCP_CONN_T conn_pool[TCP_SERVER_MAX_CONNECTIONS];
+static TCP_CONN_T *conn_free_list;
+static TX_BUF_T tx_pool[TX_POOL_SIZE];
+static TX_BUF_T *tx_free_list;
+
+
+// Take a transmit buffer; NULL once the connection holds its share
+static TX_BUF_T *tx_buf_alloc(TCP_CONN_T *conn) {
+    TX_BUF_T *buf = tx_free_list;
+    if (!buf || conn->tx_held >= TX_BUFS_PER_CONN) {
+        return NULL;
+    }
+    tx_free_list = buf->next;
+    buf->next = NULL;
+    buf->unacked = 0;
+    conn->tx_held++;
+    return buf;
+}
+
+
+static void tx_buf_free(TCP_CONN_T *conn, TX_BUF_T *buf) {
+    buf->next = tx_free_list;
+    tx_free_list = buf;
+    conn->tx_held--;
+}
+
+
+// Return the buffers lwIP is done with, oldest first
+static void tcp_server_retire(TCP_CONN_T *conn, u16_t len) {
+    while (len > 0 && conn->unacked_head) {
+        TX_BUF_T *buf = conn->unacked_head;
+        u16_t acked = len < buf->unacked ? len : buf->unacked;
+        buf->unacked -= acked;
+        len -= acked;
+        if (buf->unacked == 0) {
+            conn->unacked_head = buf->next;
+            tx_buf_free(conn, buf);
+        }
+    }
+    if (!conn->unacked_head) {
+        conn->unacked_tail = NULL;
+    }
+}
+
+
+static TCP_CONN_T *tcp_conn_alloc(void) {
+    TCP_CONN_T *conn = conn_free_list;
+    if (!conn) {
+        return NULL;
+    }
+    conn_free_list = conn->next_free;
+
+    // buffers are left as they are, only the parse and reply state is reset
+    conn->next_free = NULL;
+    conn->closing = false;
+    conn->recv_queue = NULL;
+    conn->tx_pending = 0;
+    conn->recv_len = 0;
+    conn->skip_len = 0;
+    conn->skip_line = false;
+    conn->idle_polls = 0;
+    conn->history_active = false;
+    conn->sub_fields = 0;
+    conn->push_len = 0;
+    return conn;
+}
+
+
+// Only once lwIP no longer refers to the connection's buffers: all acked, or the pcb is gone
+static void tcp_conn_free(TCP_CONN_T *conn) {
+    if (conn->recv_queue) {
+        pbuf_free(conn->recv_queue);
+        conn->recv_queue = NULL;
+    }
+    while (conn->unacked_head) {
+        TX_BUF_T *buf = conn->unacked_head;
+        conn->unacked_head = buf->next;
+        tx_buf_free(conn, buf);
+    }
+    conn->unacked_tail = NULL;
+    if (conn->tx_buf) {
+        tx_buf_free(conn, conn->tx_buf);
+        conn->tx_buf = NULL;
+    }
+    if (conn->push_buf) {
+        tx_buf_free(conn, conn->push_buf);
+        conn->push_buf = NULL;
+    }
+    conn->pcb = NULL;
+    conn->next_free = conn_free_list;
+    conn_free_list = conn;
+}
+
+
+static void tcp_conn_detach(TCP_CONN_T *conn) {
+    struct tcp_pcb *pcb = conn->pcb;
+    tcp_arg(pcb, NULL);
+    tcp_poll(pcb, NULL, 0);
+    tcp_sent(pcb, NULL);
+    tcp_recv(pcb, NULL);
+    tcp_err(pcb, NULL);
+}
+
+
+static err_t tcp_conn_close(TCP_CONN_T *conn) {
+    err_t err = ERR_OK;
+    struct tcp_pcb *pcb = conn->pcb;
+    conn->history_active = false;
+    conn->sub_fields = 0;
+    if (conn->unacked_head) {
+        // lwIP still sends from our buffers; keep the sent and err callbacks
+        // to learn when they are free again
+        tcp_poll(pcb, NULL, 0);
+        tcp_recv(pcb, NULL);
+    } else {
+        tcp_conn_detach(conn);
+    }
+    err = tcp_close(pcb);
+    if (err != ERR_OK) {
+        DEBUG_printf("close failed %d, calling abort\n", err);
+        tcp_conn_detach(conn);
+        tcp_abort(pcb);
+        err = ERR_ABRT;
+    } else if (conn->unacked_head) {
+        conn->closing = true;
+        return ERR_OK;
+    }
+    tcp_conn_free(conn);
+    return err;
+}
+
+
+// Hand len bytes of buf to lwIP without copying; returns false if lwIP has no room yet
+static bool tcp_server_write(TCP_CONN_T *conn, TX_BUF_T *buf, const uint8_t *data, u16_t len, bool more) {
+    // streamed data is coalesced with what follows, interactive replies go out with PSH
+    err_t err = tcp_write(conn->pcb, data, len, more ? TCP_WRITE_FLAG_MORE : 0);
+    if (err == ERR_MEM) {
+        return false;   // retried from tcp_server_sent or tcp_server_poll
+    } else if (err != ERR_OK) {
+        DEBUG_printf("Failed to write data %d\n", err);
+        tx_buf_free(conn, buf);
+        return true;
+    }
+    buf->unacked = len;
+    if (conn->unacked_tail) {
+        conn->unacked_tail->next = buf;
+    } else {
+        conn->unacked_head = buf;
+    }
+    conn->unacked_tail = buf;
+    return true;
+}
+
+
+// Hand the pending framed reply to lwIP; returns false if lwIP has no room for it yet
+static bool tcp_server_send_data(TCP_CONN_T *conn) {
+    if (conn->tx_pending == 0) {
+        return true;
+    }
+    PERF_BEGIN(send);
+    DEBUG_printf("Writing %u bytes to client\n", conn->tx_pending);
+
+    // this method is callback from lwIP, so cyw43_arch_lwip_begin is not required, however you
+    // can use this method to cause an assertion in debug mode, if this method is called when
+    // cyw43_arch_lwip_begin IS needed
+    cyw43_arch_lwip_check();
+    if (!tcp_server_write(conn, conn->tx_buf, conn->tx_data, conn->tx_pending, conn->tx_more)) {
+        PERF_END(PERF_TCP_SEND, send);
+        return false;
+    }
+    conn->tx_buf = NULL;
+    conn->tx_pending = 0;
+    if (!conn->tx_more) {
+        // answer now rather than on the next lwIP timer tick
+        tcp_output(conn->pcb);
+    }
+    PERF_END(PERF_TCP_SEND, send);
+    return true;
+}
+
+
+// Frame the len byte reply payload at tx_buf + PROTOCOL_HEADER_SIZE for sending
+static void tcp_server_queue_reply(TCP_CONN_T *conn, size_t len, uint8_t flags) {
+    conn->tx_data = protocol_frame(&conn->request, flags, conn->tx_buf->data, &len);
+    conn->tx_pending = len;
+    conn->tx_more = conn->history_active;
+}
+
+
+// Encode the next history chunk as send buffer space frees up; returns false to wait for tcp_server_sent
+static bool tcp_server_send_history(TCP_CONN_T *conn) {
+    u16_t space = tcp_sndbuf(conn->pcb);
+    if (space > sizeof(conn->tx_buf->data))     space = sizeof(conn->tx_buf->data);
+    if (space < PROTOCOL_HEADER_SIZE + HISTORY_RECORD_MAX_SIZE + 1)     return false;
+
+    uint8_t *payload = conn->tx_buf->data + PROTOCOL_HEADER_SIZE;
+    size_t len = history_encode(&conn->history, payload, space - PROTOCOL_HEADER_SIZE - 1);
+    if (history_encoder_done(&conn->history)) {
+        payload[len++] = 0;     // end of stream
+        conn->history_active = false;
+    }
+    tcp_server_queue_reply(conn, len, conn->history_active ? PROTOCOL_FLAG_MORE : 0);
+    return true;
+}
+
+
+// Send all batched pushes in one write once the send window has room for them
+static bool tcp_server_send_pushes(TCP_CONN_T *conn) {
+    if (conn->push_len == 0) {
+        return true;
+    }
+    if (tcp_sndbuf(conn->pcb) < conn->push_len) {
+        return false;
+    }
+    // pushes are streamed: they go out with the tcp_output() ending this round
+    if (!tcp_server_write(conn, conn->push_buf, conn->push_buf->data, conn->push_len, true)) {
+        return false;
+    }
+    conn->push_buf = NULL;
+    conn->push_len = 0;
+    return true;
+}
+
+
+static size_t append(char *buf, const char *str) {
+    size_t len = strlen(str);
+    memcpy(buf, str, len);
+    return len;
+}
+
+
+// Append one sample to the push batch in the subscription's framing
+static void tcp_server_queue_push(TCP_CONN_T *conn, const history_sample_t *sample) {
+    // runs for every sample and subscriber, so no printf: the longest line,
+    // all fields at their widest, is well under 96 bytes
+    char text[96];
+    size_t len = append(text, "sample ");
+    len += format_uint(text + len, sample->time_ms);
+    if (conn->sub_fields & TCP_SERVER_FIELD_TEMPERATURE) {
+        len += append(text + len, " temperature=");
+        len += format_tenths(text + len, sample->temperature);
+    }
+    if (conn->sub_fields & TCP_SERVER_FIELD_HUMIDITY) {
+        len += append(text + len, " humidity=");
+        len += format_tenths(text + len, sample->humidity);
+    }
+    if (conn->sub_fields & TCP_SERVER_FIELD_RPM) {
+        len += append(text + len, " rpm=");
+        len += format_uint(text + len, sample->rpm);
+    }
+    if (conn->sub_fields & TCP_SERVER_FIELD_DUTY) {
+        len += append(text + len, " duty=");
+        len += format_uint(text + len, sample->duty);
+    }
+    len += append(text + len, "\n\n");
+
+    if (!conn->push_buf && !(conn->push_buf = tx_buf_alloc(conn))) {
+        DEBUG_printf("No transmit buffer, dropping sample\n");
+        return;
+    }
+    if (conn->push_len + PROTOCOL_HEADER_SIZE + len > sizeof(conn->push_buf->data)) {
+        DEBUG_printf("Push buffer full, dropping sample\n");
+        return;
+    }
+    uint8_t *frame = conn->push_buf->data + conn->push_len;
+    memcpy(frame + PROTOCOL_HEADER_SIZE, text, len);
+    uint8_t *start = protocol_frame(&conn->sub_request, PROTOCOL_FLAG_PUSH, frame, &len);
+    memmove(frame, start, len);
+    conn->push_len += len;
+}
+
+
+// Top up buffer_recv from the queued pbufs, acking only what was taken so the
+// receive window stays closed while requests are backed up
+static void tcp_server_fill_recv(TCP_CONN_T *conn) {
+    if (conn->recv_queue == NULL) {
+        return;
+    }
+    u16_t len = conn->recv_queue->tot_len;
+    if (len > BUF_SIZE - conn->recv_len)    len = BUF_SIZE - conn->recv_len;
+    if (len == 0) {
+        return;
+    }
+    conn->recv_len += pbuf_copy_partial(conn->recv_queue, conn->buffer_recv + conn->recv_len, len, 0);
+    conn->recv_queue = pbuf_free_header(conn->recv_queue, len);
+    tcp_recved(conn->pcb, len);
+}
+
+
+// Drop what is buffered of a request rejected before all of it arrived
+static void tcp_server_skip(TCP_CONN_T *conn) {
+    size_t n = 0;
+    if (conn->skip_line) {
+        while (n < conn->recv_len && conn->buffer_recv[n] != '\n' && conn->buffer_recv[n] != '\0') {
+            n++;
+        }
+        if (n < conn->recv_len) {
+            n++;
+            conn->skip_line = false;
+        }
+    } else if (conn->skip_len > 0) {
+        n = conn->skip_len < conn->recv_len ? conn->skip_len : conn->recv_len;
+        conn->skip_len -= n;
+    }
+    memmove(conn->buffer_recv, conn->buffer_recv + n, conn->recv_len - n);
+    conn->recv_len -= n;
+}
+
+
+// Answer buffered requests in order until input runs out or the send buffer fills up
+static err_t tcp_server_process(TCP_CONN_T *conn) {
+    while (tcp_server_send_data(conn)) {
+        // the next reply is built in place; wait for acks if all our buffers are in flight
+        if (!conn->tx_buf && !(conn->tx_buf = tx_buf_alloc(conn)))    break;
+
+        if (conn->history_active) {
+            if (!tcp_server_send_history(conn))     break;
+            continue;
+        }
+        // pushes go out between replies, never inside a multi-frame one
+        if (!tcp_server_send_pushes(conn))  break;
+
+        tcp_server_fill_recv(conn);
+        tcp_server_skip(conn);
+        size_t consumed;
+        protocol_status_t status = protocol_parse(conn->buffer_recv, conn->recv_len, &conn->request,
+                                                  conn->cmd, sizeof(conn->cmd), &consumed);
+        if (status == PROTOCOL_ERROR) {
+            // request can't fit; drop all of it, including what hasn't arrived yet
+            DEBUG_printf("Malformed or oversized request\n");
+            if (consumed == PROTOCOL_TO_LINE_END) {
+                conn->skip_line = true;
+                consumed = conn->recv_len;
+            } else if (consumed > conn->recv_len) {
+                conn->skip_len = consumed - conn->recv_len;
+                consumed = conn->recv_len;
+            }
+        }
+        memmove(conn->buffer_recv, conn->buffer_recv + consumed, conn->recv_len - consumed);
+        conn->recv_len -= consumed;
+
+        char *reply = (char *)conn->tx_buf->data + PROTOCOL_HEADER_SIZE;
+        size_t len;
+        if (status == PROTOCOL_NEED_MORE) {
+            if (conn->recv_queue == NULL)   break;
+            continue;
+        } else if (status == PROTOCOL_ERROR) {
+            len = snprintf(reply, BUF_SIZE, "Error: Malformed or oversized request\n\n");
+        } else {
+            printf("cmd received from client: %s\n", conn->cmd);
+            len = server.execute(conn, conn->cmd, reply, BUF_SIZE);
+        }
+        tcp_server_queue_reply(conn, len, conn->history_active ? PROTOCOL_FLAG_MORE : 0);
+    }
+    return tcp_output(conn->pcb);
+}
+
+
+static err_t tcp_server_sent(void *arg, struct tcp_pcb *tpcb, u16_t len) {
+    TCP_CONN_T *conn = (TCP_CONN_T*)arg;
+    DEBUG_printf("tcp_server_sent %u\n", len);
+    conn->idle_polls = 0;
+    tcp_server_retire(conn, len);
+
+    if (conn->closing) {
+        if (!conn->unacked_head) {
+            tcp_conn_detach(conn);
+            tcp_conn_free(conn);
+        }
+        return ERR_OK;
+    }
+
+    // send buffer space freed up, carry on with pending replies
+    return tcp_server_process(conn);
+}
+
+
+static err_t tcp_server_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) {
+    TCP_CONN_T *conn = (TCP_CONN_T*)arg;
+
+    if (!p) {
+        DEBUG_printf("Client disconnected\n");
+        return tcp_conn_close(conn);
+    }
+
+    // this method is callback from lwIP, so cyw43_arch_lwip_begin is not required, however you
+    // can use this method to cause an assertion in debug mode, if this method is called when
+    // cyw43_arch_lwip_begin IS needed
+    cyw43_arch_lwip_check();
+    PERF_BEGIN(recv);
+    DEBUG_printf("tcp_server_recv %d/%d err %d\n", p->tot_len, conn->recv_len, err);
+    conn->idle_polls = 0;
+
+    // keep the pbuf until its bytes are parsed; it is acked as it gets copied out
+    if (conn->recv_queue == NULL) {
+        conn->recv_queue = p;
+    } else {
+        pbuf_cat(conn->recv_queue, p);
+    }
+
+    err_t result = tcp_server_process(conn);
+    PERF_END(PERF_TCP_RECV, recv);
+    return result;
+}
+
+
+static err_t tcp_server_poll(void *arg, struct tcp_pcb *tpcb) {
+    TCP_CONN_T *conn = (TCP_CONN_T*)arg;
+    if (++conn->idle_polls >= IDLE_POLLS) {
+        DEBUG_printf("Closing idle client\n");
+        return tcp_conn_close(conn);
+    }
+    // retry a reply lwIP had no memory for, in case no ack is on the way
+    return tcp_server_process(conn);
+}
+
+
+static void tcp_server_err(void *arg, err_t err) {
+    TCP_CONN_T *conn = (TCP_CONN_T*)arg;
+    if (err != ERR_ABRT) {
+        DEBUG_printf("tcp_client_err_fn %d\n", err);
+    }
+    // the pcb is already gone
+    if (conn) {
+        tcp_conn_free(conn);
+    }
+}
+
+
+static err_t tcp_server_accept(void *arg, struct tcp_pcb *client_pcb, err_t err) {
+    if (err != ERR_OK || client_pcb == NULL) {
+        DEBUG_printf("Failure in accept\n");
+        return ERR_VAL;
+    }
+
+    TCP_CONN_T *conn = tcp_conn_alloc();
+    if (!conn) {
+        DEBUG_printf("Connection pool exhausted, rejecting client\n");
+        tcp_abort(client_pcb);
+        return ERR_ABRT;
+    }
+    DEBUG_printf("Client connected\n");
+
+    conn->pcb = client_pcb;
+    // replies are flushed as soon as they are complete, Nagle would only hold them back
+    tcp_nagle_disable(client_pcb);
+    tcp_arg(client_pcb, conn);
+    tcp_sent(client_pcb, tcp_server_sent);
+    tcp_recv(client_pcb, tcp_server_recv);
+    tcp_poll(client_pcb, tcp_server_poll, POLL_INTERVAL);
+    tcp_err(client_pcb, tcp_server_err);
+
+    return ERR_OK;
+}
+
+
+TCP_SERVER_T *tcp_server_init(tcp_server_command_fn execute) {
+    memset(&server, 0, sizeof(server));
+    server.execute = execute;
+
+    conn_free_list = NULL;
+    for (int i = TCP_SERVER_MAX_CONNECTIONS - 1; i >= 0; i--) {
+        conn_pool[i].pcb = NULL;
+        conn_pool[i].next_free = conn_free_list;
+        conn_free_list = &conn_pool[i];
+    }
+    tx_free_list = NULL;
+    for (int i = TX_POOL_SIZE - 1; i >= 0; i--) {
+        tx_pool[i].next = tx_free_list;
+        tx_free_list = &tx_pool[i];
+    }
+    return &server;
+}
+
+
+bool tcp_server_open(TCP_SERVER_T *state) {
+    DEBUG_printf("Starting server at %s on port %u\n", ip4addr_ntoa(netif_ip4_addr(netif_list)), TCP_PORT);
+
+    struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb) {
+        DEBUG_printf("failed to create pcb\n");
+        return false;
+    }
+
+    err_t err = tcp_bind(pcb, NULL, TCP_PORT);
+    if (err) {
+        DEBUG_printf("failed to bind to port %u\n", TCP_PORT);
+        return false;
+    }
+
+    state->server_pcb = tcp_listen_with_backlog(pcb, TCP_SERVER_MAX_CONNECTIONS);
+    if (!state->server_pcb) {
+        DEBUG_printf("failed to listen\n");
+        if (pcb) {
+            tcp_close(pcb);
+        }
+        return false;
+    }
+
+    tcp_arg(state->server_pcb, state);
+    tcp_accept(state->server_pcb, tcp_server_accept);
+
+    return true;
+}
+
+
+void tcp_server_close(TCP_SERVER_T *state) {
+    for (int i = 0; i < TCP_SERVER_MAX_CONNECTIONS; i++) {
+        if (conn_pool[i].pcb != NULL && !conn_pool[i].closing) {
+            tcp_conn_close(&conn_pool[i]);
+        }
+    }
+    if (state->server_pcb) {
+        tcp_arg(state->server_pcb, NULL);
+        tcp_close(state->server_pcb);
+        state->server_pcb = NULL;
+    }
+}
+
+
+void tcp_server_start_history(TCP_CONN_T *conn, uint32_t from_ms, uint32_t to_ms) {
+    history_encoder_init(&conn->history, from_ms, to_ms);
+    conn->history_active = true;
+}
+
+
+void tcp_server_subscribe(TCP_CONN_T *conn, uint32_t interval_ms, uint8_t fields) {
+    conn->sub_fields = fields;
+    conn->sub_interval_ms = interval_ms;
+    conn->sub_last_ms = 0;
+    conn->sub_request = conn->request;
+}
+
+
+void tcp_server_publish(const history_sample_t *sample) {
+    cyw43_arch_lwip_begin();
+    for (int i = 0; i < TCP_SERVER_MAX_CONNECTIONS; i++) {
+        TCP_CONN_T *conn = &conn_pool[i];
+        if (conn->pcb == NULL || conn->closing || conn->sub_fields == 0) {
+            continue;
+        }
+        if (conn->sub_last_ms != 0 && sample->time_ms - conn->sub_last_ms < conn->sub_interval_ms) {
+            continue;
+        }
+        conn->sub_last_ms = sample->time_ms;
+        tcp_server_queue_push(conn, sample);
+        tcp_server_process(conn);
+    }
+    cyw43_arch_lwip_end();
+}
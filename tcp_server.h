@@ -0,0 +1,90 @@
+#ifndef _TCP_SERVER_H_
+#define _TCP_SERVER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** \file tcp_server.h
+ *
+ * \brief Multi-client TCP command server.
+ *
+ * Up to TCP_SERVER_MAX_CONNECTIONS clients are served at once. Each gets a
+ * context from a static pool with its own receive buffer and parse state.
+ * Replies are built in place in buffers from a shared transmit pool and handed
+ * to lwIP without copying; a buffer goes back to the pool once its bytes are
+ * acked. Interactive replies are flushed at once, history exports and pushes
+ * are batched. Connections idle for TCP_SERVER_IDLE_TIMEOUT_S are evicted.
+ */
+
+#define TCP_PORT 4242
+#define TCP_SERVER_MAX_CONNECTIONS 4
+#define TCP_SERVER_IDLE_TIMEOUT_S 60
+
+// fields of a telemetry subscription
+#define TCP_SERVER_FIELD_TEMPERATURE    0x01
+#define TCP_SERVER_FIELD_HUMIDITY       0x02
+#define TCP_SERVER_FIELD_RPM            0x04
+#define TCP_SERVER_FIELD_DUTY           0x08
+#define TCP_SERVER_FIELD_ALL            0x0F
+
+struct history_sample_t;
+
+typedef struct TCP_CONN_T_ TCP_CONN_T;
+
+/**
+ * \brief Command handler.
+ *
+ * Runs one command from lwIP context and writes the reply text.
+ *
+ * \return Reply length, less than size.
+ */
+typedef size_t (*tcp_server_command_fn)(TCP_CONN_T *conn, const char *cmd, char *reply, size_t size);
+
+typedef struct TCP_SERVER_T_ {
+    struct tcp_pcb *server_pcb;
+    bool complete;
+    tcp_server_command_fn execute;
+} TCP_SERVER_T;
+
+/**
+ * \brief Get the server instance, with all connection contexts free.
+ */
+TCP_SERVER_T *tcp_server_init(tcp_server_command_fn execute);
+
+/**
+ * \brief Start listening on TCP_PORT.
+ */
+bool tcp_server_open(TCP_SERVER_T *state);
+
+/**
+ * \brief Close all connections and stop listening.
+ */
+void tcp_server_close(TCP_SERVER_T *state);
+
+/**
+ * \brief Stream a history export to the connection after the current reply.
+ *
+ * Called by the command handler; see history.h for the format.
+ */
+void tcp_server_start_history(TCP_CONN_T *conn, uint32_t from_ms, uint32_t to_ms);
+
+/**
+ * \brief Push new samples to the connection from now on.
+ *
+ * Called by the command handler. Pushes go to the framing of the current
+ * request and are spaced at least interval_ms apart.
+ *
+ * \param fields TCP_SERVER_FIELD_* mask, 0 to unsubscribe.
+ */
+void tcp_server_subscribe(TCP_CONN_T *conn, uint32_t interval_ms, uint8_t fields);
+
+/**
+ * \brief Push a new sample to all subscribed connections.
+ *
+ * Called from the sampling loop, outside lwIP context. Pushes that can't be
+ * sent yet are batched into the next write, within the send window.
+ */
+void tcp_server_publish(const struct history_sample_t *sample);
+
+#endif // _TCP_SERVER_H_
@@ -0,0 +1,58 @@
+#include "telemetry.h"
+
+#include <string.h>
+#include "lwip/ip.h"
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+
+
+bool telemetry_init(telemetry_t *telemetry, const char *group, uint16_t port) {
+    memset(telemetry, 0, sizeof(telemetry_t));
+    if (!ipaddr_aton(group, &telemetry->group)) {
+        return false;
+    }
+    telemetry->port = port;
+    telemetry->pcb = udp_new_ip_type(IPADDR_TYPE_V4);
+    if (telemetry->pcb == NULL) {
+        return false;
+    }
+    if (!ip_addr_ismulticast(&telemetry->group)) {
+        ip_set_option(telemetry->pcb, SOF_BROADCAST);
+    }
+    return true;
+}
+
+
+uint8_t *telemetry_begin(const telemetry_t *telemetry, uint8_t *buf, uint32_t time_ms) {
+    uint8_t *p = buf;
+    p = telemetry_put_u8(p, TELEMETRY_MAGIC);
+    p = telemetry_put_u8(p, TELEMETRY_VERSION);
+    p = telemetry_put_u32(p, telemetry->seq);
+    return telemetry_put_u32(p, time_ms);
+}
+
+
+bool telemetry_send(telemetry_t *telemetry, const uint8_t *buf, size_t len) {
+    telemetry->seq++;
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+    if (p == NULL) {
+        telemetry->errors++;
+        return false;
+    }
+    memcpy(p->payload, buf, len);
+    err_t err = udp_sendto(telemetry->pcb, p, &telemetry->group, telemetry->port);
+    pbuf_free(p);
+    if (err != ERR_OK) {
+        telemetry->errors++;
+        return false;
+    }
+    return true;
+}
+
+
+void telemetry_deinit(telemetry_t *telemetry) {
+    if (telemetry->pcb != NULL) {
+        udp_remove(telemetry->pcb);
+        telemetry->pcb = NULL;
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "lwip/ip_addr.h"
+
+/** \file telemetry.h
+ *
+ * \brief UDP telemetry publisher.
+ *
+ * Sends the board state as one datagram to a multicast group or broadcast
+ * address. Any number of listeners can receive it, and the device keeps no
+ * state per listener. Each datagram carries a sequence number, so a receiver
+ * can count the datagrams it missed.
+ *
+ * Datagram, little-endian:
+ *
+ *   header    magic 0xB6, version 1, u32 sequence, u32 log time in ms
+ *   counts    u8 sensors, u8 fans, u8 zones
+ *   sensors   i16 temperature (0.1 C), u16 humidity (0.1 %), u16 reading age
+ *             (0.1 s, 0xFFFF for none or older)
+ *   fans      u16 RPM, u8 flags (0x01 stalled)
+ *   zones     i16 temperature (0.1 C, INT16_MIN without a fresh sensor),
+ *             i16 setpoint (0.1 C), u8 duty (%), u8 flags (0x01 automatic)
+ *
+ * A receiver should skip datagrams with a version it doesn't know.
+ */
+
+#define TELEMETRY_MAGIC 0xB6
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_HEADER_SIZE 10
+#define TELEMETRY_MAX_SIZE 256
+#define TELEMETRY_SIZE(sensors, fans, zones) (TELEMETRY_HEADER_SIZE + 3 + (sensors) * 6 + (fans) * 3 + (zones) * 6)
+
+#define TELEMETRY_FAN_STALLED 0x01
+#define TELEMETRY_ZONE_AUTO 0x01
+
+/**
+ * \brief Publisher.
+ */
+typedef struct telemetry_t {
+    struct udp_pcb *pcb;
+    ip_addr_t group;
+    uint16_t port;
+    uint32_t seq;           // of the next datagram
+    uint32_t errors;        // datagrams lwIP didn't take
+} telemetry_t;
+
+/**
+ * \brief Open the publisher.
+ *
+ * \param telemetry Publisher.
+ * \param group Destination address, dotted: a multicast group or a broadcast address.
+ * \param port Destination UDP port.
+ * Any destination but a multicast group gets SOF_BROADCAST. A directed
+ * broadcast can't be told from a unicast address without the netmask, and
+ * the option does nothing for unicast.
+ *
+ * \return false if group doesn't parse or lwIP has no UDP PCB left.
+ */
+bool telemetry_init(telemetry_t *telemetry, const char *group, uint16_t port);
+
+/**
+ * \brief Fill in the header of the next datagram.
+ *
+ * \param buf Datagram, at least TELEMETRY_MAX_SIZE bytes; the body follows the header.
+ * \param time_ms Log time of the state.
+ * \return Where the body starts.
+ */
+uint8_t *telemetry_begin(const telemetry_t *telemetry, uint8_t *buf, uint32_t time_ms);
+
+/**
+ * \brief Send a datagram and advance the sequence number.
+ *
+ * The number advances even if the send fails, so receivers count the loss.
+ * Call from lwIP context.
+ *
+ * \param buf Datagram, starting with the header from telemetry_begin().
+ * \param len Header and body.
+ * \return false if lwIP didn't take it.
+ */
+bool telemetry_send(telemetry_t *telemetry, const uint8_t *buf, size_t len);
+
+/**
+ * \brief Close the publisher.
+ */
+void telemetry_deinit(telemetry_t *telemetry);
+
+static inline uint8_t *telemetry_put_u8(uint8_t *p, uint8_t value) {
+    *p++ = value;
+    return p;
+}
+
+static inline uint8_t *telemetry_put_u16(uint8_t *p, uint16_t value) {
+    *p++ = value;
+    *p++ = value >> 8;
+    return p;
+}
+
+static inline uint8_t *telemetry_put_u32(uint8_t *p, uint32_t value) {
+    p = telemetry_put_u16(p, value);
+    return telemetry_put_u16(p, value >> 16);
+}
+
+#endif // _TELEMETRY_H_
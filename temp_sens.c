@@ -4,78 +4,189 @@
     sudo minicom -b 115200 -o -D /dev/ttyACM0
 */
 
+#include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
 #include "pico/cyw43_arch.h"
 #include "lwip/pbuf.h"
 #include "lwip/tcp.h"
 
-#define TCP_PORT 4242
 #define DEBUG_printf printf
-#define BUF_SIZE 1460
-#define CMD_SIZE 20
-#define TEST_ITERATIONS 10
-#define POLL_TIME_S 5
 
 
 #include <dht.h>
+#include <tach.h>
 #include <pico/stdlib.h>
 #include <stdio.h>
 #include <hardware/pwm.h>
 #include <hardware/gpio.h>
-
-
-// change this to match your setupuint8_t tach_pin
-static const dht_model_t DHT_MODEL = DHT22;
-static const uint DATA_PIN = 15;
-
-static const uint PWM_PIN = 16;
-static const uint TACH_PIN = 17;
-
-
-// for tach data extraction
-volatile uint64_t last_time = 0;
-volatile float rpm = 0;
-volatile bool fan_auto = true;  // automatic fan control based on temperature
+#include <hardware/sync.h>
+#include <pico/flash.h>
+#include <pico/multicore.h>
+
+#include "command.h"
+#include "dht_acquire.h"
+#include "fan_control.h"
+#include "fan_curve.h"
+#include "flash_log.h"
+#include "flash_settings.h"
+#include "format.h"
+#include "history.h"
+#include "http_metrics.h"
+#include "perf.h"
+#include "sched.h"
+#include "seqlock.h"
+#include "spsc_queue.h"
+#include "tcp_server.h"
+#include "telemetry.h"
+#include "wifi_link.h"
+
+
+// change this to match your setup: each sensor and fan belongs to a zone, and
+// each zone runs its own control loop on the hottest of its sensors
+typedef struct sensor_wiring_t {
+    dht_model_t model;
+    uint data_pin;
+    uint8_t zone;
+} sensor_wiring_t;
+
+typedef struct fan_wiring_t {
+    uint pwm_pin;
+    uint tach_pin;
+    uint8_t zone;
+} fan_wiring_t;
+
+#define NUM_ZONES 1
+
+static const sensor_wiring_t SENSORS[] = {
+    { DHT22, 15, 0 },
+};
+
+static const fan_wiring_t FANS[] = {
+    { 16, 17, 0 },
+};
+
+#define NUM_SENSORS (sizeof(SENSORS) / sizeof(SENSORS[0]))
+#define NUM_FANS (sizeof(FANS) / sizeof(FANS[0]))
+
+// one state machine each: tachs on pio1, sensors on any block with room,
+// and the Wi-Fi chip's SPI on one more
+_Static_assert(NUM_SENSORS <= DHT_SCANNER_MAX_SENSORS, "too many sensors for one scanner");
+_Static_assert(NUM_FANS <= NUM_PIO_STATE_MACHINES, "too many tachs for one PIO block");
+_Static_assert(NUM_SENSORS + NUM_FANS + 1 <= NUM_PIOS * NUM_PIO_STATE_MACHINES, "not enough PIO state machines");
+
+static const uint TACH_PULSES_PER_REV = 2;
+static const uint SAMPLE_PERIOD_MS = 2000;
+static const uint DHT_POLL_PERIOD_MS = 10;     // the read policy paces the sensor itself
+static const uint WIFI_CHECK_PERIOD_MS = 250;   // steps the connection manager
+
+
+// owned by core 1, which samples and controls; core 0 runs the network
+static dht_scanner_t scanner;
+static dht_acquire_t sensors[NUM_SENSORS];
+static tach_t tachs[NUM_FANS];
+static fan_control_t zones[NUM_ZONES];
+static fan_curve_lut_t curve_luts[NUM_ZONES];   // compiled from the curves core 0 hands over
+
+// periodic work, run from each core's main loop
+static sched_t core0_sched;
+static sched_t core1_sched;
+static sched_task_t sample_task;
+static sched_task_t dht_task;
+static sched_task_t control_task;
+static sched_task_t wifi_task;
+static sched_task_t telemetry_task;
+
+// owned by core 0, which runs the network
+static wifi_link_t wifi;
+static telemetry_t telemetry;   // to TELEMETRY_GROUP:TELEMETRY_PORT every TELEMETRY_INTERVAL_MS
+static http_metrics_t metrics;  // /metrics on HTTP_METRICS_PORT, rendered again after each sample
+
+// Longest metrics body: the HELP and TYPE lines of each family, and per line
+// 7 per sensor, 2 per fan, 5 per zone, one per task and 7 for the board
+#define METRICS_FAMILIES 22
+#define METRICS_FAMILY_SIZE 224     // HELP and TYPE lines
+#define METRICS_LINE_SIZE 96
+#define METRICS_MAX_TASKS 5
+#define METRICS_BODY_SIZE (METRICS_FAMILIES * METRICS_FAMILY_SIZE \
+    + (7 * NUM_SENSORS + 2 * NUM_FANS + 5 * NUM_ZONES + METRICS_MAX_TASKS + 7) * METRICS_LINE_SIZE)
+_Static_assert(HTTP_METRICS_HEADER_SIZE + METRICS_BODY_SIZE <= UINT16_MAX, "a metrics response fits its length fields");
+static char metrics_storage[HTTP_METRICS_STORAGE_SIZE(METRICS_BODY_SIZE)];
+
+// samples from core 1 to core 0
+#define SAMPLE_QUEUE_LEN 16
+static history_sample_t sample_storage[SAMPLE_QUEUE_LEN];
+static spsc_queue_t sample_queue;
+
+// commands from core 0 to core 1, one FIFO word each: the opcode in the top
+// byte, the zone (or CORE1_ZONE_ALL) in the next and a signed 16 bit argument
+#define CORE1_ZONE_ALL 0xFF
+
+enum {
+    CORE1_CMD_SET_MANUAL = 1,   // duty in percent
+    CORE1_CMD_SET_AUTOMATIC,
+    CORE1_CMD_SET_SETPOINT,     // tenths of a degree C
+    CORE1_CMD_SET_CURVE,        // compile the zone's curve from curve_lock
+};
+
+// fan curves, set by command on core 0, kept in flash and compiled by core 1;
+// core 1 reads them through curve_lock
+typedef struct SETTINGS_ {
+    fan_curve_t curves[NUM_ZONES];  // no points: the PID loop
+} SETTINGS_;
+
+_Static_assert(sizeof(SETTINGS_) <= FLASH_SETTINGS_MAX_SIZE, "settings fit one flash record");
+
+static SETTINGS_ settings;              // owned by core 0
+static fan_curve_t shared_curves[NUM_ZONES];
+static seqlock_t curve_lock;
+static volatile bool settings_changed;  // saved from the main loop, not from lwIP context
 
 
 // params
-static const float TEMP_THRESHOLD = 25;
+static const int16_t TEMP_SETPOINT = 250;   // tenths of a degree C
+static const uint MIN_FAN_SPEED = 20;   // slowest the fan reliably spins at, in percent
 static const uint MAX_FAN_SPEED = 100;  // max fan speed in percent
 
 
-typedef struct TCP_SERVER_T_ {
-    struct tcp_pcb *server_pcb;
-    struct tcp_pcb *client_pcb;
-    bool complete;
-    uint8_t buffer_sent[BUF_SIZE];
-    uint8_t buffer_recv[BUF_SIZE];
-    int sent_len;
-    int recv_len;
-    int run_count;
-} TCP_SERVER_T;
+typedef struct SENSOR_STATE_ {
+    int16_t temperature;    // tenths of a degree C, of the last good read
+    uint16_t humidity;      // tenths of %RH
+    uint32_t reading_age_ms;    // since the last good read, UINT32_MAX before the first
+} SENSOR_STATE_;
+
+typedef struct FAN_STATE_ {
+    uint32_t rpm;
+    bool stalled;       // driven but the tach stopped pulsing
+} FAN_STATE_;
 
+typedef struct ZONE_STATE_ {
+    bool has_input;         // a sensor of the zone is fresh
+    int16_t temperature;    // tenths of a degree C, the hottest fresh sensor
+    uint8_t duty;       // fan duty in percent
+    bool fan_auto;      // duty set by the control loop
+    bool curve;         // the control loop follows a fan curve
+    int16_t setpoint;   // tenths of a degree C
+} ZONE_STATE_;
 
 typedef struct SYSTEM_STATE_ {
-    float temperature;
-    float humidity;
-    float rpm;
+    SENSOR_STATE_ sensors[NUM_SENSORS];
+    FAN_STATE_ fans[NUM_FANS];
+    ZONE_STATE_ zones[NUM_ZONES];
 } SYSTEM_STATE_;
 
 
-volatile SYSTEM_STATE_ sys_state;
+// latest reading and control state, published whole by core 1 and read by
+// the TCP server on core 0 through sys_state_lock
+static SYSTEM_STATE_ sys_state;
+static seqlock_t sys_state_lock;
+static SYSTEM_STATE_ core1_state;   // core 1's working copy
 
+// log clock at boot, continuing the history kept in flash
+static uint32_t log_time_base_ms;
 
-void gpio_callback(uint gpio, uint32_t events) {
-    uint64_t current_time = time_us_64();
-    uint64_t pulse_width = current_time - last_time;
-
-    if (pulse_width > 10000) {                      // 10ms in microseconds (filter out noise)
-        float freq = 1.0f / (pulse_width / 1e6f);   // Convert to Hz
-        rpm = (freq / 2.0f) * 60.0f;                // 2 pulses per revolution
-        last_time = current_time;
-    }
-}
+// cyw43 and lwIP are up; without them the board still senses, controls and logs
+static bool network_up;
 
 
 uint32_t pwm_set_freq_duty(uint slice_num, uint chan, uint32_t f, int d) {
@@ -94,315 +205,838 @@ uint32_t pwm_set_freq_duty(uint slice_num, uint chan, uint32_t f, int d) {
     return wrap;
 }
 
-                  
-void pwm_gen(uint slice_num, uint chan, int set) {
-    if (set)    pwm_set_freq_duty(slice_num, chan, 25000, MAX_FAN_SPEED);  // on
-    else        pwm_set_freq_duty(slice_num, chan, 25000, 0);  // or off
-    pwm_set_enabled(slice_num, true);
-}
-
 
-void fan_pwm_init(uint8_t pwm_pin, uint* slice_num, uint* chan, uint8_t tach_pin) {
+void fan_pwm_init(uint8_t pwm_pin, uint8_t tach_pin, fan_control_t *zone, tach_t *tach, alarm_pool_t *pool) {
     // pwm setup
     gpio_set_function(pwm_pin, GPIO_FUNC_PWM);
-    *slice_num = pwm_gpio_to_slice_num(pwm_pin);
-    *chan = pwm_gpio_to_channel(pwm_pin);
-    pwm_gen(*slice_num, *chan, 0);
-    
-    // tach gpio setup
-    gpio_init(tach_pin);
-    gpio_set_dir(tach_pin, GPIO_IN);
-    gpio_pull_up(tach_pin);
-
-    // irq interrupt to gather tach
-    gpio_set_irq_enabled_with_callback(
-        tach_pin,
-        GPIO_IRQ_EDGE_FALL,
-        true,
-        &gpio_callback
-    );
-}
-
-
-void get_system_state(dht_t* dht, uint slice_num, uint chan, int* temp_mem, int* prev_temp_mem) {
-    if (time_us_64() - last_time > 1000000)     rpm = 0;
-
-    dht_start_measurement(dht);
-    
-    float humidity;
-    float temperature_c;
-    dht_result_t result = dht_finish_measurement_blocking(dht, &humidity, &temperature_c);
-
-    if (result == DHT_RESULT_OK) {
-        if (temperature_c > TEMP_THRESHOLD && fan_auto)     *temp_mem = 1;
-        else                                    *temp_mem = 0;
-    } else if (result == DHT_RESULT_TIMEOUT) {
-        puts("DHT sensor not responding. Please check your wiring.");
-    } else {
-        assert(result == DHT_RESULT_BAD_CHECKSUM);
-        puts("Bad checksum");
+    uint slice_num = pwm_gpio_to_slice_num(pwm_pin);
+    uint chan = pwm_gpio_to_channel(pwm_pin);
+    uint32_t wrap = pwm_set_freq_duty(slice_num, chan, 25000, 0);
+    pwm_set_enabled(slice_num, true);
+
+    // the duty is set by the zone's control loop from here on
+    if (!fan_control_add_output(zone, slice_num, chan, wrap)) {
+        printf("Too many fans in one zone, GPIO%u left off\n", pwm_pin);
     }
 
-    if (*temp_mem != *prev_temp_mem) {
-        pwm_gen(slice_num, chan, *temp_mem);
-        *prev_temp_mem = *temp_mem;
+    // tach edges are timestamped by PIO and collected by DMA, no per-edge irq;
+    // the estimates and stall checks of all fans run from one alarm in this core's pool
+    tach_config_t tach_config = tach_default_config();
+    tach_config.pulses_per_rev = TACH_PULSES_PER_REV;
+    tach_init(tach, pio1, tach_pin, &tach_config, pool);
+}
+
+
+// Runs on core 1
+static bool fan_is_stalled(uint i) {
+    return tach_is_stalled(&tachs[i]) && fan_control_get_duty(&zones[FANS[i].zone]) > 0;
+}
+
+
+// Runs on core 1: publish the readings and the control state in one piece
+static void publish_state(void) {
+    for (uint i = 0; i < NUM_FANS; i++) {
+        core1_state.fans[i].rpm = tach_get_rpm(&tachs[i]);
+        core1_state.fans[i].stalled = fan_is_stalled(i);
+    }
+    for (uint z = 0; z < NUM_ZONES; z++) {
+        core1_state.zones[z].duty = fan_control_get_duty(&zones[z]);
+        core1_state.zones[z].fan_auto = zones[z].automatic;
+        core1_state.zones[z].curve = zones[z].curve != NULL;
+        core1_state.zones[z].setpoint = zones[z].config.setpoint;
     }
+    seqlock_write(&sys_state_lock, &core1_state);
+}
+
 
-    sys_state.temperature = temperature_c;
-    sys_state.humidity = humidity;
-    sys_state.rpm = rpm;
+// Runs on core 1: take the hottest of a zone's fresh sensors as its temperature
+static bool update_zone_temperature(uint zone) {
+    ZONE_STATE_ *state = &core1_state.zones[zone];
+    state->has_input = false;
+    for (uint i = 0; i < NUM_SENSORS; i++) {
+        if (SENSORS[i].zone == zone && dht_acquire_is_fresh(&sensors[i]) &&
+                (!state->has_input || sensors[i].temperature > state->temperature)) {
+            state->temperature = sensors[i].temperature;
+            state->has_input = true;
+        }
+    }
+    return state->has_input;
 }
 
 
-static TCP_SERVER_T* tcp_server_init(void) {
-    TCP_SERVER_T *state = calloc(1, sizeof(TCP_SERVER_T));
-    if (!state) {
-        DEBUG_printf("failed to allocate state\n");
-        return NULL;
+// Runs on core 1: collect DHT reads and feed the good ones to their zones
+static void dht_task_fn(void *user_data) {
+    bool zone_changed[NUM_ZONES] = { false };
+    dht_result_t results[NUM_SENSORS];
+    PERF_BEGIN(dht);
+    dht_acquire_poll(&scanner, sensors, NUM_SENSORS, results);
+    for (uint i = 0; i < NUM_SENSORS; i++) {
+        dht_result_t result = results[i];
+        if (result == DHT_RESULT_OK) {
+            zone_changed[SENSORS[i].zone] = true;
+        } else if (result != DHT_RESULT_IN_PROGRESS && sensors[i].backoff_us == DHT_ACQUIRE_RETRY_MS * 1000) {
+            // only the first failure of a run, the retries would flood the log
+            printf(result == DHT_RESULT_TIMEOUT ? "DHT sensor on GPIO%u not responding. Please check your wiring.\n"
+                                                : "Bad checksum from DHT sensor on GPIO%u\n", SENSORS[i].data_pin);
+        }
     }
-    return state;
+    // a zone with no fresh sensor isn't fed, and runs its fans at full speed
+    // once its last input times out
+    for (uint z = 0; z < NUM_ZONES; z++) {
+        if (zone_changed[z] && update_zone_temperature(z)) {
+            // the control task picks this up on its next update
+            fan_control_set_input(&zones[z], core1_state.zones[z].temperature);
+        }
+    }
+    PERF_END(PERF_DHT_POLL, dht);
 }
 
 
-static err_t tcp_server_sent(void *arg, struct tcp_pcb *tpcb, u16_t len) {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
-    DEBUG_printf("tcp_server_sent %u\n", len);
-    state->sent_len += len;
+// Runs on core 1
+void get_system_state(void) {
+    // the last good readings, repeated while a sensor fails
+    bool all_fresh = true;
+    for (uint i = 0; i < NUM_SENSORS; i++) {
+        SENSOR_STATE_ *state = &core1_state.sensors[i];
+        state->reading_age_ms = UINT32_MAX;
+        dht_acquire_get(&sensors[i], &state->temperature, &state->humidity, &state->reading_age_ms);
+        all_fresh = all_fresh && dht_acquire_is_fresh(&sensors[i]);
+    }
+    for (uint z = 0; z < NUM_ZONES; z++) {
+        // a zone whose sensors all went stale shows it before the next good read
+        update_zone_temperature(z);
+    }
+    publish_state();
 
-    if (state->sent_len >= BUF_SIZE) {
-        // We should get the data back from the client
-        state->recv_len = 0;
-        DEBUG_printf("Waiting for buffer from client\n");
+    bool all_auto = true, any_stalled = false;
+    for (uint z = 0; z < NUM_ZONES; z++) {
+        all_auto = all_auto && zones[z].automatic;
     }
+    for (uint i = 0; i < NUM_FANS; i++) {
+        any_stalled = any_stalled || core1_state.fans[i].stalled;
+    }
+
+    // one sample per period, handed to core 0 for history and clients: the
+    // first sensor and the first fan, flagged for the whole board
+    uint32_t rpm = core1_state.fans[0].rpm;     // 0 once the fan stopped pulsing
+    history_sample_t sample = {
+        .time_ms = log_time_base_ms + to_ms_since_boot(get_absolute_time()),
+        .temperature = core1_state.sensors[0].temperature,
+        .humidity = core1_state.sensors[0].humidity,
+        .rpm = rpm > UINT16_MAX ? UINT16_MAX : rpm,
+        .duty = core1_state.zones[FANS[0].zone].duty,
+        .flags = (all_fresh ? HISTORY_FLAG_SENSOR_OK : 0) | (all_auto ? HISTORY_FLAG_FAN_AUTO : 0) |
+                 (any_stalled ? HISTORY_FLAG_FAN_STALLED : 0),
+    };
+    // if core 0 falls behind the sample is dropped and counted, control carries on
+    spsc_queue_push(&sample_queue, &sample);
+    __sev();
+}
+
 
-    return ERR_OK;
+// Runs on core 1: compile a zone's curve, if it has one, and switch its control loop to it.
+// Compiling takes one pass over the table; the control step then reads one entry.
+static void apply_curve(uint zone) {
+    fan_curve_t curves[NUM_ZONES];
+    seqlock_read(&curve_lock, curves);
+    if (curves[zone].num_points == 0) {
+        fan_control_set_curve(&zones[zone], NULL);
+        return;
+    }
+    // the control task runs on this core too, so it never sees a half-written table
+    fan_curve_compile(&curves[zone], &curve_luts[zone]);
+    fan_control_set_curve(&zones[zone], &curve_luts[zone]);
 }
 
 
-static err_t tcp_server_close(void *arg) {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
-    err_t err = ERR_OK;
-    if (state->client_pcb != NULL) {
-        tcp_arg(state->client_pcb, NULL);
-        tcp_poll(state->client_pcb, NULL, 0);
-        tcp_sent(state->client_pcb, NULL);
-        tcp_recv(state->client_pcb, NULL);
-        tcp_err(state->client_pcb, NULL);
-        err = tcp_close(state->client_pcb);
-        if (err != ERR_OK) {
-            DEBUG_printf("close failed %d, calling abort\n", err);
-            tcp_abort(state->client_pcb);
-            err = ERR_ABRT;
+// Runs on core 1: apply the commands core 0 queued in the FIFO
+static void core1_handle_commands(void) {
+    bool applied = false;
+    while (multicore_fifo_rvalid()) {
+        uint32_t word = multicore_fifo_pop_blocking();
+        int32_t arg = (int16_t)word;    // sign extend the low 16 bits
+        uint zone = (word >> 16) & 0xFF;
+        for (uint z = 0; z < NUM_ZONES; z++) {
+            if (zone != CORE1_ZONE_ALL && zone != z) {
+                continue;
+            }
+            switch (word >> 24) {
+                case CORE1_CMD_SET_MANUAL:
+                    fan_control_set_manual(&zones[z], arg);
+                    break;
+                case CORE1_CMD_SET_AUTOMATIC:
+                    fan_control_set_automatic(&zones[z]);
+                    break;
+                case CORE1_CMD_SET_SETPOINT:
+                    fan_control_set_setpoint(&zones[z], arg);
+                    break;
+                case CORE1_CMD_SET_CURVE:
+                    apply_curve(z);
+                    break;
+            }
         }
-        state->client_pcb = NULL;
+        applied = true;
     }
-    if (state->server_pcb) {
-        tcp_arg(state->server_pcb, NULL);
-        tcp_close(state->server_pcb);
-        state->server_pcb = NULL;
+    // a status right after the command already reflects it
+    if (applied) {
+        publish_state();
     }
-    return err;
 }
 
 
-static err_t tcp_server_result(void *arg, int status) {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
-    if (status == 0) {
-        DEBUG_printf("test success\n");
+static void sample_task_fn(void *user_data) {
+    PERF_BEGIN(sample);
+    get_system_state();
+    PERF_END(PERF_SAMPLE, sample);
+}
+
+
+// every zone in one pass, so they all step at the same rate
+static void control_task_fn(void *user_data) {
+    PERF_BEGIN(control);
+    for (uint z = 0; z < NUM_ZONES; z++) {
+        fan_control_update(&zones[z]);
     }
-    return ERR_OK;
+    PERF_END(PERF_CONTROL, control);
 }
 
 
-err_t tcp_server_send_data(void *arg, struct tcp_pcb *tpcb, char* sent_msg) {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
+static void core1_main(void) {
+    // core 0 pauses this core while it programs the flash log; on RP2350 the
+    // lockout signals through a doorbell, leaving the FIFO to the commands
+    flash_safe_execute_core_init();
+
+    // the scheduler, tach and DHT interrupts run on this core, away from the
+    // Wi-Fi and lwIP interrupts on core 0
+    alarm_pool_t *pool = alarm_pool_create_with_unused_hardware_alarm(4);
+    fan_control_config_t config = fan_control_default_config();
+    config.setpoint = TEMP_SETPOINT;
+    config.min_duty = MIN_FAN_SPEED;
+    config.max_duty = MAX_FAN_SPEED;
+    for (uint z = 0; z < NUM_ZONES; z++) {
+        fan_control_init(&zones[z], &config);
+        apply_curve(z);
+    }
+    for (uint i = 0; i < NUM_FANS; i++) {
+        fan_pwm_init(FANS[i].pwm_pin, FANS[i].tach_pin, &zones[FANS[i].zone], &tachs[i], pool);
+    }
+
+    // after the tachs, which need pio1
+    dht_scanner_init(&scanner);
+    for (uint i = 0; i < NUM_SENSORS; i++) {
+        dht_scanner_add(&scanner, SENSORS[i].model, SENSORS[i].data_pin, true /* pull_up */, true /* required */);
+        dht_acquire_init(&sensors[i], SENSORS[i].model);
+    }
 
-    memset(state->buffer_sent, 0, BUF_SIZE);    // Clear buffer
-    if (sent_msg) {
-        strncpy((char *)state->buffer_sent, sent_msg, BUF_SIZE - 1);    // Copy string, leave space for null terminator
-        printf("Prepared message to send: %s\n", state->buffer_sent);
-    } else {
-        state->buffer_sent[0] = '\0';   // Empty string if sent_msg is NULL
+    sched_init(&core1_sched, pool);
+    sched_add(&core1_sched, &control_task, "control", control_task_fn, NULL,
+              FAN_CONTROL_PERIOD_MS * 1000, FAN_CONTROL_PERIOD_MS * 1000 / 2);
+    sched_add(&core1_sched, &dht_task, "dht", dht_task_fn, NULL, DHT_POLL_PERIOD_MS * 1000, DHT_POLL_PERIOD_MS * 1000);
+    sched_add(&core1_sched, &sample_task, "sample", sample_task_fn, NULL, SAMPLE_PERIOD_MS * 1000, 20000);
+
+    while (true) {
+        sched_run(&core1_sched);
+        core1_handle_commands();
+        // the tach alarm runs on this core and wakes it, so a stall is
+        // published within a pulse period instead of at the next sample
+        for (uint i = 0; i < NUM_FANS; i++) {
+            if (fan_is_stalled(i) != core1_state.fans[i].stalled) {
+                printf(fan_is_stalled(i) ? "Fan on GPIO%u stalled\n" : "Fan on GPIO%u running again\n", FANS[i].pwm_pin);
+                publish_state();
+            }
+        }
+        // until the next release, a command from core 0 or a tach update
+        __wfe();
     }
+}
+
+
+// Runs on core 0: join, and rejoin after a drop, without blocking the loop
+static void wifi_task_fn(void *user_data) {
+    wifi_link_update(&wifi);
+}
+
+
+_Static_assert(TELEMETRY_SIZE(NUM_SENSORS, NUM_FANS, NUM_ZONES) <= TELEMETRY_MAX_SIZE, "the board fits one telemetry datagram");
 
-    state->sent_len = 0;
-    DEBUG_printf("Writing %ld bytes to client\n", BUF_SIZE);
-    
-    // this method is callback from lwIP, so cyw43_arch_lwip_begin is not required, however you
-    // can use this method to cause an assertion in debug mode, if this method is called when
-    // cyw43_arch_lwip_begin IS needed
-    cyw43_arch_lwip_check();
-    err_t err = tcp_write(tpcb, state->buffer_sent, strlen((char*)state->buffer_sent), TCP_WRITE_FLAG_COPY);
-    if (err != ERR_OK) {
-        DEBUG_printf("Failed to write data %d\n", err);
-        return tcp_server_result(arg, -1);
+// Runs on core 0: publish the state snapshot the status reply reads, to any number of listeners
+static void telemetry_task_fn(void *user_data) {
+    if (!wifi_link_is_up(&wifi)) {
+        return;
+    }
+    SYSTEM_STATE_ state;
+    seqlock_read(&sys_state_lock, &state);
+
+    uint8_t datagram[TELEMETRY_MAX_SIZE];
+    uint8_t *p = telemetry_begin(&telemetry, datagram, log_time_base_ms + to_ms_since_boot(get_absolute_time()));
+    p = telemetry_put_u8(p, NUM_SENSORS);
+    p = telemetry_put_u8(p, NUM_FANS);
+    p = telemetry_put_u8(p, NUM_ZONES);
+    for (uint i = 0; i < NUM_SENSORS; i++) {
+        uint32_t age = state.sensors[i].reading_age_ms / 100;
+        p = telemetry_put_u16(p, state.sensors[i].temperature);
+        p = telemetry_put_u16(p, state.sensors[i].humidity);
+        p = telemetry_put_u16(p, age > UINT16_MAX ? UINT16_MAX : age);
+    }
+    for (uint i = 0; i < NUM_FANS; i++) {
+        uint32_t rpm = state.fans[i].rpm;
+        p = telemetry_put_u16(p, rpm > UINT16_MAX ? UINT16_MAX : rpm);
+        p = telemetry_put_u8(p, state.fans[i].stalled ? TELEMETRY_FAN_STALLED : 0);
     }
-    return ERR_OK;
+    for (uint z = 0; z < NUM_ZONES; z++) {
+        const ZONE_STATE_ *zone = &state.zones[z];
+        p = telemetry_put_u16(p, zone->has_input ? zone->temperature : INT16_MIN);
+        p = telemetry_put_u16(p, zone->setpoint);
+        p = telemetry_put_u8(p, zone->duty);
+        p = telemetry_put_u8(p, zone->fan_auto ? TELEMETRY_ZONE_AUTO : 0);
+    }
+    cyw43_arch_lwip_begin();
+    telemetry_send(&telemetry, datagram, p - datagram);
+    cyw43_arch_lwip_end();
 }
 
 
-err_t tcp_server_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
+// Hand a command for a zone, or CORE1_ZONE_ALL, to core 1; false if its FIFO is full
+static bool send_core1_command(uint8_t op, uint8_t zone, int32_t arg) {
+    return multicore_fifo_push_timeout_us(((uint32_t)op << 24) | ((uint32_t)zone << 16) | ((uint32_t)arg & 0xFFFF), 0);
+}
+
 
-    if (!p) {
-        return tcp_server_result(arg, -1);
+// Runs on core 0, outside lwIP context: keep changed settings across reboots
+static void save_settings(void) {
+    if (!settings_changed) {
+        return;
+    }
+    settings_changed = false;
+    if (!flash_settings_save(&settings, sizeof(settings))) {
+        printf("Saving settings to flash failed\n");
     }
+}
 
-    // this method is callback from lwIP, so cyw43_arch_lwip_begin is not required, however you
-    // can use this method to cause an assertion in debug mode, if this method is called when
-    // cyw43_arch_lwip_begin IS needed
-    cyw43_arch_lwip_check();
-    if (p->tot_len > 0) {
-        DEBUG_printf("tcp_server_recv %d/%d err %d\n", p->tot_len, state->recv_len, err);
-        printf("cmd received from client: %s\n", state->buffer_recv);
 
-        // Receive the buffer
-        const uint16_t buffer_left = BUF_SIZE - state->recv_len;
-        state->recv_len += pbuf_copy_partial(p, state->buffer_recv + state->recv_len,
-                                             p->tot_len > buffer_left ? buffer_left : p->tot_len, 0);
-        tcp_recved(tpcb, p->tot_len);
+// Runs on core 0: take the samples core 1 produced
+static void drain_samples(void) {
+    history_sample_t sample;
+    while (spsc_queue_pop(&sample_queue, &sample)) {
+        history_append(&sample);
+        if (network_up) {
+            tcp_server_publish(&sample);
+        }
+        http_metrics_invalidate(&metrics);
     }
+}
 
-    pbuf_free(p);
 
-    // Have we have received the whole buffer
-    if (state->recv_len == BUF_SIZE) {
+//
+// commands, one handler per row of the command table
+//
+
+static size_t reply_text(char *reply, size_t size, int len) {
+    return len < (int)size ? len : size - 1;
+}
 
-        // check it matches
-        if (memcmp(state->buffer_sent, state->buffer_recv, BUF_SIZE) != 0) {
-            DEBUG_printf("buffer mismatch\n");
-        }
-        DEBUG_printf("tcp_server_recv buffer ok\n");
 
-        // Test complete?
-        state->run_count++;
-        if (state->run_count >= TEST_ITERATIONS) {
-            tcp_server_result(arg, 0);
-            return ERR_OK;
+static size_t cmd_status(void *context, const command_args_t *args, char *reply, size_t size) {
+    printf("Sending current system status to client\n");
+    // one consistent snapshot, core 1 may be publishing a new one meanwhile
+    SYSTEM_STATE_ state;
+    seqlock_read(&sys_state_lock, &state);
+    size_t len = reply_text(reply, size, snprintf(reply, size, "Current system status:\n"));
+    for (uint z = 0; z < NUM_ZONES; z++) {
+        const ZONE_STATE_ *zone = &state.zones[z];
+        char temperature[FORMAT_TENTHS_SIZE] = "no reading", setpoint[FORMAT_TENTHS_SIZE];
+        if (zone->has_input) {
+            format_tenths(temperature, zone->temperature);
+        }
+        format_tenths(setpoint, zone->setpoint);
+        len += reply_text(reply + len, size - len, snprintf(reply + len, size - len,
+            "Zone %u: %s%s, setpoint %s C, duty %u %% (%s)\n", z, temperature, zone->has_input ? " C" : "",
+            setpoint, zone->duty, !zone->fan_auto ? "manual" : zone->curve ? "curve" : "auto"));
+
+        for (uint i = 0; i < NUM_SENSORS; i++) {
+            const SENSOR_STATE_ *sensor = &state.sensors[i];
+            if (SENSORS[i].zone != z) {
+                continue;
+            }
+            char humidity[FORMAT_TENTHS_SIZE], age[FORMAT_TENTHS_SIZE] = "never";
+            format_tenths(temperature, sensor->temperature);
+            format_tenths(humidity, sensor->humidity);
+            if (sensor->reading_age_ms != UINT32_MAX) {
+                format_tenths(age, sensor->reading_age_ms / 100);
+            }
+            len += reply_text(reply + len, size - len, snprintf(reply + len, size - len,
+                "  Sensor GPIO%u: %s C, %s %%, read %s%s\n", SENSORS[i].data_pin, temperature, humidity, age,
+                sensor->reading_age_ms != UINT32_MAX ? " s ago" : ""));
         }
+        for (uint i = 0; i < NUM_FANS; i++) {
+            if (FANS[i].zone == z) {
+                len += reply_text(reply + len, size - len, snprintf(reply + len, size - len,
+                    "  Fan GPIO%u: %lu RPM%s\n", FANS[i].pwm_pin, (unsigned long)state.fans[i].rpm,
+                    state.fans[i].stalled ? " (stalled)" : ""));
+            }
+        }
+    }
+    return len + reply_text(reply + len, size - len, snprintf(reply + len, size - len, "\n"));
+}
+
+
+// Zone a command applies to: the optional argument at index, all zones if it isn't given
+static bool get_zone_arg(const command_args_t *args, uint index, uint8_t *zone) {
+    *zone = args->count > index ? args->value[index].u : CORE1_ZONE_ALL;
+    return args->count <= index || args->value[index].u < NUM_ZONES;
+}
+
+
+static size_t cmd_setpwm(void *context, const command_args_t *args, char *reply, size_t size) {
+    int32_t pwm_value = args->value[0].i;
+    uint8_t zone;
+    int len;
+    if ((pwm_value < 0 || pwm_value > 100) && pwm_value != -1) {
+        printf("Invalid PWM value received: %ld. Must be between 0 and 100 or -1 to default.\n", (long)pwm_value);
+        len = snprintf(reply, size, "Error: Invalid PWM value. Must be between 0 and 100.\n\n");
+    } else if (!get_zone_arg(args, 1, &zone)) {
+        len = snprintf(reply, size, "Error: Invalid zone. Must be below %u.\n\n", NUM_ZONES);
+    } else if (!send_core1_command(pwm_value == -1 ? CORE1_CMD_SET_AUTOMATIC : CORE1_CMD_SET_MANUAL, zone, pwm_value)) {
+        len = snprintf(reply, size, "Error: Controller busy, try again.\n\n");
+    } else if (pwm_value == -1) {
+        printf("Resetting to automatic fan control based on temperature.\n");
+        len = snprintf(reply, size, "Fan control set to auto\n\n");
+    } else {
+        printf("Setting fan PWM to %ld%%\n", (long)pwm_value);
+        len = snprintf(reply, size, "Fan PWM set to %ld\n\n", (long)pwm_value);
+    }
+    return reply_text(reply, size, len);
+}
+
+
+static size_t cmd_setpoint(void *context, const command_args_t *args, char *reply, size_t size) {
+    int32_t setpoint = args->value[0].i;
+    uint8_t zone;
+    int len;
+    if (setpoint < -400 || setpoint > 800) {
+        len = snprintf(reply, size, "Error: Invalid setpoint. Must be between -40.0 and 80.0 C.\n\n");
+    } else if (!get_zone_arg(args, 1, &zone)) {
+        len = snprintf(reply, size, "Error: Invalid zone. Must be below %u.\n\n", NUM_ZONES);
+    } else if (!send_core1_command(CORE1_CMD_SET_SETPOINT, zone, setpoint)) {
+        len = snprintf(reply, size, "Error: Controller busy, try again.\n\n");
+    } else {
+        char text[FORMAT_TENTHS_SIZE];
+        format_tenths(text, setpoint);
+        printf("Setting temperature setpoint to %s C\n", text);
+        len = snprintf(reply, size, "Setpoint set to %s C\n\n", text);
+    }
+    return reply_text(reply, size, len);
+}
+
+
+static size_t format_curve(uint zone, char *reply, size_t size) {
+    const fan_curve_t *curve = &settings.curves[zone];
+    if (curve->num_points == 0) {
+        return reply_text(reply, size, snprintf(reply, size, "Zone %u: no curve, PID loop\n", zone));
+    }
+    char text[FAN_CURVE_TEXT_SIZE];
+    fan_curve_format(curve, text);
+    return reply_text(reply, size, snprintf(reply, size, "Zone %u: %s\n", zone, text));
+}
+
 
-        char sent_msg[BUF_SIZE];
-
-        // printf("cmd received from client: %s\n", state->buffer_recv);
-        if (strncmp(state->buffer_recv, "status", 6) == 0) {
-            printf("Sending current system status to client\n");
-            snprintf(sent_msg, sizeof(sent_msg), 
-                "\n\nCurrent system status:\nTemperature: %.1f C\nHumidity: %.1f %%\nFan Speed: %.1f RPM\n\n\0", sys_state.temperature, sys_state.humidity, sys_state.rpm);
-        } else if (strncmp(state->buffer_recv, "setpwm", 6) == 0) {
-            int pwm_value = atoi(state->buffer_recv + 7); // Extract the value after "setpwm "
-            if ((pwm_value < 0 || pwm_value > 100) && pwm_value != -1) {
-                printf("Invalid PWM value received: %d. Must be between 0 and 100 or -1 to default.\n", pwm_value);
-                snprintf(sent_msg, sizeof(sent_msg), "Error: Invalid PWM value. Must be between 0 and 100.\n\n\0");
-            } else if (pwm_value == -1) {
-                printf("Resetting to automatic fan control based on temperature.\n");
-                // Reset to automatic control
-                fan_auto = true;
-                snprintf(sent_msg, sizeof(sent_msg), "Fan control set to auto\n\n\0");
-            } else {
-                printf("Setting fan PWM to %d%%\n", pwm_value);
-                // Set manual PWM and disable automatic control
-                fan_auto = false;
-                pwm_set_freq_duty(pwm_gpio_to_slice_num(PWM_PIN), pwm_gpio_to_channel(PWM_PIN), 25000, pwm_value);
-                snprintf(sent_msg, sizeof(sent_msg), "Fan PWM set to %d\n\n\0", pwm_value);
+static size_t cmd_curve(void *context, const command_args_t *args, char *reply, size_t size) {
+    uint8_t zone;
+    size_t len = 0;
+    if (!get_zone_arg(args, 0, &zone)) {
+        return reply_text(reply, size, snprintf(reply, size, "Error: Invalid zone. Must be below %u.\n\n", NUM_ZONES));
+    }
+    if (args->count < 2) {
+        for (uint z = 0; z < NUM_ZONES; z++) {
+            if (zone == CORE1_ZONE_ALL || zone == z) {
+                len += format_curve(z, reply + len, size - len);
             }
-        } else {
-            printf("Unknown command from client\n");
-            snprintf(sent_msg, sizeof(sent_msg), "Error: Unknown command\n\n\0");
         }
+        return len + reply_text(reply + len, size - len, snprintf(reply + len, size - len, "\n"));
+    }
+
+    fan_curve_t curve = { 0 };
+    if (strcmp(args->value[1].s, "off") != 0 && !fan_curve_parse(&curve, args->value[1].s)) {
+        return reply_text(reply, size, snprintf(reply, size,
+            "Error: Invalid curve. Give up to %u points C:duty rising in temperature and duty, within -40.0 to 100.0 C, "
+            "and an optional hysteresis up to 10.0 C, e.g. \"30:20,45:100 1.5\".\n\n", FAN_CURVE_MAX_POINTS));
+    }
+    fan_curve_t previous = settings.curves[zone];
+    settings.curves[zone] = curve;
+    seqlock_write(&curve_lock, settings.curves);
+    if (!send_core1_command(CORE1_CMD_SET_CURVE, zone, 0)) {
+        settings.curves[zone] = previous;
+        seqlock_write(&curve_lock, settings.curves);
+        return reply_text(reply, size, snprintf(reply, size, "Error: Controller busy, try again.\n\n"));
+    }
+    settings_changed = true;
+    printf("Fan curve of zone %u changed\n", zone);
+    len = format_curve(zone, reply, size);
+    return len + reply_text(reply + len, size - len, snprintf(reply + len, size - len, "\n"));
+}
+
+
+static size_t cmd_history(void *context, const command_args_t *args, char *reply, size_t size) {
+    // both inclusive, log clock in ms, which carries on across resets
+    uint32_t from_ms = args->value[0].u;
+    uint32_t to_ms = args->count > 1 ? args->value[1].u : UINT32_MAX;
+    printf("Exporting history %lu..%lu ms\n", (unsigned long)from_ms, (unsigned long)to_ms);
+    tcp_server_start_history(context, from_ms, to_ms);
+    // text header, followed by the encoded records (see history.h)
+    return reply_text(reply, size, snprintf(reply, size, "history\n"));
+}
+
 
-        memset(state->buffer_recv, 0, BUF_SIZE);    // Clear receive buffer for next command
-        state->recv_len = 0;  
-        
-        // Send another buffer
-        return tcp_server_send_data(arg, state->client_pcb, sent_msg);
+static const struct {
+    const char *name;
+    uint8_t fields;
+} SUBSCRIBE_FIELDS[] = {
+    { "temperature", TCP_SERVER_FIELD_TEMPERATURE },
+    { "humidity", TCP_SERVER_FIELD_HUMIDITY },
+    { "rpm", TCP_SERVER_FIELD_RPM },
+    { "duty", TCP_SERVER_FIELD_DUTY },
+    { "all", TCP_SERVER_FIELD_ALL },
+};
+
+
+static size_t cmd_subscribe(void *context, const command_args_t *args, char *reply, size_t size) {
+    uint32_t interval_ms = args->value[0].u;
+    const char *fields_arg = args->count > 1 ? args->value[1].s : "";
+    uint8_t fields = 0;
+    fields_arg += strspn(fields_arg, ", ");
+    while (*fields_arg != '\0') {
+        // whole names only, a typo is reported rather than dropped
+        size_t n = strcspn(fields_arg, ", ");
+        uint f = 0;
+        while (f < sizeof(SUBSCRIBE_FIELDS) / sizeof(SUBSCRIBE_FIELDS[0])
+               && !(strlen(SUBSCRIBE_FIELDS[f].name) == n && strncmp(fields_arg, SUBSCRIBE_FIELDS[f].name, n) == 0)) {
+            f++;
+        }
+        if (f == sizeof(SUBSCRIBE_FIELDS) / sizeof(SUBSCRIBE_FIELDS[0])) {
+            return reply_text(reply, size, snprintf(reply, size,
+                "Error: Unknown field %.*s. Use temperature,humidity,rpm,duty or all.\n\n", (int)n, fields_arg));
+        }
+        fields |= SUBSCRIBE_FIELDS[f].fields;
+        fields_arg += n;
+        fields_arg += strspn(fields_arg, ", ");
+    }
+    if (fields == 0) {
+        fields = TCP_SERVER_FIELD_ALL;
     }
-    return ERR_OK;
+    printf("Subscribing client, every %lu ms\n", (unsigned long)interval_ms);
+    tcp_server_subscribe(context, interval_ms, fields);
+    return reply_text(reply, size, snprintf(reply, size, "Subscribed\n\n"));
+}
+
+
+static size_t cmd_unsubscribe(void *context, const command_args_t *args, char *reply, size_t size) {
+    tcp_server_subscribe(context, 0, 0);
+    return reply_text(reply, size, snprintf(reply, size, "Unsubscribed\n\n"));
 }
 
 
-static err_t tcp_server_poll(void *arg, struct tcp_pcb *tpcb) {
-    return tcp_server_result(arg, -1); // no response is an error?
+static size_t cmd_sensor(void *context, const command_args_t *args, char *reply, size_t size) {
+    size_t len = 0;
+    for (uint i = 0; i < NUM_SENSORS; i++) {
+        // counters written by core 1, each read whole
+        const dht_acquire_t *sensor = &sensors[i];
+        uint32_t reads = sensor->reads, good = sensor->good;
+        char good_pct[FORMAT_TENTHS_SIZE];
+        format_tenths(good_pct, reads ? (uint32_t)((uint64_t)good * 1000 / reads) : 0);
+        len += reply_text(reply + len, size - len, snprintf(reply + len, size - len,
+            "Sensor on GPIO%u (zone %u):\nReads: %lu, good %lu (%s %%)\nTimeouts: %lu\nBad checksums: %lu\n"
+            "Recovered by retry: %lu\nRetry delay: %lu ms\n",
+            SENSORS[i].data_pin, SENSORS[i].zone, (unsigned long)reads, (unsigned long)good, good_pct,
+            (unsigned long)sensor->timeouts, (unsigned long)sensor->bad_checksums, (unsigned long)sensor->recovered,
+            (unsigned long)(sensor->backoff_us / 1000)));
+    }
+    return len + reply_text(reply + len, size - len, snprintf(reply + len, size - len, "\n"));
 }
 
 
-static void tcp_server_err(void *arg, err_t err) {
-    if (err != ERR_ABRT) {
-        DEBUG_printf("tcp_client_err_fn %d\n", err);
-        tcp_server_result(arg, err);
+static size_t cmd_tasks(void *context, const command_args_t *args, char *reply, size_t size) {
+    // the counters belong to each scheduler's core; a report may mix a run
+    // with the one before it, which is fine for statistics
+    const sched_t *scheds[] = { &core0_sched, &core1_sched };
+    size_t len = reply_text(reply, size, snprintf(reply, size, "Tasks:\n"));
+    for (uint core = 0; core < 2; core++) {
+        for (const sched_task_t *task = scheds[core]->tasks; task != NULL; task = task->next_task) {
+            uint32_t runs = task->runs;
+            len += reply_text(reply + len, size - len, snprintf(reply + len, size - len,
+                "%s (core %u): every %lu ms, %lu runs, %lu overruns, jitter %lu us mean %lu us max, longest run %lu us\n",
+                task->name, core, (unsigned long)(task->period_us / 1000), (unsigned long)runs,
+                (unsigned long)task->overruns, (unsigned long)(runs ? task->jitter_total_us / runs : 0),
+                (unsigned long)task->jitter_max_us, (unsigned long)task->run_max_us));
+        }
     }
+    return len + reply_text(reply + len, size - len, snprintf(reply + len, size - len, "\n"));
 }
 
 
-static err_t tcp_server_accept(void *arg, struct tcp_pcb *client_pcb, err_t err) {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
-    if (err != ERR_OK || client_pcb == NULL) {
-        DEBUG_printf("Failure in accept\n");
-        tcp_server_result(arg, err);
-        return ERR_VAL;
+static size_t cmd_telemetry(void *context, const command_args_t *args, char *reply, size_t size) {
+    if (telemetry.pcb == NULL) {
+        return reply_text(reply, size, snprintf(reply, size, "Telemetry off\n\n"));
     }
-    DEBUG_printf("Client connected\n");
+    return reply_text(reply, size, snprintf(reply, size,
+        "Telemetry to %s:%u every %u ms\nSent: %lu, failed %lu\n\n",
+        ipaddr_ntoa(&telemetry.group), telemetry.port, TELEMETRY_INTERVAL_MS,
+        (unsigned long)(telemetry.seq - telemetry.errors), (unsigned long)telemetry.errors));
+}
+
+
+static size_t cmd_wifi(void *context, const command_args_t *args, char *reply, size_t size) {
+    char downtime[FORMAT_TENTHS_SIZE], in_state[FORMAT_TENTHS_SIZE];
+    format_tenths(downtime, (int32_t)(wifi_link_downtime_ms(&wifi) / 100));
+    format_tenths(in_state, (int32_t)(absolute_time_diff_us(wifi.since, get_absolute_time()) / 100000));
+    return reply_text(reply, size, snprintf(reply, size,
+        "Wi-Fi: %s for %s s (link status %d)\nJoins: %lu, failed %lu\nDrops: %lu, reconnected %lu\n"
+        "Downtime: %s s\nRetry delay: %lu ms\n\n",
+        wifi_link_state_name(wifi.state), in_state, wifi.status, (unsigned long)wifi.attempts,
+        (unsigned long)wifi.failures, (unsigned long)wifi.drops, (unsigned long)wifi.reconnects, downtime,
+        (unsigned long)wifi.backoff_ms));
+}
+
+
+#if PERF_ENABLED
+static size_t cmd_perf(void *context, const command_args_t *args, char *reply, size_t size) {
+    return perf_report(reply, size);
+}
+#endif
+
+
+// to add a command, add a handler and a row here
+static const command_t COMMANDS[] = {
+    { "status",         "",     0, false, "status",                                 cmd_status },
+    { "setpwm",         "iu",   1, false, "setpwm <0-100, or -1 for auto> [zone]",  cmd_setpwm },
+    { "setpoint",       "tu",   1, false, "setpoint <-40.0 to 80.0> [zone]",        cmd_setpoint },
+    { "curve",          "us",   0, false, "curve [zone] [C:duty,... [hysteresis] | off]", cmd_curve },
+    { "history",        "uu",   0, true,  "history [from_ms] [to_ms]",              cmd_history },
+    { "subscribe",      "us",   0, false, "subscribe [interval_ms] [field,...]",    cmd_subscribe },
+    { "unsubscribe",    "",     0, false, "unsubscribe",                            cmd_unsubscribe },
+    { "sensor",         "",     0, false, "sensor",                                 cmd_sensor },
+    { "tasks",          "",     0, false, "tasks",                                  cmd_tasks },
+    { "telemetry",      "",     0, false, "telemetry",                              cmd_telemetry },
+    { "wifi",           "",     0, false, "wifi",                                   cmd_wifi },
+#if PERF_ENABLED
+    { "perf",           "",     0, false, "perf",                                   cmd_perf },
+#endif
+};
+
+static command_registry_t commands;
+
+
+// Runs a request from lwIP context; several commands may be separated by ';'
+static size_t execute_command(TCP_CONN_T *conn, const char *cmd, char *reply, size_t size) {
+    return command_execute(&commands, conn, cmd, reply, size);
+}
+
+
+//
+// metrics for the HTTP endpoint, in the Prometheus text format
+//
+
+static size_t metrics_printf(char *body, size_t size, size_t len, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    len += reply_text(body + len, size - len, vsnprintf(body + len, size - len, format, args));
+    va_end(args);
+    return len;
+}
 
-    state->client_pcb = client_pcb;
-    tcp_arg(client_pcb, state);
-    tcp_sent(client_pcb, tcp_server_sent);
-    tcp_recv(client_pcb, tcp_server_recv);
-    tcp_poll(client_pcb, tcp_server_poll, POLL_TIME_S * 2);
-    tcp_err(client_pcb, tcp_server_err);
 
-    return tcp_server_send_data(arg, state->client_pcb, NULL);
+static size_t metric_family(char *body, size_t size, size_t len, const char *name, const char *type,
+                            const char *help) {
+    return metrics_printf(body, size, len, "# HELP temp_sens_%s %s\n# TYPE temp_sens_%s %s\n",
+                          name, help, name, type);
 }
 
 
-static bool tcp_server_open(void *arg) {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
-    DEBUG_printf("Starting server at %s on port %u\n", ip4addr_ntoa(netif_ip4_addr(netif_list)), TCP_PORT);
+// Runs from lwIP context on the first scrape after a sample; all values are as of that sample
+static size_t render_metrics(void *user_data, char *body, size_t size) {
+    SYSTEM_STATE_ state;
+    seqlock_read(&sys_state_lock, &state);
+    char value[FORMAT_TENTHS_SIZE];
+    size_t len = 0;
 
-    struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
-    if (!pcb) {
-        DEBUG_printf("failed to create pcb\n");
-        return false;
+    len = metric_family(body, size, len, "temperature_celsius", "gauge", "Last good reading of the sensor.");
+    for (uint i = 0; i < NUM_SENSORS; i++) {
+        if (state.sensors[i].reading_age_ms != UINT32_MAX) {
+            format_tenths(value, state.sensors[i].temperature);
+            len = metrics_printf(body, size, len, "temp_sens_temperature_celsius{sensor=\"%u\",gpio=\"%u\",zone=\"%u\"} %s\n",
+                                 i, SENSORS[i].data_pin, SENSORS[i].zone, value);
+        }
+    }
+    len = metric_family(body, size, len, "humidity_percent", "gauge", "Last good relative humidity reading of the sensor.");
+    for (uint i = 0; i < NUM_SENSORS; i++) {
+        if (state.sensors[i].reading_age_ms != UINT32_MAX) {
+            format_tenths(value, state.sensors[i].humidity);
+            len = metrics_printf(body, size, len, "temp_sens_humidity_percent{sensor=\"%u\"} %s\n", i, value);
+        }
+    }
+    len = metric_family(body, size, len, "sensor_reading_age_seconds", "gauge", "Age of the last good reading.");
+    for (uint i = 0; i < NUM_SENSORS; i++) {
+        if (state.sensors[i].reading_age_ms != UINT32_MAX) {
+            format_tenths(value, (int32_t)(state.sensors[i].reading_age_ms / 100));
+            len = metrics_printf(body, size, len, "temp_sens_sensor_reading_age_seconds{sensor=\"%u\"} %s\n", i, value);
+        }
+    }
+
+    // counters written by core 1, each read whole
+    static const char *const COUNTER_NAMES[] = {
+        "sensor_reads_total", "sensor_good_reads_total", "sensor_timeouts_total", "sensor_bad_checksums_total",
+    };
+    static const char *const COUNTER_HELP[] = {
+        "Sensor reads started.", "Sensor reads with valid data.", "Sensor reads without a response.",
+        "Sensor reads with a bad checksum.",
+    };
+    uint32_t counts[4][NUM_SENSORS];
+    for (uint i = 0; i < NUM_SENSORS; i++) {
+        counts[0][i] = sensors[i].reads;
+        counts[1][i] = sensors[i].good;
+        counts[2][i] = sensors[i].timeouts;
+        counts[3][i] = sensors[i].bad_checksums;
+    }
+    for (uint c = 0; c < 4; c++) {
+        len = metric_family(body, size, len, COUNTER_NAMES[c], "counter", COUNTER_HELP[c]);
+        for (uint i = 0; i < NUM_SENSORS; i++) {
+            len = metrics_printf(body, size, len, "temp_sens_%s{sensor=\"%u\"} %lu\n", COUNTER_NAMES[c], i,
+                                 (unsigned long)counts[c][i]);
+        }
+    }
+
+    len = metric_family(body, size, len, "fan_rpm", "gauge", "Fan speed from the tachometer.");
+    for (uint i = 0; i < NUM_FANS; i++) {
+        len = metrics_printf(body, size, len, "temp_sens_fan_rpm{fan=\"%u\",gpio=\"%u\",zone=\"%u\"} %lu\n",
+                             i, FANS[i].pwm_pin, FANS[i].zone, (unsigned long)state.fans[i].rpm);
+    }
+    len = metric_family(body, size, len, "fan_stalled", "gauge", "1 if the fan is driven but not turning.");
+    for (uint i = 0; i < NUM_FANS; i++) {
+        len = metrics_printf(body, size, len, "temp_sens_fan_stalled{fan=\"%u\"} %u\n", i, state.fans[i].stalled);
     }
 
-    err_t err = tcp_bind(pcb, NULL, TCP_PORT);
-    if (err) {
-        DEBUG_printf("failed to bind to port %u\n", TCP_PORT);
-        return false;
+    len = metric_family(body, size, len, "zone_temperature_celsius", "gauge", "Hottest fresh sensor of the zone.");
+    for (uint z = 0; z < NUM_ZONES; z++) {
+        if (state.zones[z].has_input) {
+            format_tenths(value, state.zones[z].temperature);
+            len = metrics_printf(body, size, len, "temp_sens_zone_temperature_celsius{zone=\"%u\"} %s\n", z, value);
+        }
+    }
+    len = metric_family(body, size, len, "zone_setpoint_celsius", "gauge", "Temperature automatic control holds.");
+    for (uint z = 0; z < NUM_ZONES; z++) {
+        format_tenths(value, state.zones[z].setpoint);
+        len = metrics_printf(body, size, len, "temp_sens_zone_setpoint_celsius{zone=\"%u\"} %s\n", z, value);
+    }
+    len = metric_family(body, size, len, "zone_duty_percent", "gauge", "PWM duty of the zone's fans.");
+    for (uint z = 0; z < NUM_ZONES; z++) {
+        len = metrics_printf(body, size, len, "temp_sens_zone_duty_percent{zone=\"%u\"} %u\n", z, state.zones[z].duty);
+    }
+    len = metric_family(body, size, len, "zone_automatic", "gauge", "1 if the control loop sets the duty.");
+    for (uint z = 0; z < NUM_ZONES; z++) {
+        len = metrics_printf(body, size, len, "temp_sens_zone_automatic{zone=\"%u\"} %u\n", z, state.zones[z].fan_auto);
+    }
+    len = metric_family(body, size, len, "zone_curve", "gauge", "1 if automatic control follows a fan curve.");
+    for (uint z = 0; z < NUM_ZONES; z++) {
+        len = metrics_printf(body, size, len, "temp_sens_zone_curve{zone=\"%u\"} %u\n", z, state.zones[z].curve);
     }
 
-    state->server_pcb = tcp_listen_with_backlog(pcb, 1);
-    if (!state->server_pcb) {
-        DEBUG_printf("failed to listen\n");
-        if (pcb) {
-            tcp_close(pcb);
+    len = metric_family(body, size, len, "task_overruns_total", "counter", "Scheduler task runs that missed their deadline.");
+    const sched_t *scheds[] = { &core0_sched, &core1_sched };
+    for (uint core = 0; core < 2; core++) {
+        for (const sched_task_t *task = scheds[core]->tasks; task != NULL; task = task->next_task) {
+            len = metrics_printf(body, size, len, "temp_sens_task_overruns_total{task=\"%s\",core=\"%u\"} %lu\n",
+                                 task->name, core, (unsigned long)task->overruns);
         }
-        return false;
     }
+    len = metric_family(body, size, len, "samples_dropped_total", "counter", "Samples lost because core 0 fell behind.");
+    len = metrics_printf(body, size, len, "temp_sens_samples_dropped_total %lu\n", (unsigned long)sample_queue.dropped);
+    len = metric_family(body, size, len, "wifi_join_failures_total", "counter", "Wi-Fi joins that failed or timed out.");
+    len = metrics_printf(body, size, len, "temp_sens_wifi_join_failures_total %lu\n", (unsigned long)wifi.failures);
+    len = metric_family(body, size, len, "wifi_drops_total", "counter", "Wi-Fi link losses.");
+    len = metrics_printf(body, size, len, "temp_sens_wifi_drops_total %lu\n", (unsigned long)wifi.drops);
+    len = metric_family(body, size, len, "telemetry_send_failures_total", "counter", "Telemetry datagrams lwIP didn't take.");
+    len = metrics_printf(body, size, len, "temp_sens_telemetry_send_failures_total %lu\n", (unsigned long)telemetry.errors);
+    len = metric_family(body, size, len, "uptime_seconds", "gauge", "Time since boot.");
+    len = metrics_printf(body, size, len, "temp_sens_uptime_seconds %lu\n",
+                         (unsigned long)(to_ms_since_boot(get_absolute_time()) / 1000));
+    len = metric_family(body, size, len, "metrics_renders_total", "counter", "Times this body was rendered; scrapes between samples reuse it.");
+    len = metrics_printf(body, size, len, "temp_sens_metrics_renders_total %lu\n", (unsigned long)metrics.renders);
+    len = metric_family(body, size, len, "metrics_truncated_total", "counter", "Renders that didn't fit and lost their last lines.");
+    return metrics_printf(body, size, len, "temp_sens_metrics_truncated_total %lu\n", (unsigned long)metrics.truncated);
+}
+
 
-    tcp_arg(state->server_pcb, state);
-    tcp_accept(state->server_pcb, tcp_server_accept);
+// Runs on core 0 before anything that can fail, so a board without a network
+// still controls its fans
+static void start_control(void) {
+    log_time_base_ms = history_init();
+    printf("Recovered %lu samples from flash\n", (unsigned long)(flash_log_head() - flash_log_tail()));
 
-    return true;
+    // sensing and fan control live on core 1
+    for (uint z = 0; z < NUM_ZONES; z++) {
+        core1_state.zones[z].fan_auto = true;
+        core1_state.zones[z].setpoint = TEMP_SETPOINT;
+    }
+    for (uint i = 0; i < NUM_SENSORS; i++) {
+        core1_state.sensors[i].reading_age_ms = UINT32_MAX;
+    }
+    sys_state = core1_state;
+    seqlock_init(&sys_state_lock, &sys_state, sizeof(sys_state));
+    // curves saved before the reset apply from the start
+    if (!flash_settings_load(&settings, sizeof(settings))) {
+        memset(&settings, 0, sizeof(settings));
+    }
+    for (uint z = 0; z < NUM_ZONES; z++) {
+        if (!fan_curve_is_valid(&settings.curves[z])) {
+            settings.curves[z].num_points = 0;
+        }
+    }
+    memcpy(shared_curves, settings.curves, sizeof(shared_curves));
+    seqlock_init(&curve_lock, shared_curves, sizeof(shared_curves));
+    spsc_queue_init(&sample_queue, sample_storage, sizeof(history_sample_t), SAMPLE_QUEUE_LEN);
+    multicore_launch_core1(core1_main);
 }
 
 
-void run_tcp_server_test(void) {
-    TCP_SERVER_T *state = tcp_server_init();
-    if (!state) {
-        return;
+static void start_network(TCP_SERVER_T *state) {
+    cyw43_arch_lwip_begin();
+    bool server_opened = tcp_server_open(state);
+    // scrapes are served from a cache, so the command server isn't held up by them
+    bool metrics_opened = http_metrics_open(&metrics, render_metrics, NULL, metrics_storage, METRICS_BODY_SIZE);
+    cyw43_arch_lwip_end();
+    if (!server_opened) {
+        printf("Command server on port %u not started\n", TCP_PORT);
     }
-    if (!tcp_server_open(state)) {
-        tcp_server_result(state, -1);
-        return;
+    if (!metrics_opened) {
+        printf("Metrics endpoint on port %u not started\n", HTTP_METRICS_PORT);
     }
 
-    uint slice_num, chan;
-    fan_pwm_init(PWM_PIN, &slice_num, &chan, TACH_PIN);     // fan control init
+    // control is already running; the network comes up in the background
+    wifi_link_init(&wifi, WIFI_SSID, WIFI_PASSWORD, CYW43_AUTH_WPA2_AES_PSK);
+    sched_add(&core0_sched, &wifi_task, "wifi", wifi_task_fn, NULL, WIFI_CHECK_PERIOD_MS * 1000, 10000);
+    // an empty TELEMETRY_GROUP builds without the publisher
+    if (TELEMETRY_GROUP[0] != '\0') {
+        cyw43_arch_lwip_begin();
+        bool opened = telemetry_init(&telemetry, TELEMETRY_GROUP, TELEMETRY_PORT);
+        cyw43_arch_lwip_end();
+        if (opened) {
+            sched_add(&core0_sched, &telemetry_task, "telemetry", telemetry_task_fn, NULL,
+                      TELEMETRY_INTERVAL_MS * 1000, 10000);
+        } else {
+            printf("Telemetry to %s not started\n", TELEMETRY_GROUP);
+        }
+    }
+}
 
-    int temp_mem = 0;
-    int prev_temp_mem = 0;
 
-    dht_t dht;
-    dht_init(&dht, DHT_MODEL, pio0, DATA_PIN, true /* pull_up */);
+// A failed radio, socket or endpoint only disables that part of the network,
+// the loop keeps logging and saving settings either way
+void run_tcp_server_test(void) {
+    command_registry_init(&commands, COMMANDS, sizeof(COMMANDS) / sizeof(COMMANDS[0]));
+    TCP_SERVER_T *state = tcp_server_init(execute_command);
+    sched_init(&core0_sched, NULL);
+    if (network_up) {
+        start_network(state);
+    }
 
     while(!state->complete) {
         // the following #ifdef is only here so this same example can be used in multiple modes;
@@ -410,23 +1044,42 @@ void run_tcp_server_test(void) {
 #if PICO_CYW43_ARCH_POLL
         // if you are using pico_cyw43_arch_poll, then you must poll periodically from your
         // main loop (not from a timer) to check for Wi-Fi driver or lwIP work that needs to be done.
-        cyw43_arch_poll();
+        if (network_up) {
+            cyw43_arch_poll();
+        }
+        drain_samples();
+        save_settings();
+        sched_run(&core0_sched);
         // you can poll as often as you like, however if you have nothing else to do you can
-        // choose to sleep until either a specified time, or cyw43_arch_poll() has work to do:
-        cyw43_arch_wait_for_work_until(make_timeout_time_ms(1000));
+        // choose to sleep until either the next task is due, or cyw43_arch_poll() has work to do:
+        if (network_up) {
+            cyw43_arch_wait_for_work_until(sched_next_release(&core0_sched));
+        } else {
+            best_effort_wfe_or_timeout(sched_next_release(&core0_sched));
+        }
 #else
         // if you are not using pico_cyw43_arch_poll, then WiFI driver and lwIP work
-        // is done via interrupt in the background. This sleep is just an example of some (blocking)
-        // work you might be doing.
-
-        get_system_state(&dht, slice_num, chan, &temp_mem, &prev_temp_mem);
-
-        sleep_ms(2000);
+        // is done via interrupt in the background. Core 1 raises an event with
+        // every new sample, the scheduler's alarm when a task is due.
+        drain_samples();
+        save_settings();
+        sched_run(&core0_sched);
+        __wfe();
 #endif
     }
 
-    tcp_server_close(state);
-    free(state);
+    multicore_reset_core1();
+    dht_scanner_deinit(&scanner);
+    for (uint i = 0; i < NUM_FANS; i++) {
+        tach_deinit(&tachs[i]);
+    }
+    if (network_up) {
+        cyw43_arch_lwip_begin();
+        telemetry_deinit(&telemetry);
+        http_metrics_close(&metrics);
+        tcp_server_close(state);
+        cyw43_arch_lwip_end();
+    }
 }
 
 
@@ -434,25 +1087,19 @@ int main() {
     stdio_init_all();   // serial output
     puts("\nDHT test");
 
+    // sensing and control start right away, Wi-Fi joins alongside them
+    start_control();
     if (cyw43_arch_init()) {
-        printf("failed to initialise\n");
-        return 1;
-    }
-
-    cyw43_arch_enable_sta_mode();
-    ip_addr_t* ip_address = malloc(sizeof(ip_addr_t));
-
-    connect_wifi:
-    printf("Connecting to Wi-Fi...\n");
-    if (cyw43_arch_wifi_connect_timeout_ms(WIFI_SSID, WIFI_PASSWORD, CYW43_AUTH_WPA2_AES_PSK, 30000)) {
-        printf("failed to connect.\n");
-        goto connect_wifi;
+        printf("failed to initialise, running without network\n");
     } else {
-        printf("Connected.\n");
+        cyw43_arch_enable_sta_mode();
+        network_up = true;
     }
 
     run_tcp_server_test();
-    cyw43_arch_deinit();
+    if (network_up) {
+        cyw43_arch_deinit();
+    }
 
     return 0;
 }
@@ -0,0 +1,121 @@
+#include "wifi_link.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/cyw43_arch.h"
+
+
+static int link_status(void) {
+    cyw43_arch_lwip_begin();
+    int status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+    cyw43_arch_lwip_end();
+    return status;
+}
+
+
+static void enter(wifi_link_t *link, wifi_link_state_t state) {
+    link->state = state;
+    link->since = get_absolute_time();
+}
+
+
+static uint32_t elapsed_ms(absolute_time_t since) {
+    return (uint32_t)(absolute_time_diff_us(since, get_absolute_time()) / 1000);
+}
+
+
+// Give up on a join and wait before the next, longer after every failure
+static void fail(wifi_link_t *link, const char *reason) {
+    link->failures++;
+    cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+    if (link->backoff_ms == 0) {
+        link->backoff_ms = WIFI_LINK_RETRY_MS;
+    } else if (link->backoff_ms < WIFI_LINK_MAX_BACKOFF_MS) {
+        link->backoff_ms *= 2;
+    }
+    printf("Wi-Fi join failed (%s), retrying in %lu ms\n", reason, (unsigned long)link->backoff_ms);
+    enter(link, WIFI_LINK_BACKOFF);
+}
+
+
+static void start_join(wifi_link_t *link) {
+    link->attempts++;
+    enter(link, WIFI_LINK_CONNECTING);
+    if (cyw43_arch_wifi_connect_async(link->ssid, link->password, link->auth) != 0) {
+        fail(link, "not started");
+    }
+}
+
+
+void wifi_link_init(wifi_link_t *link, const char *ssid, const char *password, uint32_t auth) {
+    memset(link, 0, sizeof(wifi_link_t));
+    link->ssid = ssid;
+    link->password = password;
+    link->auth = auth;
+    link->status = CYW43_LINK_DOWN;
+    link->down_since = get_absolute_time();
+    printf("Connecting to Wi-Fi...\n");
+    start_join(link);
+}
+
+
+void wifi_link_update(wifi_link_t *link) {
+    int status = link_status();
+    link->status = status;
+
+    switch (link->state) {
+        case WIFI_LINK_CONNECTING:
+            if (status == CYW43_LINK_UP) {
+                uint32_t outage_ms = elapsed_ms(link->down_since);
+                link->downtime_ms += outage_ms;
+                link->backoff_ms = 0;
+                if (link->drops > 0) {
+                    link->reconnects++;
+                }
+                enter(link, WIFI_LINK_UP);
+                printf("Wi-Fi link up at %s after %lu ms\n", ip4addr_ntoa(netif_ip4_addr(netif_list)),
+                       (unsigned long)outage_ms);
+            } else if (status == CYW43_LINK_BADAUTH) {
+                fail(link, "bad password");
+            } else if (status == CYW43_LINK_NONET) {
+                fail(link, "network not found");
+            } else if (status == CYW43_LINK_FAIL) {
+                fail(link, "error");
+            } else if (elapsed_ms(link->since) >= WIFI_LINK_CONNECT_TIMEOUT_MS) {
+                fail(link, "timeout");
+            }
+            break;
+
+        case WIFI_LINK_UP:
+            if (status != CYW43_LINK_UP) {
+                // the first join after a drop goes out right away
+                link->drops++;
+                link->down_since = get_absolute_time();
+                printf("Wi-Fi link down (%d), reconnecting\n", status);
+                cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+                start_join(link);
+            }
+            break;
+
+        case WIFI_LINK_BACKOFF:
+            if (elapsed_ms(link->since) >= link->backoff_ms) {
+                start_join(link);
+            }
+            break;
+    }
+}
+
+
+uint64_t wifi_link_downtime_ms(const wifi_link_t *link) {
+    return link->downtime_ms + (link->state == WIFI_LINK_UP ? 0 : elapsed_ms(link->down_since));
+}
+
+
+const char *wifi_link_state_name(wifi_link_state_t state) {
+    switch (state) {
+        case WIFI_LINK_CONNECTING:  return "connecting";
+        case WIFI_LINK_UP:          return "up";
+        case WIFI_LINK_BACKOFF:     return "waiting to retry";
+    }
+    return "?";
+}
@@ -0,0 +1,87 @@
+#ifndef _WIFI_LINK_H_
+#define _WIFI_LINK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "pico/time.h"
+
+/** \file wifi_link.h
+ *
+ * \brief Wi-Fi connection manager that never blocks.
+ *
+ * A small state machine on the asynchronous cyw43 join and the link status.
+ * It joins the network, and after the link drops it joins again. A join that
+ * fails, or isn't up within WIFI_LINK_CONNECT_TIMEOUT_MS, is retried after
+ * WIFI_LINK_RETRY_MS. The delay doubles with every further failure, up to
+ * WIFI_LINK_MAX_BACKOFF_MS, so an access point that is down isn't flooded
+ * with joins. Each step returns immediately. Sampling and control never wait
+ * for the network, during startup or during an outage.
+ *
+ * Call wifi_link_update() periodically from the core that runs lwIP.
+ */
+
+#define WIFI_LINK_CONNECT_TIMEOUT_MS 30000
+#define WIFI_LINK_RETRY_MS 1000
+#define WIFI_LINK_MAX_BACKOFF_MS 64000
+
+typedef enum wifi_link_state_t {
+    WIFI_LINK_CONNECTING,   // join in progress
+    WIFI_LINK_UP,
+    WIFI_LINK_BACKOFF,      // waiting to retry after a failed join
+} wifi_link_state_t;
+
+/**
+ * \brief Connection manager state and statistics.
+ */
+typedef struct wifi_link_t {
+    const char *ssid;
+    const char *password;
+    uint32_t auth;
+    wifi_link_state_t state;
+    int status;                 // last cyw43 link status
+    absolute_time_t since;      // entered the current state
+    absolute_time_t down_since; // link lost, or init
+    uint32_t backoff_ms;        // delay before the next join, 0 after the link was up
+    // statistics
+    uint32_t attempts;          // joins started
+    uint32_t failures;          // joins failed or timed out
+    uint32_t drops;             // link lost while up
+    uint32_t reconnects;        // link up again after a drop
+    uint64_t downtime_ms;       // of the outages that ended
+} wifi_link_t;
+
+/**
+ * \brief Start joining a network.
+ *
+ * Station mode must be enabled. The first join starts here.
+ *
+ * \param link Manager.
+ * \param ssid Network name, must stay valid.
+ * \param password Password, must stay valid.
+ * \param auth cyw43 authorization type, e.g. CYW43_AUTH_WPA2_AES_PSK.
+ */
+void wifi_link_init(wifi_link_t *link, const char *ssid, const char *password, uint32_t auth);
+
+/**
+ * \brief Check the join or the link and take the next step.
+ */
+void wifi_link_update(wifi_link_t *link);
+
+/**
+ * \brief Whether the link is up with an address.
+ */
+static inline bool wifi_link_is_up(const wifi_link_t *link) {
+    return link->state == WIFI_LINK_UP;
+}
+
+/**
+ * \brief Time the link has been down since init, including an ongoing outage.
+ */
+uint64_t wifi_link_downtime_ms(const wifi_link_t *link);
+
+/**
+ * \brief Name of a state, for reports.
+ */
+const char *wifi_link_state_name(wifi_link_state_t state);
+
+#endif // _WIFI_LINK_H_